@@ -1,7 +1,28 @@
-#include "wotto.h"
+// Native host for wotto modules, used to test and benchmark module code
+// without a wasm runtime.
+//
+// Any exported function can be called by name: the harness is linked with
+// -rdynamic, so module functions are found with dlsym().
+//
+// Usage:
+//   wotto-native <function> <input>
+//       Run the function once and print its output.
+//   wotto-native -c <corpus> [-n <iterations>] <function>
+//       Run the function on each line of the corpus file, `iterations` times
+//       per line, and print one line per input: the mean time per call in
+//       nanoseconds, a tab, and the output (with \, tab and newline escaped).
+//       This is the format expected by `wotto-cli diffbench`.
 
 #ifndef __wasm32
 
+#define _GNU_SOURCE
+#include "wotto.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MAX_OUTPUT ((size_t)512)
@@ -13,6 +34,8 @@ size_t input_length;
 u8 output_data[MAX_OUTPUT];
 size_t output_length;
 
+int verbose = 1;
+
 unsigned int input(u8 *buf, int len) {
     if (len < input_length) {
         memcpy(buf, input_data, len);
@@ -23,13 +46,17 @@ unsigned int input(u8 *buf, int len) {
 }
 
 void output(const u8 *buf, int len) {
-    write(STDERR_FILENO, "out: '", 6);
-    write(STDERR_FILENO, buf, len);
-    write(STDERR_FILENO, "'\n", 2);
+    if (verbose) {
+        write(STDERR_FILENO, "out: '", 6);
+        write(STDERR_FILENO, buf, len);
+        write(STDERR_FILENO, "'\n", 2);
+    }
 
     size_t new_length = output_length + len;
     if (new_length > MAX_OUTPUT) {
-        write(STDERR_FILENO, "warning: discarding output bytes\n", 33);
+        if (verbose) {
+            write(STDERR_FILENO, "warning: discarding output bytes\n", 33);
+        }
         new_length = MAX_OUTPUT;
     }
     size_t actual_size = new_length - output_length;
@@ -39,31 +66,49 @@ void output(const u8 *buf, int len) {
     output_length += actual_size;
 }
 
-size_t _strnlen(const char* str, size_t buflen) {
-    size_t i;
-    for (i = 0; i < buflen; i++) {
-        if (str[i] == 0) {
-            return i;
-        }
+typedef void (*wotto_function)(void);
+
+static wotto_function find_function(const char *name) {
+    wotto_function f;
+    // the POSIX way to convert void * to a function pointer
+    *(void **)(&f) = dlsym(RTLD_DEFAULT, name);
+    if (!f) {
+        fprintf(stderr, "no such function: %s\n", name);
     }
-    return buflen;
+    return f;
 }
 
-// TODO: dynamically choose function
-#define EXPORTED_FUNC cp
-void EXPORTED_FUNC(void);
+static void set_input(const char *data, size_t len) {
+    input_length = len < MAX_INPUT ? len : MAX_INPUT;
+    memcpy(input_data, data, input_length);
+}
 
-int main(int argc, const char* argv[]) {
-    if (argc != 3) {
-        write(STDERR_FILENO, "expected args: <function> <args>\n", 33);
-        return 1;
-    }
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-    // TODO: dynamically choose function
-    void(*f)(void) = &EXPORTED_FUNC;
+static void print_escaped(const u8 *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        switch (buf[i]) {
+        case '\\':
+            fputs("\\\\", stdout);
+            break;
+        case '\t':
+            fputs("\\t", stdout);
+            break;
+        case '\n':
+            fputs("\\n", stdout);
+            break;
+        default:
+            putchar(buf[i]);
+        }
+    }
+}
 
-    input_length = _strnlen(argv[2], MAX_INPUT);
-    memcpy(input_data, argv[2], input_length);
+static int run_once(wotto_function f, const char *arg) {
+    set_input(arg, strlen(arg));
     output_length = 0;
     f();
 
@@ -73,4 +118,67 @@ int main(int argc, const char* argv[]) {
     return 0;
 }
 
+static int run_corpus(wotto_function f, const char *corpus_path, long iterations) {
+    FILE *corpus = fopen(corpus_path, "r");
+    if (!corpus) {
+        perror(corpus_path);
+        return 1;
+    }
+    verbose = 0;
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    while ((len = getline(&line, &capacity, corpus)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            len--;
+        }
+        set_input(line, len);
+        long long start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            output_length = 0;
+            f();
+        }
+        long long elapsed = now_ns() - start;
+        printf("%lld\t", elapsed / iterations);
+        print_escaped(output_data, output_length);
+        putchar('\n');
+    }
+    free(line);
+    fclose(corpus);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *corpus_path = NULL;
+    long iterations = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:")) != -1) {
+        switch (opt) {
+        case 'c':
+            corpus_path = optarg;
+            break;
+        case 'n':
+            iterations = atol(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (corpus_path && optind == argc - 1 && iterations > 0) {
+        wotto_function f = find_function(argv[optind]);
+        return f ? run_corpus(f, corpus_path, iterations) : 1;
+    } else if (!corpus_path && optind == argc - 2) {
+        wotto_function f = find_function(argv[optind]);
+        return f ? run_once(f, argv[optind + 1]) : 1;
+    }
+
+usage:
+    fprintf(stderr,
+            "usage: %s <function> <input>\n"
+            "       %s -c <corpus> [-n <iterations>] <function>\n",
+            argv[0], argv[0]);
+    return 1;
+}
+
 #endif // ifndef __wasm32
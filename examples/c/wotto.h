@@ -2,14 +2,28 @@
 
 #include <stddef.h>
 
+typedef unsigned char u8;
+
+// The output of a command defined with WottoReturningFunction: len bytes of
+// UTF-8 text at ptr, which must still be valid after the function returns
+// (e.g. a static buffer).
+typedef struct {
+    const u8 *ptr;
+    int len;
+} WottoOutput;
+
 #ifdef __wasm32
 
 #define WottoFunction(name) __attribute__((export_name(#name))) void name(void)
+// Returning the struct as two values needs the multivalue ABI:
+// -mmultivalue -Xclang -target-abi -Xclang experimental-mv
+#define WottoReturningFunction(name) __attribute__((export_name(#name))) WottoOutput name(void)
 #define WOTTO_IMPORT(module, name) __attribute__((import_module(#module), import_name(#name)))
 
 #else // ifdef __wasm32
 
 #define WottoFunction(name) void name(void)
+#define WottoReturningFunction(name) WottoOutput name(void)
 #define WOTTO_IMPORT(module, name)
 
 #endif // ifdef __wasm32
@@ -19,8 +33,6 @@
 // Copy n bytes from src to dst.
 void *memcpy(void *restrict dst, const void *restrict src, size_t n);
 
-typedef unsigned char u8;
-
 // Read the input string into buf. At most len bytes will be copied. Return the
 // length of the input string.
 //
@@ -43,10 +55,101 @@ WOTTO_IMPORT(wotto, input) unsigned int input(u8 *buf, int len);
 // number of bytes (typically 512). This function will not report an error if
 // the limit is exceeded, but the output will be truncated. If the output is
 // truncated in the middle of a UTF-8 sequence, this can result in invalid
-// UTF-8, which is handled as above.
+// UTF-8, which is handled as above. Use output_capacity() to find out how
+// much output still fits.
 //
-// TODO: there is currently no way to inspect the limit
+// The operator can mark a module as stoppable: then, as soon as its output
+// is full, this function does not return and the command ends there (this is
+// not an error). Don't rely on code after the last output() running.
 //
 // You must expect output to be shown only after the command returns. There is
 // currently no facility to stream output.
 WOTTO_IMPORT(wotto, output) void output(const u8 *buf, int len);
+
+// Return how many more bytes output() accepts before the output is truncated.
+// Once anything has been truncated, this returns 0.
+WOTTO_IMPORT(wotto, output_capacity) int output_capacity(void);
+
+// Look up key in the cache of this module, and copy the value into buf. At
+// most buf_len bytes will be copied. Return the length of the value, which
+// can be larger than buf_len, or -1 if the key is not in the cache.
+//
+// Each module has its own cache, which survives between invocations (and
+// possibly restarts of the bot), but entries can be evicted at any time.
+WOTTO_IMPORT(wotto, cache_get) int cache_get(const u8 *key, int key_len, u8 *buf, int buf_len);
+
+// Store a value in the cache of this module, replacing any previous value for
+// the same key. Return 0 on success, or -1 if the value was not stored because
+// it is too large, or because the module is over its quota.
+WOTTO_IMPORT(wotto, cache_put) int cache_put(const u8 *key, int key_len, const u8 *value, int value_len);
+
+// Remove a key from the cache of this module. Return 1 if the key was in the
+// cache, 0 otherwise.
+WOTTO_IMPORT(wotto, cache_delete) int cache_delete(const u8 *key, int key_len);
+
+// Open a read-only blob registered by the operator (e.g. a word list).
+// Return a handle for blob_len() and blob_read(), or -1 if there is no blob
+// with the given name.
+//
+// Blobs are shared by all modules and are not copied into the module memory,
+// so prefer them to large static arrays for reference data.
+WOTTO_IMPORT(wotto, blob_open) int blob_open(const char *name, int name_len);
+
+// Return the size of an open blob in bytes, or -1 if the handle is not valid.
+WOTTO_IMPORT(wotto, blob_len) int blob_len(int handle);
+
+// Copy up to len bytes of an open blob, starting at offset, into buf. Return
+// the number of bytes copied, which is less than len only at the end of the
+// blob, or -1 if the handle or the offset are not valid.
+WOTTO_IMPORT(wotto, blob_read) int blob_read(int handle, int offset, u8 *buf, int len);
+
+// Pause for ms milliseconds (at most 1000 per call). Other modules can run in
+// the meantime, but the pause still counts towards the time limit of the
+// command.
+WOTTO_IMPORT(wotto, sleep) void sleep_ms(int ms);
+
+// Text functions, implemented natively by the host. They are usually much
+// faster than the equivalent code compiled to wasm. Lengths and offsets are
+// in bytes.
+
+// Return -1 if buf is valid UTF-8, otherwise the offset of the first invalid
+// byte.
+WOTTO_IMPORT(wotto.text, utf8_validate) int utf8_validate(const u8 *buf, int len);
+
+// Return the number of codepoints in buf, or -1 if it is not valid UTF-8.
+WOTTO_IMPORT(wotto.text, utf8_count) int utf8_count(const u8 *buf, int len);
+
+// Reverse buf in place, keeping grapheme clusters (such as flags, or letters
+// with combining accents) intact. Return 0, or -1 if buf is not valid UTF-8,
+// in which case it is left unchanged.
+WOTTO_IMPORT(wotto.text, reverse_graphemes) int reverse_graphemes(u8 *buf, int len);
+
+// Write the case folded version of src into dst, which must not overlap. At
+// most dst_len bytes are written, always ending on a codepoint boundary.
+// Return the length of the whole folded text, which can be larger than
+// dst_len, or -1 if src is not valid UTF-8.
+WOTTO_IMPORT(wotto.text, casefold) int casefold(const u8 *src, int src_len, u8 *dst, int dst_len);
+
+// Return the offset of the first occurrence of needle in haystack, or -1 if
+// there is none.
+WOTTO_IMPORT(wotto.text, find) int find(const u8 *haystack, int haystack_len, const u8 *needle, int needle_len);
+
+// Regular expressions, compiled and run by the host, with the syntax of the
+// Rust regex crate (https://docs.rs/regex). Compiled patterns are cached, so
+// compiling the same pattern on every call is cheap. Offsets are in bytes,
+// relative to the start of the haystack.
+
+// Return a handle for the other regex_* functions, or -1 if the pattern is
+// not valid, or too long or complex.
+WOTTO_IMPORT(wotto.regex, compile) int regex_compile(const char *pattern, int pattern_len);
+
+// Return 1 if the pattern matches anywhere in haystack, 0 if it does not, or
+// -1 if the handle is not valid.
+WOTTO_IMPORT(wotto.regex, is_match) int regex_is_match(int handle, const u8 *haystack, int haystack_len);
+
+// Find the first match at or after start. On a match, write up to max_spans
+// pairs of start and end offsets into spans (the whole match, then each
+// capture group; -1, -1 for groups that did not match) and return the number
+// of pairs the pattern has. Return -1 if there is no match, or if the handle
+// or start are not valid.
+WOTTO_IMPORT(wotto.regex, find) int regex_find(int handle, const u8 *haystack, int haystack_len, int start, int *spans, int max_spans);
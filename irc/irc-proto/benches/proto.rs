@@ -0,0 +1,144 @@
+//! Throughput of parsing and serializing messages.
+//!
+//! The corpus under `benches/corpus` is meant to look like real traffic: tag-heavy
+//! IRCv3 lines, long PRIVMSGs (some with formatting), mode floods, and NAMES replies.
+//! The same files can be used as seeds for the `roundtrip` fuzz target.
+
+use bytes::BytesMut;
+use criterion::{black_box, criterion_group, criterion_main, BatchSize, Criterion, Throughput};
+use irc_proto::line::LineCodec;
+use irc_proto::{ChannelMode, Command, FormattedStringExt, Message, Mode};
+use tokio_util::codec::{Decoder, Encoder};
+
+const CORPUS: &[(&str, &str)] = &[
+    ("tags", include_str!("corpus/tags.txt")),
+    ("privmsg", include_str!("corpus/privmsg.txt")),
+    ("modes", include_str!("corpus/modes.txt")),
+    ("names", include_str!("corpus/names.txt")),
+];
+
+fn lines(corpus: &str) -> Vec<&str> {
+    corpus.split_inclusive('\n').collect()
+}
+
+fn bench_parse(c: &mut Criterion) {
+    let mut group = c.benchmark_group("Message::from_str");
+    for (name, corpus) in CORPUS {
+        let lines = lines(corpus);
+        group.throughput(Throughput::Bytes(corpus.len() as u64));
+        group.bench_function(*name, |b| {
+            b.iter(|| {
+                for line in &lines {
+                    black_box(line.parse::<Message>().unwrap());
+                }
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_serialize(c: &mut Criterion) {
+    let mut group = c.benchmark_group("Message::to_string");
+    for (name, corpus) in CORPUS {
+        let messages: Vec<Message> = lines(corpus)
+            .into_iter()
+            .map(|line| line.parse().unwrap())
+            .collect();
+        group.throughput(Throughput::Bytes(corpus.len() as u64));
+        group.bench_function(*name, |b| {
+            b.iter(|| {
+                for message in &messages {
+                    black_box(message.to_string());
+                }
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_line_codec(c: &mut Criterion) {
+    let mut group = c.benchmark_group("LineCodec");
+    for (name, corpus) in CORPUS {
+        group.throughput(Throughput::Bytes(corpus.len() as u64));
+        group.bench_function(format!("decode/{}", name), |b| {
+            let mut codec = LineCodec::new("utf-8").unwrap();
+            b.iter_batched_ref(
+                || BytesMut::from(*corpus),
+                |buf| while codec.decode(buf).unwrap().is_some() {},
+                BatchSize::SmallInput,
+            )
+        });
+        let lines: Vec<String> = lines(corpus).into_iter().map(str::to_owned).collect();
+        group.bench_function(format!("encode/{}", name), |b| {
+            let mut codec = LineCodec::new("utf-8").unwrap();
+            b.iter_batched(
+                || (lines.clone(), BytesMut::with_capacity(corpus.len())),
+                |(lines, mut buf)| {
+                    for line in lines {
+                        codec.encode(line, &mut buf).unwrap();
+                    }
+                    buf
+                },
+                BatchSize::SmallInput,
+            )
+        });
+    }
+    group.finish();
+}
+
+fn bench_modes(c: &mut Criterion) {
+    // the arguments of MODE after the channel name, as the parser sees them
+    let (_, corpus) = CORPUS.iter().find(|(name, _)| *name == "modes").unwrap();
+    let pieces: Vec<Vec<&str>> = lines(corpus)
+        .into_iter()
+        .map(|line| line.split_whitespace().skip(3).collect())
+        .collect();
+    let mut group = c.benchmark_group("Mode::as_channel_modes");
+    group.throughput(Throughput::Elements(pieces.len() as u64));
+    group.bench_function("modes", |b| {
+        b.iter(|| {
+            for args in &pieces {
+                black_box(Mode::<ChannelMode>::as_channel_modes(args).unwrap());
+            }
+        })
+    });
+    group.finish();
+}
+
+fn bench_strip_formatting(c: &mut Criterion) {
+    let (_, corpus) = CORPUS.iter().find(|(name, _)| *name == "privmsg").unwrap();
+    let texts: Vec<String> = lines(corpus)
+        .into_iter()
+        .filter_map(|line| match line.parse::<Message>().unwrap().command {
+            Command::PRIVMSG(_, text) => Some(text),
+            _ => None,
+        })
+        .collect();
+    let (formatted, plain): (Vec<_>, Vec<_>) = texts
+        .iter()
+        .map(String::as_str)
+        .partition(|text| text.is_formatted());
+    let mut group = c.benchmark_group("strip_formatting");
+    for (name, texts) in [("formatted", formatted), ("plain", plain)] {
+        let bytes: usize = texts.iter().map(|text| text.len()).sum();
+        group.throughput(Throughput::Bytes(bytes as u64));
+        group.bench_function(name, |b| {
+            b.iter(|| {
+                for text in &texts {
+                    black_box(text.strip_formatting());
+                }
+            })
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(
+    benches,
+    bench_parse,
+    bench_serialize,
+    bench_line_codec,
+    bench_modes,
+    bench_strip_formatting
+);
+criterion_main!(benches);
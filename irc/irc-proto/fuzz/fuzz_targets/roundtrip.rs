@@ -0,0 +1,38 @@
+//! Parse → serialize → parse must give back the same message.
+//!
+//! Inputs are split into lines, so the benchmark corpus files can be used as
+//! seeds: `cargo fuzz run roundtrip fuzz/corpus/roundtrip benches/corpus`
+
+#![no_main]
+
+use irc_proto::Message;
+use libfuzzer_sys::fuzz_target;
+
+fuzz_target!(|data: &[u8]| {
+    if let Ok(text) = std::str::from_utf8(data) {
+        for line in text.split_inclusive('\n') {
+            roundtrip(line);
+        }
+    }
+});
+
+fn roundtrip(line: &str) {
+    let message = match line.parse::<Message>() {
+        Ok(message) => message,
+        Err(_) => return,
+    };
+    let serialized = message.to_string();
+    let reparsed = match serialized.parse::<Message>() {
+        Ok(reparsed) => reparsed,
+        Err(err) => panic!(
+            "serialized message cannot be parsed: {:?} -> {:?} ({})",
+            line, serialized, err
+        ),
+    };
+    assert_eq!(
+        message, reparsed,
+        "round trip changed the message: {:?} -> {:?}",
+        line, serialized
+    );
+    assert_eq!(serialized, reparsed.to_string());
+}
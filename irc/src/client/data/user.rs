@@ -78,6 +78,15 @@ impl User {
         self.access_levels.clone()
     }
 
+    /// Gets an estimate of the memory used by this user, in bytes.
+    pub fn heap_size(&self) -> usize {
+        std::mem::size_of::<User>()
+            + self.nickname.capacity()
+            + self.username.as_ref().map_or(0, String::capacity)
+            + self.hostname.as_ref().map_or(0, String::capacity)
+            + self.access_levels.capacity() * std::mem::size_of::<AccessLevel>()
+    }
+
     /// Updates the user's access level.
     pub fn update_access_level(&mut self, mode: &Mode<ChannelMode>) {
         match *mode {
@@ -64,7 +64,10 @@ use std::{
     fmt,
     path::Path,
     pin::Pin,
-    sync::Arc,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
     task::{Context, Poll},
 };
 use tokio::sync::mpsc::{self, UnboundedReceiver, UnboundedSender};
@@ -820,12 +823,17 @@ impl ClientState {
 #[derive(Debug, Clone)]
 pub struct Sender {
     tx_outgoing: UnboundedSender<Message>,
+    /// Messages sent through any clone of this sender and not yet taken by
+    /// the outgoing future.
+    queued: Arc<AtomicUsize>,
 }
 
 impl Sender {
     /// Send a single message to the unbounded queue.
     pub fn send<M: Into<Message>>(&self, msg: M) -> error::Result<()> {
-        Ok(self.tx_outgoing.send(msg.into())?)
+        self.tx_outgoing.send(msg.into())?;
+        self.queued.fetch_add(1, Ordering::Relaxed);
+        Ok(())
     }
 
     pub_state_base!();
@@ -840,6 +848,7 @@ pub struct Outgoing {
     sink: SplitSink<Connection, Message>,
     stream: UnboundedReceiver<Message>,
     buffered: Option<Message>,
+    queued: Arc<AtomicUsize>,
 }
 
 impl Outgoing {
@@ -880,7 +889,14 @@ impl Future for Outgoing {
 
         loop {
             match this.stream.poll_recv(cx) {
-                Poll::Ready(Some(message)) => ready!(this.try_start_send(cx, message))?,
+                Poll::Ready(Some(message)) => {
+                    // messages sent by the connection itself (e.g. pings)
+                    // bypass the sender and are not counted
+                    let _ = this
+                        .queued
+                        .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |n| n.checked_sub(1));
+                    ready!(this.try_start_send(cx, message))?
+                }
                 Poll::Ready(None) => {
                     ready!(Pin::new(&mut this.sink).poll_flush(cx))?;
                     return Poll::Ready(Ok(()));
@@ -940,7 +956,11 @@ impl Client {
 
         let (sink, incoming) = conn.split();
 
-        let sender = Sender { tx_outgoing };
+        let queued = Arc::new(AtomicUsize::new(0));
+        let sender = Sender {
+            tx_outgoing,
+            queued: queued.clone(),
+        };
 
         Ok(Client {
             sender: sender.clone(),
@@ -950,6 +970,7 @@ impl Client {
                 sink,
                 stream: rx_outgoing,
                 buffered: None,
+                queued,
             }),
             #[cfg(test)]
             view,
@@ -1050,6 +1071,28 @@ impl Client {
         None
     }
 
+    /// Gets an estimate of the memory used to track the users of the joined channels, in bytes.
+    /// This is always 0 if tracking is disabled via the `nochanlists` feature.
+    #[cfg(not(feature = "nochanlists"))]
+    pub fn chanlists_size(&self) -> usize {
+        self.state
+            .chanlists
+            .read()
+            .iter()
+            .map(|(chan, users)| chan.capacity() + users.iter().map(User::heap_size).sum::<usize>())
+            .sum()
+    }
+
+    #[cfg(feature = "nochanlists")]
+    pub fn chanlists_size(&self) -> usize {
+        0
+    }
+
+    /// Gets the number of messages that have been sent but not yet written to the connection.
+    pub fn queued_messages(&self) -> usize {
+        self.sender.queued.load(Ordering::Relaxed)
+    }
+
     /// Gets the current nickname in use. This may be the primary username set in the configuration,
     /// or it could be any of the alternative nicknames listed as well. As a result, this is the
     /// preferred way to refer to the client's nickname.
@@ -1451,6 +1494,7 @@ mod test {
             client.list_users("#test").unwrap(),
             vec![User::new("&admin"), User::new("~owner"),]
         );
+        assert!(client.chanlists_size() > 0);
         Ok(())
     }
 
@@ -1742,6 +1786,17 @@ mod test {
         Ok(())
     }
 
+    #[tokio::test]
+    async fn queued_messages() -> Result<()> {
+        let mut client = Client::from_config(test_config()).await?;
+        client.send_notice("#test", "Hi, everybody!")?;
+        client.send_notice("#test", "Bye, everybody!")?;
+        assert_eq!(client.queued_messages(), 2);
+        client.stream()?.collect().await?;
+        assert_eq!(client.queued_messages(), 0);
+        Ok(())
+    }
+
     #[tokio::test]
     async fn send_topic_no_topic() -> Result<()> {
         let mut client = Client::from_config(test_config()).await?;
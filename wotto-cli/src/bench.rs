@@ -0,0 +1,238 @@
+//! `bench` subcommand: measure a module before loading it into the bot.
+
+use std::path::PathBuf;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use anyhow::Result;
+use clap::Args;
+use serde_json::json;
+use wotto_engine::{RunStats, Service};
+
+#[derive(Debug, Args)]
+pub(crate) struct BenchArgs {
+    /// Module to load (.wasm or .wat)
+    module: PathBuf,
+    /// Entry point to invoke
+    entry_point: String,
+    /// Input for the entry point (joined with spaces, like on IRC)
+    #[arg(trailing_var_arg = true, allow_hyphen_values = true)]
+    args: Vec<String>,
+    /// Number of measured invocations
+    #[arg(short = 'n', long, default_value_t = 1000, value_parser = clap::value_parser!(u64).range(1..))]
+    iterations: u64,
+    /// Number of concurrent callers
+    #[arg(short, long, default_value_t = 1, value_parser = clap::value_parser!(u64).range(1..))]
+    concurrency: u64,
+    /// Invocations before measuring (at least one is always done)
+    #[arg(long, default_value_t = 10)]
+    warmup: u64,
+    /// Print the report as JSON
+    #[arg(long)]
+    json: bool,
+}
+
+struct Sample {
+    latency: Duration,
+    stats: RunStats,
+}
+
+pub(crate) async fn bench(args: BenchArgs) -> Result<()> {
+    let svc = Arc::new(Service::new());
+    let weak = Arc::downgrade(&svc);
+    let _epoch_timer = Service::epoch_timer(move || weak.upgrade());
+
+    let start = Instant::now();
+    let module = svc.load_module_from_file(&args.module).await?;
+    let compile_time = start.elapsed();
+
+    let input = args.args.join(" ");
+    // the first call checks that the entry point works at all
+    let output = svc.run_module(&module, &args.entry_point, &input).await?;
+    for _ in 1..args.warmup {
+        svc.run_module(&module, &args.entry_point, &input).await?;
+    }
+
+    let start = Instant::now();
+    let callers: Vec<_> = (0..args.concurrency)
+        .map(|i| {
+            let svc = svc.clone();
+            let module = module.clone();
+            let entry_point = args.entry_point.clone();
+            let input = input.clone();
+            let calls = args.iterations / args.concurrency
+                + u64::from(i < args.iterations % args.concurrency);
+            tokio::spawn(async move {
+                let mut samples = Vec::with_capacity(calls as usize);
+                for _ in 0..calls {
+                    let call_start = Instant::now();
+                    let (_, stats) = svc
+                        .run_module_with_stats(&module, &entry_point, &input)
+                        .await?;
+                    samples.push(Sample {
+                        latency: call_start.elapsed(),
+                        stats,
+                    });
+                }
+                anyhow::Ok(samples)
+            })
+        })
+        .collect();
+    let mut samples = Vec::with_capacity(args.iterations as usize);
+    for caller in callers {
+        samples.extend(caller.await??);
+    }
+    let wall_time = start.elapsed();
+
+    let report = Report::new(&args, module, compile_time, wall_time, &samples, output);
+    if args.json {
+        println!("{}", report.to_json());
+    } else {
+        report.print();
+    }
+    Ok(())
+}
+
+struct Report {
+    module: String,
+    entry_point: String,
+    iterations: u64,
+    concurrency: u64,
+    compile_time: Duration,
+    wall_time: Duration,
+    latency: Percentiles,
+    mean_instantiate: Duration,
+    mean_execute: Duration,
+    peak_guest_memory: usize,
+    peak_rss: Option<u64>,
+    output: String,
+}
+
+impl Report {
+    fn new(
+        args: &BenchArgs,
+        module: String,
+        compile_time: Duration,
+        wall_time: Duration,
+        samples: &[Sample],
+        output: String,
+    ) -> Self {
+        let mut latencies: Vec<_> = samples.iter().map(|sample| sample.latency).collect();
+        latencies.sort();
+        let count = samples.len().max(1) as u32;
+        Self {
+            module,
+            entry_point: args.entry_point.clone(),
+            iterations: samples.len() as u64,
+            concurrency: args.concurrency,
+            compile_time,
+            wall_time,
+            latency: Percentiles::new(&latencies),
+            mean_instantiate: samples
+                .iter()
+                .map(|s| s.stats.instantiate)
+                .sum::<Duration>()
+                / count,
+            mean_execute: samples.iter().map(|s| s.stats.execute).sum::<Duration>() / count,
+            peak_guest_memory: samples
+                .iter()
+                .map(|s| s.stats.peak_memory)
+                .max()
+                .unwrap_or_default(),
+            peak_rss: peak_rss(),
+            output,
+        }
+    }
+
+    fn throughput(&self) -> f64 {
+        self.iterations as f64 / self.wall_time.as_secs_f64()
+    }
+
+    fn print(&self) {
+        println!("module:            {}", self.module);
+        println!("entry point:       {}", self.entry_point);
+        println!("output:            {}", self.output);
+        println!("compile time:      {:?}", self.compile_time);
+        println!(
+            "invocations:       {} ({} concurrent)",
+            self.iterations, self.concurrency
+        );
+        println!("throughput:        {:.1} calls/s", self.throughput());
+        let l = &self.latency;
+        println!(
+            "latency:           min {:?}  p50 {:?}  p90 {:?}  p99 {:?}  max {:?}",
+            l.min, l.p50, l.p90, l.p99, l.max
+        );
+        println!("mean instantiate:  {:?}", self.mean_instantiate);
+        println!("mean execute:      {:?}", self.mean_execute);
+        println!("peak guest memory: {} bytes", self.peak_guest_memory);
+        if let Some(peak_rss) = self.peak_rss {
+            println!("peak process rss:  {} bytes", peak_rss);
+        }
+    }
+
+    fn to_json(&self) -> serde_json::Value {
+        fn us(duration: Duration) -> f64 {
+            duration.as_secs_f64() * 1e6
+        }
+        let l = &self.latency;
+        json!({
+            "module": self.module,
+            "entry_point": self.entry_point,
+            "output": self.output,
+            "iterations": self.iterations,
+            "concurrency": self.concurrency,
+            "compile_time_us": us(self.compile_time),
+            "wall_time_us": us(self.wall_time),
+            "throughput_per_s": self.throughput(),
+            "latency_us": {
+                "min": us(l.min),
+                "p50": us(l.p50),
+                "p90": us(l.p90),
+                "p99": us(l.p99),
+                "max": us(l.max),
+            },
+            "mean_instantiate_us": us(self.mean_instantiate),
+            "mean_execute_us": us(self.mean_execute),
+            "peak_guest_memory_bytes": self.peak_guest_memory,
+            "peak_rss_bytes": self.peak_rss,
+        })
+    }
+}
+
+struct Percentiles {
+    min: Duration,
+    p50: Duration,
+    p90: Duration,
+    p99: Duration,
+    max: Duration,
+}
+
+impl Percentiles {
+    /// `sorted` must be sorted in ascending order.
+    fn new(sorted: &[Duration]) -> Self {
+        // nearest-rank method
+        let percentile = |p: f64| {
+            let rank = (p / 100.0 * sorted.len() as f64).ceil() as usize;
+            sorted
+                .get(rank.clamp(1, sorted.len().max(1)) - 1)
+                .copied()
+                .unwrap_or_default()
+        };
+        Self {
+            min: sorted.first().copied().unwrap_or_default(),
+            p50: percentile(50.0),
+            p90: percentile(90.0),
+            p99: percentile(99.0),
+            max: sorted.last().copied().unwrap_or_default(),
+        }
+    }
+}
+
+/// Peak resident set size of this process, where available (Linux).
+fn peak_rss() -> Option<u64> {
+    let status = std::fs::read_to_string("/proc/self/status").ok()?;
+    let line = status.lines().find(|line| line.starts_with("VmHWM:"))?;
+    let kilobytes: u64 = line.split_whitespace().nth(1)?.parse().ok()?;
+    Some(kilobytes * 1024)
+}
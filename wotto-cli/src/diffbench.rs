@@ -0,0 +1,257 @@
+//! `diffbench` subcommand: run the same entry point natively and as wasm on
+//! the same inputs, check that the outputs agree, and report how much the
+//! wasm path costs on top of the native code.
+//!
+//! The native side is the `wotto-native` harness from `examples/c`, which
+//! prints one `<nanoseconds per call>\t<escaped output>` line per input.
+
+use std::path::PathBuf;
+use std::process::Command;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use anyhow::{bail, Context, Result};
+use clap::Args;
+use serde_json::json;
+use wotto_engine::{HostCallStats, Service};
+
+#[derive(Debug, Args)]
+pub(crate) struct DiffBenchArgs {
+    /// Module to load (.wasm or .wat)
+    module: PathBuf,
+    /// Entry point to invoke
+    entry_point: String,
+    /// Native harness built from the same sources (e.g. examples/c/wotto-native)
+    #[arg(long)]
+    native: PathBuf,
+    /// Input corpus, one input per line
+    #[arg(long)]
+    corpus: PathBuf,
+    /// Number of measured invocations per input, on each side
+    #[arg(short = 'n', long, default_value_t = 1000, value_parser = clap::value_parser!(u32).range(1..))]
+    iterations: u32,
+    /// Print the report as JSON
+    #[arg(long)]
+    json: bool,
+}
+
+/// Measurements for one line of the corpus. Times are per call.
+struct Row {
+    input: String,
+    native: Duration,
+    wasm: Duration,
+    instantiate: Duration,
+    execute: Duration,
+    host_calls: HostCallStats,
+    matches: bool,
+}
+
+pub(crate) async fn diffbench(args: DiffBenchArgs) -> Result<()> {
+    let corpus = std::fs::read_to_string(&args.corpus)
+        .with_context(|| format!("cannot read {}", args.corpus.display()))?;
+    let inputs: Vec<&str> = corpus.split_terminator('\n').collect();
+    let native = run_native(&args)?;
+    if native.len() != inputs.len() {
+        bail!(
+            "native harness returned {} results for {} inputs",
+            native.len(),
+            inputs.len()
+        );
+    }
+
+    let svc = Arc::new(Service::new());
+    let weak = Arc::downgrade(&svc);
+    let _epoch_timer = Service::epoch_timer(move || weak.upgrade());
+    let module = svc.load_module_from_file(&args.module).await?;
+
+    let mut rows = Vec::with_capacity(inputs.len());
+    for (input, (native_time, native_output)) in inputs.iter().zip(native) {
+        // warm up, and take the output to compare
+        let output = svc.run_module(&module, &args.entry_point, input).await?;
+        let mut row = Row {
+            input: input.to_string(),
+            native: native_time,
+            wasm: Duration::ZERO,
+            instantiate: Duration::ZERO,
+            execute: Duration::ZERO,
+            host_calls: HostCallStats::default(),
+            matches: escape(&output) == native_output,
+        };
+        for _ in 0..args.iterations {
+            let start = Instant::now();
+            let (_, stats) = svc
+                .run_module_with_stats(&module, &args.entry_point, input)
+                .await?;
+            row.wasm += start.elapsed();
+            row.instantiate += stats.instantiate;
+            row.execute += stats.execute;
+            row.host_calls.calls += stats.host_calls.calls;
+            row.host_calls.time += stats.host_calls.time;
+            row.host_calls.bytes_in += stats.host_calls.bytes_in;
+            row.host_calls.bytes_out += stats.host_calls.bytes_out;
+        }
+        row.wasm /= args.iterations;
+        row.instantiate /= args.iterations;
+        row.execute /= args.iterations;
+        row.host_calls.calls /= args.iterations;
+        row.host_calls.time /= args.iterations;
+        row.host_calls.bytes_in /= args.iterations as usize;
+        row.host_calls.bytes_out /= args.iterations as usize;
+        rows.push(row);
+    }
+
+    let report = Report {
+        module,
+        entry_point: args.entry_point,
+        iterations: args.iterations,
+        rows,
+    };
+    if args.json {
+        println!("{}", report.to_json());
+    } else {
+        report.print();
+    }
+    if report.mismatches() > 0 {
+        bail!("{} outputs differ", report.mismatches());
+    }
+    Ok(())
+}
+
+/// Run the native harness on the corpus and parse its results.
+fn run_native(args: &DiffBenchArgs) -> Result<Vec<(Duration, String)>> {
+    let result = Command::new(&args.native)
+        .arg("-c")
+        .arg(&args.corpus)
+        .arg("-n")
+        .arg(args.iterations.to_string())
+        .arg(&args.entry_point)
+        .output()
+        .with_context(|| format!("cannot run {}", args.native.display()))?;
+    if !result.status.success() {
+        bail!(
+            "native harness failed ({}): {}",
+            result.status,
+            String::from_utf8_lossy(&result.stderr).trim()
+        );
+    }
+    // the output might not be valid UTF-8 if it was truncated mid-sequence
+    String::from_utf8_lossy(&result.stdout)
+        .lines()
+        .map(|line| {
+            let (nanos, output) = line
+                .split_once('\t')
+                .context("unexpected output from native harness")?;
+            let nanos = nanos
+                .parse()
+                .context("unexpected output from native harness")?;
+            Ok((Duration::from_nanos(nanos), output.to_string()))
+        })
+        .collect()
+}
+
+/// Escape an output the same way the native harness does.
+fn escape(output: &str) -> String {
+    output
+        .replace('\\', "\\\\")
+        .replace('\t', "\\t")
+        .replace('\n', "\\n")
+}
+
+struct Report {
+    module: String,
+    entry_point: String,
+    iterations: u32,
+    rows: Vec<Row>,
+}
+
+impl Report {
+    fn mismatches(&self) -> usize {
+        self.rows.iter().filter(|row| !row.matches).count()
+    }
+
+    fn mean(&self, f: impl Fn(&Row) -> Duration) -> Duration {
+        self.rows.iter().map(f).sum::<Duration>() / self.rows.len().max(1) as u32
+    }
+
+    fn print(&self) {
+        println!("module:      {}", self.module);
+        println!("entry point: {}", self.entry_point);
+        println!("iterations:  {} per input", self.iterations);
+        println!();
+        println!(
+            "{:>10} {:>10} {:>10} {:>12} {:>10} {:>6} {:>8}  input",
+            "native", "wasm", "overhead", "instantiate", "host", "calls", "copied"
+        );
+        for row in &self.rows {
+            let mut input: String = row.input.chars().take(30).collect();
+            if !row.matches {
+                input.insert_str(0, "MISMATCH ");
+            }
+            println!(
+                "{:>10?} {:>10?} {:>10?} {:>12?} {:>10?} {:>6} {:>8}  {input}",
+                row.native,
+                row.wasm,
+                row.wasm.saturating_sub(row.native),
+                row.instantiate,
+                row.host_calls.time,
+                row.host_calls.calls,
+                row.host_calls.bytes_in + row.host_calls.bytes_out,
+            );
+        }
+        println!();
+        let native = self.mean(|row| row.native);
+        let wasm = self.mean(|row| row.wasm);
+        let instantiate = self.mean(|row| row.instantiate);
+        let execute = self.mean(|row| row.execute);
+        let host = self.mean(|row| row.host_calls.time);
+        println!("mean per call:");
+        println!("  native:           {native:?}");
+        println!("  wasm:             {wasm:?}");
+        println!("    instantiate:    {instantiate:?}");
+        println!("    execute:        {execute:?}");
+        println!("      host calls:   {host:?}");
+        println!(
+            "    other:          {:?}",
+            wasm.saturating_sub(instantiate + execute)
+        );
+        println!("  overhead:         {:?}", wasm.saturating_sub(native));
+        println!(
+            "outputs:            {} of {} match",
+            self.rows.len() - self.mismatches(),
+            self.rows.len()
+        );
+    }
+
+    fn to_json(&self) -> serde_json::Value {
+        fn ns(duration: Duration) -> u128 {
+            duration.as_nanos()
+        }
+        let rows: Vec<_> = self
+            .rows
+            .iter()
+            .map(|row| {
+                json!({
+                    "input": row.input,
+                    "matches": row.matches,
+                    "native_ns": ns(row.native),
+                    "wasm_ns": ns(row.wasm),
+                    "instantiate_ns": ns(row.instantiate),
+                    "execute_ns": ns(row.execute),
+                    "host_calls": row.host_calls.calls,
+                    "host_call_ns": ns(row.host_calls.time),
+                    "bytes_in": row.host_calls.bytes_in,
+                    "bytes_out": row.host_calls.bytes_out,
+                })
+            })
+            .collect();
+        json!({
+            "module": self.module,
+            "entry_point": self.entry_point,
+            "iterations": self.iterations,
+            "mismatches": self.mismatches(),
+            "mean_native_ns": ns(self.mean(|row| row.native)),
+            "mean_wasm_ns": ns(self.mean(|row| row.wasm)),
+            "inputs": rows,
+        })
+    }
+}
@@ -1,7 +1,65 @@
-use anyhow::Result;
+use std::path::PathBuf;
+
+use anyhow::{Context, Result};
+use clap::{Args, Parser, Subcommand};
+use tokio::fs::File;
+use tokio::io::BufReader;
 use wotto_engine::repl;
 
+mod bench;
+mod diffbench;
+mod precompile;
+
+#[derive(Debug, Parser)]
+#[command(version, about = "Tools for wotto modules")]
+struct Cli {
+    #[command(subcommand)]
+    command: Option<CliCommand>,
+}
+
+#[derive(Debug, Subcommand)]
+enum CliCommand {
+    /// Interactive shell for the engine (default)
+    Repl(ReplArgs),
+    /// Benchmark an entry point of a local module
+    Bench(bench::BenchArgs),
+    /// Compare an entry point against a native build of the same module
+    Diffbench(diffbench::DiffBenchArgs),
+    /// Compile modules into a bundle that the bot can load without compiling
+    Precompile(precompile::PrecompileArgs),
+}
+
+#[derive(Debug, Default, Args)]
+struct ReplArgs {
+    /// Run the commands in FILE ("-" for stdin) instead of prompting
+    #[arg(long, value_name = "FILE")]
+    script: Option<PathBuf>,
+    /// Maximum number of script commands running at the same time
+    #[arg(short, long, default_value_t = 1, requires = "script")]
+    jobs: u32,
+}
+
 #[tokio::main]
 async fn main() -> Result<()> {
-    repl::repl().await
+    let cli = Cli::parse();
+    match cli
+        .command
+        .unwrap_or_else(|| CliCommand::Repl(ReplArgs::default()))
+    {
+        CliCommand::Repl(args) => match args.script {
+            None => repl::repl().await,
+            Some(path) if path.as_os_str() == "-" => {
+                repl::batch(BufReader::new(tokio::io::stdin()), args.jobs).await
+            }
+            Some(path) => {
+                let file = File::open(&path)
+                    .await
+                    .with_context(|| format!("cannot open {}", path.display()))?;
+                repl::batch(BufReader::new(file), args.jobs).await
+            }
+        },
+        CliCommand::Bench(args) => bench::bench(args).await,
+        CliCommand::Diffbench(args) => diffbench::diffbench(args).await,
+        CliCommand::Precompile(args) => precompile::precompile(args),
+    }
 }
@@ -0,0 +1,35 @@
+//! `precompile` subcommand: compile modules at deploy time.
+
+use std::path::PathBuf;
+
+use anyhow::Result;
+use clap::Args;
+use wotto_engine::Service;
+
+#[derive(Debug, Args)]
+pub(crate) struct PrecompileArgs {
+    /// Output directory for the bundle
+    #[arg(short, long)]
+    output: PathBuf,
+    /// Modules to compile (.wasm or .wat)
+    #[arg(required = true)]
+    modules: Vec<PathBuf>,
+}
+
+pub(crate) fn precompile(args: PrecompileArgs) -> Result<()> {
+    let svc = Service::new();
+    let manifest = svc.write_bundle(&args.output, &args.modules)?;
+    for module in &manifest.modules {
+        println!(
+            "{}: {} -> {} bytes in {:.1} ms",
+            module.name, module.source_size, module.artifact_size, module.compile_time_ms
+        );
+    }
+    println!(
+        "wrote {} modules to {} (engine: {})",
+        manifest.modules.len(),
+        args.output.display(),
+        manifest.engine
+    );
+    Ok(())
+}
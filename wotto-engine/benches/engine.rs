@@ -0,0 +1,475 @@
+//! Benchmarks for the hot paths of the engine.
+//!
+//! Run with `cargo bench -p wotto-engine --features bench`. Fixtures are
+//! checked in under `benches/fixtures` so that this works offline.
+
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+use tokio::runtime::Runtime;
+use wotto_engine::bench::{decode_assemblyscript_string, BenchRegistry};
+use wotto_engine::{CacheConfig, CustomSections, Service, ThreadConfig};
+
+const FOO_WAT: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/benches/fixtures/foo.wat");
+const CACHE_WAT: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/benches/fixtures/cache.wat");
+const TEXT_WAT: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/benches/fixtures/text.wat");
+const REGEX_WAT: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/benches/fixtures/regex.wat");
+const SLEEP_WAT: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/benches/fixtures/sleep.wat");
+const PARALLEL_WAT: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/benches/fixtures/parallel.wat");
+const BLOB_WAT: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/benches/fixtures/blob.wat");
+
+const SHORT_INPUT: &str = "hello wotto";
+const LONG_INPUT: &str = "Ünïcödé text with some emoji 🐕🐈 and a few more words to make it \
+                          long enough to be interesting, like an average IRC line would be.";
+
+fn runtime() -> Runtime {
+    tokio::runtime::Builder::new_multi_thread()
+        .enable_all()
+        .build()
+        .unwrap()
+}
+
+fn foo_wasm() -> Vec<u8> {
+    wat::parse_file(FOO_WAT).expect("fixture should be valid")
+}
+
+/// Make a service with a running epoch timer, like the bot does.
+fn service(rt: &Runtime) -> Arc<Service> {
+    service_with(rt, |_| {})
+}
+
+fn service_with(rt: &Runtime, configure: impl FnOnce(&mut Service)) -> Arc<Service> {
+    let mut svc = Service::new();
+    configure(&mut svc);
+    let svc = Arc::new(svc);
+    let weak = Arc::downgrade(&svc);
+    let _guard = rt.enter();
+    let _ = Service::epoch_timer(move || weak.upgrade());
+    svc
+}
+
+fn bench_load_module(c: &mut Criterion) {
+    let rt = runtime();
+    let svc = service(&rt);
+    let svc = &*svc;
+    let wasm = &foo_wasm();
+    c.bench_function("load_module/foo", |b| {
+        b.to_async(&rt)
+            .iter(|| async move { svc.load_module_from_bytes("foo", wasm).await.unwrap() })
+    });
+}
+
+/// Append a custom section to a module, like the DWARF sections of a debug
+/// build.
+fn with_custom_section(mut wasm: Vec<u8>, name: &str, len: usize) -> Vec<u8> {
+    fn leb128(mut value: usize, out: &mut Vec<u8>) {
+        loop {
+            let byte = (value & 0x7f) as u8;
+            value >>= 7;
+            if value == 0 {
+                out.push(byte);
+                return;
+            }
+            out.push(byte | 0x80);
+        }
+    }
+    let mut payload = vec![];
+    leb128(name.len(), &mut payload);
+    payload.extend_from_slice(name.as_bytes());
+    payload.resize(payload.len() + len, 0);
+    wasm.push(0);
+    leb128(payload.len(), &mut wasm);
+    wasm.extend(payload);
+    wasm
+}
+
+fn bench_custom_sections(c: &mut Criterion) {
+    let rt = runtime();
+    let wasm = &with_custom_section(foo_wasm(), ".debug_str", 1 << 20);
+    let mut group = c.benchmark_group("load_module/debug");
+    for (name, policy) in [
+        ("keep", CustomSections::Keep),
+        ("strip-debug", CustomSections::StripDebug),
+    ] {
+        let svc = service_with(&rt, |svc| svc.set_custom_sections(policy));
+        let svc = &*svc;
+        group.bench_function(name, |b| {
+            b.to_async(&rt)
+                .iter(|| async move { svc.load_module_from_bytes("foo", wasm).await.unwrap() })
+        });
+    }
+    group.finish();
+}
+
+fn bench_run_module(c: &mut Criterion) {
+    let rt = runtime();
+    let svc = service(&rt);
+    let svc = &*svc;
+    let wasm = &foo_wasm();
+    rt.block_on(svc.load_module_from_bytes("foo", wasm))
+        .unwrap();
+
+    let mut group = c.benchmark_group("run_module");
+    for entry_point in ["rev", "rev_ret", "cp"] {
+        for (input_name, input) in [("short", SHORT_INPUT), ("long", LONG_INPUT)] {
+            let id = format!("{entry_point}/{input_name}");
+            // cold: first invocation after the module is (re)compiled
+            group.bench_function(BenchmarkId::new("cold", &id), |b| {
+                b.iter_batched(
+                    || {
+                        rt.block_on(svc.load_module_from_bytes("foo", wasm))
+                            .unwrap()
+                    },
+                    |_| {
+                        rt.block_on(svc.run_module("foo", entry_point, input))
+                            .unwrap()
+                    },
+                    BatchSize::PerIteration,
+                )
+            });
+            group.bench_function(BenchmarkId::new("warm", &id), |b| {
+                b.to_async(&rt).iter(|| async move {
+                    svc.run_module("foo", entry_point, input).await.unwrap()
+                })
+            });
+            // warm, reusing the output buffer
+            group.bench_function(BenchmarkId::new("warm_into", &id), |b| {
+                let mut output = String::new();
+                b.iter(|| {
+                    rt.block_on(svc.run_module_into("foo", entry_point, input, &mut output))
+                        .unwrap()
+                })
+            });
+        }
+    }
+    group.finish();
+}
+
+fn bench_host_calls(c: &mut Criterion) {
+    let rt = runtime();
+    let svc = service(&rt);
+    let svc = &*svc;
+    rt.block_on(svc.load_module_from_bytes("foo", &foo_wasm()))
+        .unwrap();
+
+    // noop is the baseline; echo adds one input and one output call;
+    // roundtrip does 100 of each, so the per-call cost is the difference
+    // with noop divided by 200.
+    let mut group = c.benchmark_group("host_calls");
+    for entry_point in ["noop", "echo", "roundtrip"] {
+        group.bench_function(entry_point, |b| {
+            b.to_async(&rt).iter(|| async move {
+                svc.run_module("foo", entry_point, SHORT_INPUT)
+                    .await
+                    .unwrap()
+            })
+        });
+    }
+    group.finish();
+}
+
+/// Lay out an AssemblyScript string object in a fresh memory buffer and
+/// return the buffer along with the pointer to the string payload.
+fn assemblyscript_string(text: &str) -> (Vec<u8>, u32) {
+    const AS_CLASS_ID_STRING: u32 = 2;
+    const PAYLOAD_OFFSET: usize = 32;
+    let payload: Vec<u8> = text.encode_utf16().flat_map(u16::to_le_bytes).collect();
+    let header = [0, 0, 0, AS_CLASS_ID_STRING, payload.len() as u32];
+    let header_offset = PAYLOAD_OFFSET - header.len() * 4;
+    let mut memory = vec![0u8; PAYLOAD_OFFSET + payload.len()];
+    for (i, field) in header.iter().enumerate() {
+        memory[header_offset + i * 4..][..4].copy_from_slice(&field.to_le_bytes());
+    }
+    memory[PAYLOAD_OFFSET..].copy_from_slice(&payload);
+    (memory, PAYLOAD_OFFSET as u32)
+}
+
+fn bench_assemblyscript(c: &mut Criterion) {
+    let mut group = c.benchmark_group("assemblyscript_string");
+    for (name, text) in [("short", SHORT_INPUT), ("long", LONG_INPUT)] {
+        let (memory, ptr) = assemblyscript_string(text);
+        assert_eq!(
+            decode_assemblyscript_string(&memory, ptr).as_deref(),
+            Some(text)
+        );
+        group.throughput(Throughput::Bytes(text.len() as u64));
+        group.bench_function(name, |b| {
+            b.iter(|| decode_assemblyscript_string(&memory, ptr).unwrap())
+        });
+    }
+    group.finish();
+}
+
+fn bench_concurrency(c: &mut Criterion) {
+    let rt = runtime();
+    let svc = service(&rt);
+    rt.block_on(svc.load_module_from_bytes("foo", &foo_wasm()))
+        .unwrap();
+
+    let mut group = c.benchmark_group("concurrent_callers");
+    group.throughput(Throughput::Elements(1));
+    for callers in [1u64, 2, 4, 8, 16] {
+        group.bench_function(BenchmarkId::new("rev", callers), |b| {
+            b.iter_custom(|iters| run_concurrently(&rt, &svc, callers, iters, "foo", "rev"))
+        });
+    }
+    group.finish();
+}
+
+/// Make `iters` calls split among `callers` tasks, and return the time it
+/// took for all of them to finish.
+fn run_concurrently(
+    rt: &Runtime,
+    svc: &Arc<Service>,
+    callers: u64,
+    iters: u64,
+    module: &'static str,
+    entry_point: &'static str,
+) -> Duration {
+    rt.block_on(async {
+        let start = Instant::now();
+        let tasks: Vec<_> = (0..callers)
+            .map(|i| {
+                let svc = svc.clone();
+                let calls = iters / callers + u64::from(i < iters % callers);
+                tokio::spawn(async move {
+                    for _ in 0..calls {
+                        svc.run_module(module, entry_point, LONG_INPUT)
+                            .await
+                            .unwrap();
+                    }
+                })
+            })
+            .collect();
+        for task in tasks {
+            task.await.unwrap();
+        }
+        start.elapsed()
+    })
+}
+
+fn bench_suspended(c: &mut Criterion) {
+    let rt = runtime();
+    let svc = service_with(&rt, |svc| svc.set_execution_slots(2));
+    let wasm = wat::parse_file(SLEEP_WAT).expect("fixture should be valid");
+    rt.block_on(svc.load_module_from_bytes("sleep", &wasm))
+        .unwrap();
+
+    // with 2 execution slots, throughput should still grow with the number
+    // of callers, since sleeping guests give back their slot
+    let mut group = c.benchmark_group("suspended_callers");
+    group.throughput(Throughput::Elements(1));
+    for callers in [1u64, 2, 8, 32] {
+        group.bench_function(BenchmarkId::new("nap", callers), |b| {
+            b.iter_custom(|iters| run_concurrently(&rt, &svc, callers, iters, "sleep", "nap"))
+        });
+    }
+    group.finish();
+}
+
+fn bench_parallel(c: &mut Criterion) {
+    let rt = runtime();
+    let wasm = &wat::parse_file(PARALLEL_WAT).expect("fixture should be valid");
+    let mut group = c.benchmark_group("parallel");
+    // the same 16 tasks, with 1 to 4 workers
+    for workers in [1usize, 2, 4] {
+        let svc = service_with(&rt, |svc| {
+            svc.enable_threads(ThreadConfig {
+                max_threads: 3,
+                max_per_call: workers,
+            });
+            svc.set_threaded("parallel", true);
+        });
+        rt.block_on(svc.load_module_from_bytes("parallel", wasm))
+            .unwrap();
+        let svc = &*svc;
+        group.bench_function(BenchmarkId::new("hash", workers), |b| {
+            b.to_async(&rt).iter(|| async move {
+                svc.run_module("parallel", "hash_parallel", "")
+                    .await
+                    .unwrap()
+            })
+        });
+    }
+    let svc = service_with(&rt, |svc| {
+        svc.enable_threads(ThreadConfig::default());
+        svc.set_threaded("parallel", true);
+    });
+    rt.block_on(svc.load_module_from_bytes("parallel", wasm))
+        .unwrap();
+    let svc = &*svc;
+    group.bench_function("hash_serial", |b| {
+        b.to_async(&rt)
+            .iter(|| async move { svc.run_module("parallel", "hash_serial", "").await.unwrap() })
+    });
+    group.finish();
+}
+
+fn bench_cache(c: &mut Criterion) {
+    let rt = runtime();
+    let svc = service_with(&rt, |svc| svc.enable_cache(CacheConfig::default()).unwrap());
+    let svc = &*svc;
+    let wasm = wat::parse_file(CACHE_WAT).expect("fixture should be valid");
+    rt.block_on(svc.load_module_from_bytes("cache", &wasm))
+        .unwrap();
+    rt.block_on(svc.run_module("cache", "put", SHORT_INPUT))
+        .unwrap();
+
+    // put100 and get100 minus put and get, divided by 99, give the cost of
+    // a single call from inside the guest
+    let mut group = c.benchmark_group("cache");
+    for entry_point in ["put", "get", "miss", "put100", "get100"] {
+        group.bench_function(entry_point, |b| {
+            b.to_async(&rt).iter(|| async move {
+                svc.run_module("cache", entry_point, SHORT_INPUT)
+                    .await
+                    .unwrap()
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_text(c: &mut Criterion) {
+    let rt = runtime();
+    let svc = service(&rt);
+    let svc = &*svc;
+    let wasm = wat::parse_file(TEXT_WAT).expect("fixture should be valid");
+    rt.block_on(svc.load_module_from_bytes("text", &wasm))
+        .unwrap();
+    rt.block_on(svc.load_module_from_bytes("foo", &foo_wasm()))
+        .unwrap();
+
+    // the same kernels in wasm and on the host; foo's rev (which reverses
+    // codepoints) is the guest baseline for rev_host
+    let mut group = c.benchmark_group("text");
+    group.throughput(Throughput::Bytes(LONG_INPUT.len() as u64));
+    let kernels = [
+        ("text", "count_guest"),
+        ("text", "count_host"),
+        ("text", "find_guest"),
+        ("text", "find_host"),
+        ("foo", "rev"),
+        ("text", "rev_host"),
+    ];
+    for (module, entry_point) in kernels {
+        group.bench_function(entry_point, |b| {
+            b.to_async(&rt).iter(|| async move {
+                svc.run_module(module, entry_point, LONG_INPUT)
+                    .await
+                    .unwrap()
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_regex(c: &mut Criterion) {
+    let rt = runtime();
+    let svc = service(&rt);
+    let svc = &*svc;
+    let wasm = wat::parse_file(REGEX_WAT).expect("fixture should be valid");
+    rt.block_on(svc.load_module_from_bytes("regex", &wasm))
+        .unwrap();
+
+    let mut group = c.benchmark_group("regex");
+    group.throughput(Throughput::Bytes(LONG_INPUT.len() as u64));
+    for entry_point in ["compile", "words"] {
+        group.bench_function(entry_point, |b| {
+            b.to_async(&rt).iter(|| async move {
+                svc.run_module("regex", entry_point, LONG_INPUT)
+                    .await
+                    .unwrap()
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_blob(c: &mut Criterion) {
+    const BLOB_SIZE: usize = 64 << 10;
+    let rt = runtime();
+    let svc = service(&rt);
+    let svc = &*svc;
+    let path = std::env::temp_dir().join(format!("wotto-bench-blob-{}", std::process::id()));
+    std::fs::write(&path, vec![b'x'; BLOB_SIZE]).unwrap();
+    svc.register_blob("words", &path).unwrap();
+    let wasm = wat::parse_file(BLOB_WAT).expect("fixture should be valid");
+    rt.block_on(svc.load_module_from_bytes("blob", &wasm))
+        .unwrap();
+
+    let mut group = c.benchmark_group("blob");
+    group.bench_function("open", |b| {
+        b.to_async(&rt)
+            .iter(|| async move { svc.run_module("blob", "open", "").await.unwrap() })
+    });
+    group.throughput(Throughput::Bytes(BLOB_SIZE as u64));
+    group.bench_function("scan", |b| {
+        b.to_async(&rt)
+            .iter(|| async move { svc.run_module("blob", "scan", "").await.unwrap() })
+    });
+    group.finish();
+    std::fs::remove_file(&path).unwrap();
+}
+
+/// Lookups of existing entries from concurrent tasks, which used to
+/// serialize on a single mutex, and loads of names that don't exist, which
+/// used to leave an entry behind forever.
+fn bench_registry(c: &mut Criterion) {
+    const KEYS: usize = 1024;
+    let rt = runtime();
+    let registry = Arc::new(BenchRegistry::default());
+    let keys: Arc<Vec<String>> = Arc::new((0..KEYS).map(|i| format!("user/module{i}")).collect());
+    rt.block_on(async {
+        for (i, key) in keys.iter().enumerate() {
+            registry.insert(key.clone(), i as u64).await;
+        }
+    });
+
+    let mut group = c.benchmark_group("registry");
+    group.throughput(Throughput::Elements(1));
+    for tasks in [1u64, 2, 4, 8, 16] {
+        group.bench_function(BenchmarkId::new("lookup", tasks), |b| {
+            b.iter_custom(|iters| {
+                rt.block_on(async {
+                    let start = Instant::now();
+                    let handles: Vec<_> = (0..tasks)
+                        .map(|t| {
+                            let registry = registry.clone();
+                            let keys = keys.clone();
+                            let calls = iters / tasks + u64::from(t < iters % tasks);
+                            tokio::spawn(async move {
+                                for i in 0..calls {
+                                    let key = &keys[(t * 7919 + i * 31) as usize % KEYS];
+                                    registry.wait(key).await;
+                                }
+                            })
+                        })
+                        .collect();
+                    for handle in handles {
+                        handle.await.unwrap();
+                    }
+                    start.elapsed()
+                })
+            })
+        });
+    }
+    let mut typos = 0u64;
+    group.bench_function("missing", |b| {
+        b.to_async(&rt).iter(|| {
+            typos += 1;
+            registry.touch(format!("user/typo{typos}"))
+        })
+    });
+    group.finish();
+}
+
+criterion_group! {
+    name = benches;
+    config = Criterion::default().measurement_time(Duration::from_secs(5));
+    targets = bench_load_module, bench_custom_sections, bench_run_module, bench_host_calls,
+        bench_assemblyscript, bench_concurrency, bench_suspended, bench_parallel, bench_cache,
+        bench_text, bench_regex, bench_blob, bench_registry
+}
+criterion_main!(benches);
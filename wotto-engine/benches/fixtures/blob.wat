@@ -0,0 +1,33 @@
+;; Benchmark fixture for the blob imports. Expects a blob named "words".
+;;
+;; Exports:
+;;   open  open the blob and ask for its size
+;;   scan  read the whole blob, 1 KiB at a time
+(module
+  (import "wotto" "blob_open" (func $open (param i32 i32) (result i32)))
+  (import "wotto" "blob_len" (func $len (param i32) (result i32)))
+  (import "wotto" "blob_read" (func $read (param i32 i32 i32 i32) (result i32)))
+  (memory (export "memory") 1)
+
+  ;; name: 16 "words"
+  ;; read buffer: 1024..2048
+  (data (i32.const 16) "words")
+
+  (func $open_words (result i32)
+    (call $open (i32.const 16) (i32.const 5)))
+
+  (func (export "open")
+    (drop (call $len (call $open_words))))
+
+  (func (export "scan")
+    (local $blob i32)
+    (local $offset i32)
+    (local $read i32)
+    (local.set $blob (call $open_words))
+    (block $done
+      (loop $next
+        (local.set $read
+          (call $read (local.get $blob) (local.get $offset) (i32.const 1024) (i32.const 1024)))
+        (br_if $done (i32.le_s (local.get $read) (i32.const 0)))
+        (local.set $offset (i32.add (local.get $offset) (local.get $read)))
+        (br_if $next (i32.eq (local.get $read) (i32.const 1024)))))))
@@ -0,0 +1,59 @@
+;; Benchmark fixture for the cache imports.
+;;
+;; Exports:
+;;   put     store the input under the key "k"
+;;   get     look up "k" and output its value
+;;   miss    look up a key that is never stored
+;;   put100  100 stores of the input (host call cost)
+;;   get100  100 lookups of "k" (host call cost)
+(module
+  (import "wotto" "input" (func $input (param i32 i32) (result i32)))
+  (import "wotto" "output" (func $output (param i32 i32)))
+  (import "wotto" "cache_get" (func $cache_get (param i32 i32 i32 i32) (result i32)))
+  (import "wotto" "cache_put" (func $cache_put (param i32 i32 i32 i32) (result i32)))
+  (memory (export "memory") 1)
+
+  ;; keys: 16 "k", 32 "missing"
+  ;; input buffer: 1024..1536
+  ;; value buffer: 2048..2560
+  (data (i32.const 16) "k")
+  (data (i32.const 32) "missing")
+
+  (func $read_input (result i32)
+    (local $len i32)
+    (local.set $len (call $input (i32.const 1024) (i32.const 512)))
+    (select (local.get $len) (i32.const 512) (i32.lt_u (local.get $len) (i32.const 512))))
+
+  (func $get (param $key i32) (param $key_len i32) (result i32)
+    (local $len i32)
+    (local.set $len
+      (call $cache_get (local.get $key) (local.get $key_len) (i32.const 2048) (i32.const 512)))
+    (select (local.get $len) (i32.const 512) (i32.lt_s (local.get $len) (i32.const 512))))
+
+  (func (export "put")
+    (drop (call $cache_put (i32.const 16) (i32.const 1) (i32.const 1024) (call $read_input))))
+
+  (func (export "get")
+    (local $len i32)
+    (local.set $len (call $get (i32.const 16) (i32.const 1)))
+    (if (i32.ge_s (local.get $len) (i32.const 0))
+      (then (call $output (i32.const 2048) (local.get $len)))))
+
+  (func (export "miss")
+    (drop (call $get (i32.const 32) (i32.const 7))))
+
+  (func (export "put100")
+    (local $len i32)
+    (local $i i32)
+    (local.set $len (call $read_input))
+    (loop $again
+      (drop (call $cache_put (i32.const 16) (i32.const 1) (i32.const 1024) (local.get $len)))
+      (local.set $i (i32.add (local.get $i) (i32.const 1)))
+      (br_if $again (i32.lt_u (local.get $i) (i32.const 100)))))
+
+  (func (export "get100")
+    (local $i i32)
+    (loop $again
+      (drop (call $get (i32.const 16) (i32.const 1)))
+      (local.set $i (i32.add (local.get $i) (i32.const 1)))
+      (br_if $again (i32.lt_u (local.get $i) (i32.const 100))))))
@@ -0,0 +1,164 @@
+;; Hand-written equivalent of examples/c/foo.c, used as a benchmark fixture.
+;;
+;; The layout mirrors what clang produces for foo.c closely enough to be
+;; representative: one page of memory, input buffer and scratch buffers at
+;; fixed offsets instead of on the shadow stack.
+;;
+;; Exports:
+;;   rev        reverse the input (UTF-8 aware, like foo.c)
+;;   rev_ret    like rev, but return the output instead of calling output
+;;   cp         print the codepoints of the input (like foo.c)
+;;   noop       do nothing (baseline for call overhead)
+;;   echo       one input + one output call
+;;   roundtrip  100 input + output pairs (host call cost)
+(module
+  (import "wotto" "input" (func $input (param i32 i32) (result i32)))
+  (import "wotto" "output" (func $output (param i32 i32)))
+  (memory (export "memory") 1)
+
+  ;; input buffer: 1024..1536
+  ;; reverse buffer: 2048..2560
+  ;; digits scratch: 3072..3088
+  ;; single char scratch: 3100
+
+  (func $utf8_byte (param $c i32) (result i32)
+    (if (i32.lt_u (local.get $c) (i32.const 0xc0)) (then (return (i32.const 1))))
+    (if (i32.lt_u (local.get $c) (i32.const 0xe0)) (then (return (i32.const 2))))
+    (if (i32.lt_u (local.get $c) (i32.const 0xf0)) (then (return (i32.const 3))))
+    (i32.const 4))
+
+  (func $reverse_utf8 (param $a i32) (param $len i32)
+    (local $fwd i32)
+    (local $bwd i32)
+    (local $seqlen i32)
+    (local $i i32)
+    (local.set $bwd (i32.sub (local.get $len) (i32.const 1)))
+    (block $done
+      (loop $next
+        (br_if $done (i32.ge_u (local.get $fwd) (local.get $len)))
+        (local.set $seqlen
+          (call $utf8_byte (i32.load8_u (i32.add (local.get $a) (local.get $fwd)))))
+        ;; truncated sequence at the end of the input
+        (if (i32.gt_u (local.get $seqlen) (i32.sub (local.get $len) (local.get $fwd)))
+          (then (local.set $seqlen (i32.sub (local.get $len) (local.get $fwd)))))
+        (local.set $i (i32.const 0))
+        (block $copied
+          (loop $copy
+            (br_if $copied (i32.ge_u (local.get $i) (local.get $seqlen)))
+            (i32.store8
+              (i32.add
+                (i32.const 2048)
+                (i32.add
+                  (i32.sub (local.get $bwd) (local.get $seqlen))
+                  (i32.add (local.get $i) (i32.const 1))))
+              (i32.load8_u
+                (i32.add (local.get $a) (i32.add (local.get $fwd) (local.get $i)))))
+            (local.set $i (i32.add (local.get $i) (i32.const 1)))
+            (br $copy)))
+        (local.set $fwd (i32.add (local.get $fwd) (local.get $seqlen)))
+        (local.set $bwd (i32.sub (local.get $bwd) (local.get $seqlen)))
+        (br $next)))
+    (memory.copy (local.get $a) (i32.const 2048) (local.get $len)))
+
+  ;; decode one codepoint at *$pos, return it and store the new position at
+  ;; address 3096
+  (func $utf8_decode (param $pos i32) (result i32)
+    (local $b1 i32)
+    (local.set $b1 (i32.load8_u (local.get $pos)))
+    (if (i32.lt_u (local.get $b1) (i32.const 0xc0))
+      (then
+        (i32.store (i32.const 3096) (i32.add (local.get $pos) (i32.const 1)))
+        (return (local.get $b1))))
+    (if (i32.lt_u (local.get $b1) (i32.const 0xe0))
+      (then
+        (i32.store (i32.const 3096) (i32.add (local.get $pos) (i32.const 2)))
+        (return
+          (i32.add
+            (i32.shl (i32.and (local.get $b1) (i32.const 0x1f)) (i32.const 6))
+            (i32.and (i32.load8_u offset=1 (local.get $pos)) (i32.const 0x3f))))))
+    (if (i32.lt_u (local.get $b1) (i32.const 0xf0))
+      (then
+        (i32.store (i32.const 3096) (i32.add (local.get $pos) (i32.const 3)))
+        (return
+          (i32.add
+            (i32.add
+              (i32.shl (i32.and (local.get $b1) (i32.const 0xf)) (i32.const 12))
+              (i32.shl (i32.and (i32.load8_u offset=1 (local.get $pos)) (i32.const 0x3f)) (i32.const 6)))
+            (i32.and (i32.load8_u offset=2 (local.get $pos)) (i32.const 0x3f))))))
+    (i32.store (i32.const 3096) (i32.add (local.get $pos) (i32.const 4)))
+    (i32.add
+      (i32.add
+        (i32.shl (i32.and (local.get $b1) (i32.const 0x7)) (i32.const 18))
+        (i32.shl (i32.and (i32.load8_u offset=1 (local.get $pos)) (i32.const 0x3f)) (i32.const 12)))
+      (i32.add
+        (i32.shl (i32.and (i32.load8_u offset=2 (local.get $pos)) (i32.const 0x3f)) (i32.const 6))
+        (i32.and (i32.load8_u offset=3 (local.get $pos)) (i32.const 0x3f)))))
+
+  (func $output_char (param $c i32)
+    (i32.store8 (i32.const 3100) (local.get $c))
+    (call $output (i32.const 3100) (i32.const 1)))
+
+  ;; write digits right-aligned in 3072..3088, then output them
+  (func $output_u32 (param $n i32)
+    (local $pos i32)
+    (local.set $pos (i32.const 3088))
+    (loop $digit
+      (local.set $pos (i32.sub (local.get $pos) (i32.const 1)))
+      (i32.store8
+        (local.get $pos)
+        (i32.add (i32.const 48) (i32.rem_u (local.get $n) (i32.const 10))))
+      (local.set $n (i32.div_u (local.get $n) (i32.const 10)))
+      (br_if $digit (local.get $n)))
+    (call $output (local.get $pos) (i32.sub (i32.const 3088) (local.get $pos))))
+
+  (func (export "rev")
+    (local $len i32)
+    (local.set $len (call $input (i32.const 1024) (i32.const 512)))
+    (if (i32.gt_u (local.get $len) (i32.const 512))
+      (then (local.set $len (i32.const 512))))
+    (call $reverse_utf8 (i32.const 1024) (local.get $len))
+    (call $output (i32.const 1024) (local.get $len)))
+
+  (func (export "rev_ret") (result i32 i32)
+    (local $len i32)
+    (local.set $len (call $input (i32.const 1024) (i32.const 512)))
+    (if (i32.gt_u (local.get $len) (i32.const 512))
+      (then (local.set $len (i32.const 512))))
+    (call $reverse_utf8 (i32.const 1024) (local.get $len))
+    (i32.const 1024)
+    (local.get $len))
+
+  (func (export "cp")
+    (local $pos i32)
+    (local $end i32)
+    (local $len i32)
+    (local.set $len (call $input (i32.const 1024) (i32.const 512)))
+    (if (i32.gt_u (local.get $len) (i32.const 512))
+      (then (local.set $len (i32.const 512))))
+    (local.set $pos (i32.const 1024))
+    (local.set $end (i32.add (i32.const 1024) (local.get $len)))
+    (loop $next
+      (call $output_u32 (call $utf8_decode (local.get $pos)))
+      (local.set $pos (i32.load (i32.const 3096)))
+      (if (i32.lt_u (local.get $pos) (local.get $end))
+        (then
+          (call $output_char (i32.const 32))
+          (br $next)))))
+
+  (func (export "noop"))
+
+  (func (export "echo")
+    (local $len i32)
+    (local.set $len (call $input (i32.const 1024) (i32.const 512)))
+    (if (i32.gt_u (local.get $len) (i32.const 512))
+      (then (local.set $len (i32.const 512))))
+    (call $output (i32.const 1024) (local.get $len)))
+
+  (func (export "roundtrip")
+    (local $i i32)
+    (loop $again
+      (drop (call $input (i32.const 1024) (i32.const 16)))
+      (call $output_char (i32.const 120))
+      (local.set $i (i32.add (local.get $i) (i32.const 1)))
+      (br_if $again (i32.lt_u (local.get $i) (i32.const 100)))))
+)
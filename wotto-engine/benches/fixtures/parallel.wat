@@ -0,0 +1,43 @@
+;; Benchmark fixture for data-parallel guests. Needs to be trusted with
+;; threads, and to be loaded as "parallel".
+;;
+;; Exports:
+;;   work           hash one 64 KiB chunk of the shared memory, a few times
+;;   hash_serial    run `work` on all 16 chunks, one after the other
+;;   hash_parallel  run `work` on all 16 chunks through `wotto.parallel`
+(module
+  (import "wotto" "shared" (memory $shared 17 17 shared))
+  (import "wotto" "parallel" (func $parallel (param i32 i32 i32) (result i32)))
+  (memory $private (export "memory") 1)
+  (data (memory $private) (i32.const 0) "work")
+
+  ;; FNV-1a over the chunk, stored after the 16 chunks
+  (func $work (export "work") (param $task i32)
+    (local $i i32) (local $end i32) (local $hash i32) (local $rounds i32)
+    (local.set $hash (i32.const 0x811c9dc5))
+    (local.set $rounds (i32.const 4))
+    (loop $round
+      (local.set $i (i32.shl (local.get $task) (i32.const 16)))
+      (local.set $end (i32.add (local.get $i) (i32.const 0x10000)))
+      (loop $byte
+        (local.set $hash
+          (i32.mul
+            (i32.xor (local.get $hash) (i32.load8_u $shared (local.get $i)))
+            (i32.const 0x01000193)))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br_if $byte (i32.lt_u (local.get $i) (local.get $end))))
+      (local.set $rounds (i32.sub (local.get $rounds) (i32.const 1)))
+      (br_if $round (local.get $rounds)))
+    (i32.atomic.store $shared
+      (i32.add (i32.const 0x100000) (i32.shl (local.get $task) (i32.const 2)))
+      (local.get $hash)))
+
+  (func (export "hash_serial")
+    (local $task i32)
+    (loop $tasks
+      (call $work (local.get $task))
+      (local.set $task (i32.add (local.get $task) (i32.const 1)))
+      (br_if $tasks (i32.lt_u (local.get $task) (i32.const 16)))))
+
+  (func (export "hash_parallel")
+    (drop (call $parallel (i32.const 0) (i32.const 4) (i32.const 16)))))
@@ -0,0 +1,42 @@
+;; Benchmark fixture for the regex imports.
+;;
+;; Exports:
+;;   compile  compile the pattern (a cache hit after the first call)
+;;   words    count the matches of \w+ in the input with regex_find
+(module
+  (import "wotto" "input" (func $input (param i32 i32) (result i32)))
+  (import "wotto.regex" "compile" (func $compile (param i32 i32) (result i32)))
+  (import "wotto.regex" "find" (func $find (param i32 i32 i32 i32 i32 i32) (result i32)))
+  (memory (export "memory") 1)
+
+  ;; pattern: 16 "\w+"
+  ;; spans: 32..40
+  ;; input buffer: 1024..2048
+  (data (i32.const 16) "\\w+")
+
+  (func $compile_pattern (result i32)
+    (call $compile (i32.const 16) (i32.const 3)))
+
+  (func (export "compile")
+    (drop (call $compile_pattern)))
+
+  (func (export "words")
+    (local $regex i32)
+    (local $len i32)
+    (local $start i32)
+    (local $count i32)
+    (local.set $regex (call $compile_pattern))
+    (local.set $len (call $input (i32.const 1024) (i32.const 1024)))
+    (local.set $len
+      (select (local.get $len) (i32.const 1024) (i32.lt_u (local.get $len) (i32.const 1024))))
+    (block $done
+      (loop $next
+        (br_if $done
+          (i32.lt_s
+            (call $find (local.get $regex) (i32.const 1024) (local.get $len) (local.get $start)
+              (i32.const 32) (i32.const 1))
+            (i32.const 0)))
+        (local.set $count (i32.add (local.get $count) (i32.const 1)))
+        ;; \w+ never matches the empty string
+        (local.set $start (i32.load (i32.const 36)))
+        (br $next)))))
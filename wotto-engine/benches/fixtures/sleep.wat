@@ -0,0 +1,10 @@
+;; Benchmark fixture for async host imports.
+;;
+;; Exports:
+;;   nap  sleep for 1 ms
+(module
+  (import "wotto" "sleep" (func $sleep (param i32)))
+  (memory (export "memory") 1)
+
+  (func (export "nap")
+    (call $sleep (i32.const 1))))
@@ -0,0 +1,81 @@
+;; Benchmark fixture for the wotto.text imports: each kernel is implemented
+;; both as plain wasm and as a call to the host.
+;;
+;; Exports:
+;;   count_guest  count the codepoints of the input in wasm
+;;   count_host   same, with utf8_count
+;;   find_guest   look for "needle" in the input, naive search in wasm
+;;   find_host    same, with find
+;;   rev_host     reverse the input with reverse_graphemes and output it
+(module
+  (import "wotto" "input" (func $input (param i32 i32) (result i32)))
+  (import "wotto" "output" (func $output (param i32 i32)))
+  (import "wotto.text" "utf8_count" (func $utf8_count (param i32 i32) (result i32)))
+  (import "wotto.text" "find" (func $find (param i32 i32 i32 i32) (result i32)))
+  (import "wotto.text" "reverse_graphemes" (func $reverse_graphemes (param i32 i32) (result i32)))
+  (memory (export "memory") 1)
+
+  ;; needle: 16 "needle"
+  ;; input buffer: 1024..2048
+  (data (i32.const 16) "needle")
+
+  (func $read_input (result i32)
+    (local $len i32)
+    (local.set $len (call $input (i32.const 1024) (i32.const 1024)))
+    (select (local.get $len) (i32.const 1024) (i32.lt_u (local.get $len) (i32.const 1024))))
+
+  (func $count_guest (result i32)
+    (local $end i32)
+    (local $i i32)
+    (local $count i32)
+    (local.set $i (i32.const 1024))
+    (local.set $end (i32.add (i32.const 1024) (call $read_input)))
+    (block $done
+      (loop $again
+        (br_if $done (i32.ge_u (local.get $i) (local.get $end)))
+        ;; not a continuation byte (10xxxxxx)
+        (if (i32.ne (i32.and (i32.load8_u (local.get $i)) (i32.const 0xc0)) (i32.const 0x80))
+          (then (local.set $count (i32.add (local.get $count) (i32.const 1)))))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $again)))
+    (local.get $count))
+
+  (func $count_host (result i32)
+    (call $utf8_count (i32.const 1024) (call $read_input)))
+
+  (func $find_guest (result i32)
+    (local $len i32)
+    (local $i i32)
+    (local $j i32)
+    (local.set $len (call $read_input))
+    (block $not_found
+      (loop $next
+        (br_if $not_found (i32.gt_s (local.get $i) (i32.sub (local.get $len) (i32.const 6))))
+        (local.set $j (i32.const 0))
+        (block $mismatch
+          (loop $compare
+            (br_if $mismatch
+              (i32.ne
+                (i32.load8_u (i32.add (i32.const 1024) (i32.add (local.get $i) (local.get $j))))
+                (i32.load8_u (i32.add (i32.const 16) (local.get $j)))))
+            (local.set $j (i32.add (local.get $j) (i32.const 1)))
+            (br_if $compare (i32.lt_u (local.get $j) (i32.const 6)))
+            (return (local.get $i))))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $next)))
+    (i32.const -1))
+
+  (func $find_host (result i32)
+    (call $find (i32.const 1024) (call $read_input) (i32.const 16) (i32.const 6)))
+
+  (func (export "rev_host")
+    (local $len i32)
+    (local.set $len (call $read_input))
+    (drop (call $reverse_graphemes (i32.const 1024) (local.get $len)))
+    (call $output (i32.const 1024) (local.get $len)))
+
+  ;; entry points cannot return values
+  (func (export "count_guest") (drop (call $count_guest)))
+  (func (export "count_host") (drop (call $count_host)))
+  (func (export "find_guest") (drop (call $find_guest)))
+  (func (export "find_host") (drop (call $find_host))))
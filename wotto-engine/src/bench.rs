@@ -0,0 +1,28 @@
+//! Hooks for the benchmark suite into crate internals. Not a stable API.
+
+use crate::assemblyscript::AssemblyScriptString;
+use crate::registry::Registry;
+
+/// Decode the AssemblyScript string object found at `ptr` in `memory`.
+pub fn decode_assemblyscript_string(memory: &[u8], ptr: u32) -> Option<String> {
+    AssemblyScriptString::from_memory(memory, ptr).map(|s| s.to_string())
+}
+
+/// A registry of numbers, to measure contention on its locks.
+#[derive(Default)]
+pub struct BenchRegistry(Registry<String, u64>);
+
+impl BenchRegistry {
+    pub async fn insert(&self, key: String, value: u64) {
+        *self.0.lock_entry_mut(key).await = Some(value);
+    }
+
+    /// Lock an entry and leave it empty, like a failed load does.
+    pub async fn touch(&self, key: String) {
+        self.0.lock_entry_mut(key).await;
+    }
+
+    pub async fn wait(&self, key: &str) {
+        self.0.wait_entry(key).await;
+    }
+}
@@ -0,0 +1,233 @@
+//! Named read-only blobs shared by all modules.
+//!
+//! Reference data (word lists, tables, ...) is registered by the operator and
+//! memory-mapped once. Guests read the parts they need through the
+//! `wotto.blob_*` imports, instead of carrying the data in their own data
+//! segments, which would be copied into every instance.
+
+use std::collections::HashMap;
+use std::fs::File;
+use std::io;
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+
+use memmap2::Mmap;
+use parking_lot::RwLock;
+
+/// Offsets and lengths are i32 on the guest side.
+const MAX_BLOB_SIZE: u64 = i32::MAX as u64;
+
+pub(crate) struct Blob {
+    path: PathBuf,
+    /// `None` for empty files, which cannot be mapped.
+    map: Option<Mmap>,
+}
+
+impl Blob {
+    fn open(path: &Path) -> io::Result<Self> {
+        let file = File::open(path)?;
+        let size = file.metadata()?.len();
+        if size > MAX_BLOB_SIZE {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "blob is larger than 2 GiB",
+            ));
+        }
+        // Safety: the file must not be modified while it is mapped. Blobs
+        // are meant to be replaced by registering a new file (or renaming
+        // over the old one), never by editing in place.
+        let map = if size > 0 {
+            Some(unsafe { Mmap::map(&file)? })
+        } else {
+            None
+        };
+        Ok(Self {
+            path: path.to_path_buf(),
+            map,
+        })
+    }
+
+    pub(crate) fn data(&self) -> &[u8] {
+        self.map.as_deref().unwrap_or_default()
+    }
+
+    /// Copy the blob from `offset` into `buf`, as far as it goes. Returns
+    /// the number of bytes copied, or `None` if `offset` is past the end.
+    pub(crate) fn read(&self, offset: u32, buf: &mut [u8]) -> Option<usize> {
+        let data = self.data().get(offset as usize..)?;
+        let size = data.len().min(buf.len());
+        buf[..size].copy_from_slice(&data[..size]);
+        Some(size)
+    }
+}
+
+#[derive(Debug, Clone)]
+pub struct BlobInfo {
+    pub name: String,
+    pub path: PathBuf,
+    pub size: usize,
+}
+
+#[derive(Default)]
+pub(crate) struct BlobRegistry {
+    blobs: RwLock<HashMap<String, Arc<Blob>>>,
+}
+
+impl BlobRegistry {
+    /// Map a file and make it available under `name`, replacing any blob
+    /// with the same name. Instances that already opened the old blob keep
+    /// reading from it. Returns the size of the blob.
+    pub(crate) fn register(&self, name: &str, path: &Path) -> io::Result<usize> {
+        let blob = Blob::open(path)?;
+        let size = blob.data().len();
+        self.blobs.write().insert(name.to_string(), Arc::new(blob));
+        Ok(size)
+    }
+
+    pub(crate) fn unregister(&self, name: &str) -> bool {
+        self.blobs.write().remove(name).is_some()
+    }
+
+    pub(crate) fn get(&self, name: &str) -> Option<Arc<Blob>> {
+        self.blobs.read().get(name).cloned()
+    }
+
+    pub(crate) fn list(&self) -> Vec<BlobInfo> {
+        let mut list: Vec<_> = self
+            .blobs
+            .read()
+            .iter()
+            .map(|(name, blob)| BlobInfo {
+                name: name.clone(),
+                path: blob.path.clone(),
+                size: blob.data().len(),
+            })
+            .collect();
+        list.sort_by(|a, b| a.name.cmp(&b.name));
+        list
+    }
+}
+
+/// Blobs opened by one instance. Handles are indices into `open`, so that
+/// reads do not need to go through the registry.
+pub(crate) struct BlobHandles {
+    registry: Arc<BlobRegistry>,
+    open: Vec<Arc<Blob>>,
+}
+
+impl BlobHandles {
+    pub(crate) fn new(registry: Arc<BlobRegistry>) -> Self {
+        Self {
+            registry,
+            open: Vec::new(),
+        }
+    }
+
+    pub(crate) fn open(&mut self, name: &str) -> Option<i32> {
+        let blob = self.registry.get(name)?;
+        let handle = match self.open.iter().position(|open| Arc::ptr_eq(open, &blob)) {
+            Some(handle) => handle,
+            None => {
+                self.open.push(blob);
+                self.open.len() - 1
+            }
+        };
+        handle.try_into().ok()
+    }
+
+    pub(crate) fn get(&self, handle: i32) -> Option<&Blob> {
+        self.open
+            .get(usize::try_from(handle).ok()?)
+            .map(|blob| &**blob)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A directory of its own for each test, which run in parallel.
+    fn dir(test: &str) -> PathBuf {
+        let dir = std::env::temp_dir().join(format!("wotto-blobs-{test}-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)] // mmap is not supported
+    fn register_and_replace() {
+        let dir = dir("replace");
+        let (old, new) = (dir.join("old.txt"), dir.join("new.txt"));
+        std::fs::write(&old, "hello").unwrap();
+        std::fs::write(&new, "bye").unwrap();
+        let registry = Arc::new(BlobRegistry::default());
+        assert_eq!(registry.register("words", &old).unwrap(), 5);
+        let mut before = BlobHandles::new(registry.clone());
+        let handle = before.open("words").unwrap();
+        // opening again gives the same handle
+        assert_eq!(before.open("words"), Some(handle));
+
+        assert_eq!(registry.register("words", &new).unwrap(), 3);
+        assert_eq!(registry.list().len(), 1);
+        // open handles keep the old mapping
+        assert_eq!(before.get(handle).unwrap().data(), b"hello");
+        let mut after = BlobHandles::new(registry.clone());
+        let handle = after.open("words").unwrap();
+        assert_eq!(after.get(handle).unwrap().data(), b"bye");
+
+        assert!(registry.unregister("words"));
+        assert!(!registry.unregister("words"));
+        assert_eq!(after.open("words"), None);
+        assert_eq!(after.get(handle).unwrap().data(), b"bye");
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)] // mmap is not supported
+    fn empty_files() {
+        let dir = dir("empty");
+        let path = dir.join("empty.txt");
+        std::fs::write(&path, "").unwrap();
+        let registry = Arc::new(BlobRegistry::default());
+        assert_eq!(registry.register("empty", &path).unwrap(), 0);
+        let mut handles = BlobHandles::new(registry);
+        let blob = handles
+            .open("empty")
+            .and_then(|handle| handles.get(handle))
+            .unwrap();
+        assert!(blob.data().is_empty());
+        assert_eq!(blob.read(0, &mut [0; 4]), Some(0));
+        assert_eq!(blob.read(1, &mut [0; 4]), None);
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn invalid_handles() {
+        let mut handles = BlobHandles::new(Arc::default());
+        assert_eq!(handles.open("nope"), None);
+        assert!(handles.get(-1).is_none());
+        assert!(handles.get(0).is_none());
+        assert!(handles.get(i32::MAX).is_none());
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)] // mmap is not supported
+    fn reads() {
+        let dir = dir("reads");
+        let path = dir.join("hello.txt");
+        std::fs::write(&path, "hello").unwrap();
+        let blob = Blob::open(&path).unwrap();
+        let mut buf = [0; 4];
+        assert_eq!(blob.read(0, &mut buf), Some(4));
+        assert_eq!(&buf, b"hell");
+        // short read at the end
+        assert_eq!(blob.read(3, &mut buf), Some(2));
+        assert_eq!(&buf[..2], b"lo");
+        // the end itself is fine, past it is not
+        assert_eq!(blob.read(5, &mut buf), Some(0));
+        assert_eq!(blob.read(6, &mut buf), None);
+        assert_eq!(blob.read(u32::MAX, &mut buf), None);
+        assert_eq!(blob.read(0, &mut []), Some(0));
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+}
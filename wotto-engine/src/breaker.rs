@@ -0,0 +1,452 @@
+//! Circuit breakers for entry points that keep failing.
+//!
+//! Every entry point has a window of its most recent outcomes. When too many
+//! of them are failures (traps or timeouts), its breaker opens, and calls
+//! fail immediately with `Error::CircuitOpen` instead of running the guest.
+//! After a cooldown, the breaker lets a single probe call through: if it
+//! succeeds the breaker closes again, otherwise it stays open for another
+//! cooldown.
+
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::{Duration, Instant};
+
+use parking_lot::Mutex;
+use tracing::{info, warn};
+
+#[derive(Debug, Clone)]
+pub struct BreakerConfig {
+    /// Number of recent calls considered, at most 64.
+    pub window: u32,
+    /// Failures in the window that open the breaker.
+    pub max_failures: u32,
+    /// Timeouts in the window that open the breaker. Timeouts are much more
+    /// expensive than other failures, so this is usually lower.
+    pub max_timeouts: u32,
+    /// How long the breaker stays open before letting a probe through.
+    pub cooldown: Duration,
+}
+
+impl Default for BreakerConfig {
+    fn default() -> Self {
+        Self {
+            window: 20,
+            max_failures: 10,
+            max_timeouts: 3,
+            cooldown: Duration::from_secs(60),
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) enum Outcome {
+    Success,
+    Failure,
+    Timeout,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum BreakerState {
+    Closed,
+    /// Failing fast; the next probe is allowed after `retry_in`.
+    Open {
+        retry_in: Duration,
+    },
+    /// Waiting for the result of a probe.
+    HalfOpen,
+}
+
+#[derive(Debug, Clone)]
+pub struct BreakerInfo {
+    /// As `module.entry_point`.
+    pub name: String,
+    pub state: BreakerState,
+    /// Calls in the window, and how many of them failed or timed out.
+    pub calls: u32,
+    pub failures: u32,
+    pub timeouts: u32,
+    /// How many times the breaker was opened.
+    pub opened: u64,
+}
+
+enum State {
+    Closed,
+    Open { until: Instant },
+    HalfOpen { probing: bool },
+}
+
+struct Breaker {
+    /// One bit per call in the window, most recent in the lowest bit.
+    failures: u64,
+    timeouts: u64,
+    calls: u32,
+    state: State,
+    opened: u64,
+}
+
+impl Breaker {
+    fn new() -> Self {
+        Self {
+            failures: 0,
+            timeouts: 0,
+            calls: 0,
+            state: State::Closed,
+            opened: 0,
+        }
+    }
+
+    fn push(&mut self, config: &BreakerConfig, outcome: Outcome) {
+        let mask = if config.window >= 64 {
+            u64::MAX
+        } else {
+            (1 << config.window) - 1
+        };
+        self.failures = (self.failures << 1 | u64::from(outcome != Outcome::Success)) & mask;
+        self.timeouts = (self.timeouts << 1 | u64::from(outcome == Outcome::Timeout)) & mask;
+        self.calls = (self.calls + 1).min(config.window);
+    }
+
+    fn tripped(&self, config: &BreakerConfig) -> bool {
+        self.failures.count_ones() >= config.max_failures
+            || self.timeouts.count_ones() >= config.max_timeouts
+    }
+
+    fn open(&mut self, config: &BreakerConfig, now: Instant) {
+        self.state = State::Open {
+            until: now + config.cooldown,
+        };
+        self.opened += 1;
+    }
+
+    fn close(&mut self) {
+        self.state = State::Closed;
+        self.failures = 0;
+        self.timeouts = 0;
+        self.calls = 0;
+    }
+}
+
+#[derive(Default)]
+pub(crate) struct Breakers {
+    config: BreakerConfig,
+    /// Keyed by module, then entry point. Entries are only created when a
+    /// call actually ran, so that calls to entry points that don't exist
+    /// don't fill the map.
+    breakers: Mutex<HashMap<String, HashMap<String, Breaker>>>,
+    /// Bumped by resets, so that calls admitted before one don't count.
+    resets: AtomicU64,
+}
+
+impl Breakers {
+    pub(crate) fn set_config(&mut self, config: BreakerConfig) {
+        self.config = config;
+    }
+
+    /// Check whether a call can go ahead. The returned admission must be
+    /// finished with the outcome of the call.
+    pub(crate) fn admit<'a>(
+        &'a self,
+        module: &'a str,
+        entry_point: &'a str,
+    ) -> Option<Admission<'a>> {
+        let mut breakers = self.breakers.lock();
+        let breaker = breakers
+            .get_mut(module)
+            .and_then(|breakers| breakers.get_mut(entry_point));
+        let probe = match breaker {
+            None => false,
+            Some(breaker) => match breaker.state {
+                State::Closed => false,
+                State::Open { until } if Instant::now() < until => return None,
+                State::Open { .. } | State::HalfOpen { probing: false } => {
+                    breaker.state = State::HalfOpen { probing: true };
+                    true
+                }
+                State::HalfOpen { probing: true } => return None,
+            },
+        };
+        drop(breakers);
+        Some(Admission {
+            breakers: self,
+            module,
+            entry_point,
+            probe,
+            resets: self.resets.load(Ordering::Relaxed),
+            finished: false,
+        })
+    }
+
+    pub(crate) fn reset(&self, module: &str, entry_point: &str) -> bool {
+        let mut breakers = self.breakers.lock();
+        self.resets.fetch_add(1, Ordering::Relaxed);
+        let Some(entry_points) = breakers.get_mut(module) else { return false; };
+        let removed = entry_points.remove(entry_point).is_some();
+        if entry_points.is_empty() {
+            breakers.remove(module);
+        }
+        removed
+    }
+
+    /// Forget the breakers of all the entry points of a module, when a new
+    /// version replaces the one that failed.
+    pub(crate) fn reset_module(&self, module: &str) -> bool {
+        let mut breakers = self.breakers.lock();
+        self.resets.fetch_add(1, Ordering::Relaxed);
+        breakers.remove(module).is_some()
+    }
+
+    pub(crate) fn list(&self) -> Vec<BreakerInfo> {
+        let now = Instant::now();
+        let mut list: Vec<_> = self
+            .breakers
+            .lock()
+            .iter()
+            .flat_map(|(module, entry_points)| {
+                entry_points
+                    .iter()
+                    .map(move |(entry_point, breaker)| (module, entry_point, breaker))
+            })
+            .map(|(module, entry_point, breaker)| BreakerInfo {
+                name: format!("{module}.{entry_point}"),
+                state: match breaker.state {
+                    State::Closed => BreakerState::Closed,
+                    State::Open { until } => BreakerState::Open {
+                        retry_in: until.saturating_duration_since(now),
+                    },
+                    State::HalfOpen { .. } => BreakerState::HalfOpen,
+                },
+                calls: breaker.calls,
+                failures: breaker.failures.count_ones(),
+                timeouts: breaker.timeouts.count_ones(),
+                opened: breaker.opened,
+            })
+            .collect();
+        list.sort_by(|a, b| a.name.cmp(&b.name));
+        list
+    }
+
+    fn record(
+        &self,
+        module: &str,
+        entry_point: &str,
+        probe: bool,
+        resets: u64,
+        outcome: Option<Outcome>,
+    ) {
+        let mut breakers = self.breakers.lock();
+        // a call admitted before a reset might have run the old version
+        let outcome = outcome.filter(|_| self.resets.load(Ordering::Relaxed) == resets);
+        let Some(outcome) = outcome else {
+            // the call did not get to run; give somebody else a chance to probe
+            let breaker = breakers
+                .get_mut(module)
+                .and_then(|breakers| breakers.get_mut(entry_point));
+            if let Some(breaker) = breaker {
+                if probe {
+                    breaker.state = State::HalfOpen { probing: false };
+                }
+            }
+            return;
+        };
+        // only allocate keys the first time an entry point is seen
+        if !breakers.contains_key(module) {
+            breakers.insert(module.to_string(), HashMap::new());
+        }
+        let entry_points = breakers.get_mut(module).unwrap();
+        if !entry_points.contains_key(entry_point) {
+            entry_points.insert(entry_point.to_string(), Breaker::new());
+        }
+        let breaker = entry_points.get_mut(entry_point).unwrap();
+        breaker.push(&self.config, outcome);
+        let now = Instant::now();
+        if probe {
+            if outcome == Outcome::Success {
+                info!(module, entry_point, "circuit closed");
+                breaker.close();
+            } else {
+                breaker.open(&self.config, now);
+            }
+        } else if matches!(breaker.state, State::Closed) && breaker.tripped(&self.config) {
+            warn!(
+                module,
+                entry_point,
+                failures = breaker.failures.count_ones(),
+                timeouts = breaker.timeouts.count_ones(),
+                "circuit opened"
+            );
+            breaker.open(&self.config, now);
+        }
+    }
+}
+
+/// A call let through by the breaker of its entry point.
+pub(crate) struct Admission<'a> {
+    breakers: &'a Breakers,
+    module: &'a str,
+    entry_point: &'a str,
+    probe: bool,
+    /// Resets when the call was admitted.
+    resets: u64,
+    finished: bool,
+}
+
+impl Admission<'_> {
+    /// Record the outcome of the call, or `None` if it says nothing about
+    /// the health of the entry point (it does not exist, for instance).
+    pub(crate) fn finish(mut self, outcome: Option<Outcome>) {
+        self.finished = true;
+        self.breakers.record(
+            self.module,
+            self.entry_point,
+            self.probe,
+            self.resets,
+            outcome,
+        );
+    }
+}
+
+impl Drop for Admission<'_> {
+    fn drop(&mut self) {
+        // the call was cancelled
+        if !self.finished {
+            self.breakers
+                .record(self.module, self.entry_point, self.probe, self.resets, None);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::buffers::counting::allocations;
+
+    fn breakers() -> Breakers {
+        let mut breakers = Breakers::default();
+        breakers.set_config(BreakerConfig {
+            window: 4,
+            max_failures: 3,
+            max_timeouts: 2,
+            cooldown: Duration::from_millis(50),
+        });
+        breakers
+    }
+
+    fn call(breakers: &Breakers, outcome: Outcome) -> bool {
+        match breakers.admit("m", "f") {
+            Some(admission) => {
+                admission.finish(Some(outcome));
+                true
+            }
+            None => false,
+        }
+    }
+
+    fn state(breakers: &Breakers) -> BreakerState {
+        breakers.list()[0].state
+    }
+
+    #[test]
+    fn opens_after_failures() {
+        let breakers = breakers();
+        assert!(call(&breakers, Outcome::Failure));
+        assert!(call(&breakers, Outcome::Success));
+        assert!(call(&breakers, Outcome::Failure));
+        assert_eq!(state(&breakers), BreakerState::Closed);
+        assert!(call(&breakers, Outcome::Failure));
+        assert!(matches!(state(&breakers), BreakerState::Open { .. }));
+        assert!(!call(&breakers, Outcome::Success));
+        assert_eq!(breakers.list()[0].opened, 1);
+    }
+
+    #[test]
+    fn old_failures_leave_the_window() {
+        let breakers = breakers();
+        for _ in 0..10 {
+            assert!(call(&breakers, Outcome::Failure));
+            assert!(call(&breakers, Outcome::Success));
+            assert!(call(&breakers, Outcome::Success));
+        }
+        assert_eq!(state(&breakers), BreakerState::Closed);
+    }
+
+    #[test]
+    fn timeouts_open_sooner() {
+        let breakers = breakers();
+        assert!(call(&breakers, Outcome::Timeout));
+        assert!(call(&breakers, Outcome::Timeout));
+        assert!(!call(&breakers, Outcome::Success));
+    }
+
+    #[test]
+    fn probe_after_cooldown() {
+        let breakers = breakers();
+        for _ in 0..2 {
+            call(&breakers, Outcome::Timeout);
+        }
+        std::thread::sleep(Duration::from_millis(60));
+        // failed probe: open again
+        assert!(call(&breakers, Outcome::Failure));
+        assert!(!call(&breakers, Outcome::Success));
+        std::thread::sleep(Duration::from_millis(60));
+
+        // only one probe at a time
+        let probe = breakers.admit("m", "f").unwrap();
+        assert_eq!(state(&breakers), BreakerState::HalfOpen);
+        assert!(breakers.admit("m", "f").is_none());
+        probe.finish(Some(Outcome::Success));
+        assert_eq!(state(&breakers), BreakerState::Closed);
+        assert!(call(&breakers, Outcome::Success));
+        assert_eq!(breakers.list()[0].opened, 2);
+    }
+
+    #[test]
+    fn cancelled_probe() {
+        let breakers = breakers();
+        for _ in 0..2 {
+            call(&breakers, Outcome::Timeout);
+        }
+        std::thread::sleep(Duration::from_millis(60));
+        drop(breakers.admit("m", "f").unwrap());
+        assert!(breakers.admit("m", "f").is_some());
+    }
+
+    #[test]
+    fn unknown_entry_points_are_not_tracked() {
+        let breakers = breakers();
+        breakers.admit("m", "nope").unwrap().finish(None);
+        assert!(breakers.list().is_empty());
+    }
+
+    #[test]
+    fn warm_calls_do_not_allocate() {
+        let breakers = breakers();
+        call(&breakers, Outcome::Success);
+        assert_eq!(allocations(|| call(&breakers, Outcome::Success)), 0);
+    }
+
+    #[test]
+    fn reset() {
+        let breakers = breakers();
+        for _ in 0..2 {
+            call(&breakers, Outcome::Timeout);
+        }
+        assert!(breakers.reset("m", "f"));
+        assert!(call(&breakers, Outcome::Success));
+    }
+
+    #[test]
+    fn reset_module() {
+        let breakers = breakers();
+        for _ in 0..2 {
+            call(&breakers, Outcome::Timeout);
+        }
+        // still running the old version when the new one comes in
+        let old = breakers.admit("m", "g").unwrap();
+        assert!(breakers.reset_module("m"));
+        assert!(!breakers.reset_module("m"));
+        assert!(call(&breakers, Outcome::Success));
+        old.finish(Some(Outcome::Failure));
+        assert_eq!(breakers.list()[0].failures, 0);
+        assert_eq!(breakers.list().len(), 1);
+    }
+}
@@ -0,0 +1,182 @@
+//! Time budgets for running modules.
+//!
+//! Budgets are enforced by the epoch deadline callback, which runs on every
+//! tick of the epoch timer while a guest is executing, so a guest that runs
+//! over is stopped within a tick. Guests waiting in async host imports don't
+//! run the callback, so the wall-clock budget is also enforced by a timeout
+//! around the whole call.
+
+use std::collections::HashMap;
+use std::fmt::Display;
+use std::time::Duration;
+
+use parking_lot::{Mutex, RwLock};
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Budget {
+    /// Wall-clock time for the whole call, including instantiation and the
+    /// time spent waiting in async host imports.
+    pub wall: Duration,
+    /// Time spent running guest code. Measured in ticks of the epoch timer,
+    /// so it is only as precise as the timer.
+    pub cpu: Duration,
+}
+
+impl Default for Budget {
+    fn default() -> Self {
+        Self {
+            wall: Duration::from_millis(5000),
+            cpu: Duration::from_millis(5000),
+        }
+    }
+}
+
+impl Budget {
+    pub(crate) fn check(&self, wall: Duration, cpu: Duration) -> Result<(), Overrun> {
+        if wall > self.wall {
+            Err(Overrun {
+                limit: Limit::Wall,
+                by: wall - self.wall,
+            })
+        } else if cpu > self.cpu {
+            Err(Overrun {
+                limit: Limit::Cpu,
+                by: cpu - self.cpu,
+            })
+        } else {
+            Ok(())
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Limit {
+    Wall,
+    Cpu,
+}
+
+/// A guest ran past its budget. Returned by the epoch deadline callback to
+/// stop the guest.
+#[derive(Debug, Clone, Copy)]
+pub(crate) struct Overrun {
+    pub(crate) limit: Limit,
+    /// How far past the budget the guest was when it was stopped.
+    pub(crate) by: Duration,
+}
+
+impl Display for Overrun {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        let limit = match self.limit {
+            Limit::Wall => "wall-clock",
+            Limit::Cpu => "CPU",
+        };
+        write!(f, "{limit} time budget exceeded by {:?}", self.by)
+    }
+}
+
+impl std::error::Error for Overrun {}
+
+/// Overruns of one entry point.
+#[derive(Debug, Clone, Default)]
+pub struct OverrunStats {
+    pub count: u64,
+    /// The limit that stopped the guest most recently.
+    pub last_limit: Option<Limit>,
+    pub last: Duration,
+    pub worst: Duration,
+}
+
+#[derive(Default)]
+struct ModuleBudgets {
+    module: Option<Budget>,
+    entry_points: HashMap<String, Budget>,
+}
+
+/// Budgets configured for modules and entry points, and the overruns seen
+/// so far.
+#[derive(Default)]
+pub(crate) struct Budgets {
+    default: Budget,
+    /// Keyed by module name. Nested, so that looking up a budget on every
+    /// call does not need to build an owned key.
+    budgets: RwLock<HashMap<String, ModuleBudgets>>,
+    overruns: Mutex<HashMap<(String, String), OverrunStats>>,
+}
+
+impl Budgets {
+    pub(crate) fn set_default(&mut self, budget: Budget) {
+        self.default = budget;
+    }
+
+    pub(crate) fn set(&self, module: &str, entry_point: Option<&str>, budget: Budget) {
+        let mut budgets = self.budgets.write();
+        let module = budgets.entry(module.to_string()).or_default();
+        match entry_point {
+            Some(entry_point) => {
+                module.entry_points.insert(entry_point.to_string(), budget);
+            }
+            None => module.module = Some(budget),
+        }
+    }
+
+    /// The budget for an entry point: its own if it has one, otherwise the
+    /// one of the module, otherwise the default.
+    pub(crate) fn get(&self, module: &str, entry_point: &str) -> Budget {
+        let budgets = self.budgets.read();
+        let Some(module) = budgets.get(module) else { return self.default; };
+        module
+            .entry_points
+            .get(entry_point)
+            .copied()
+            .or(module.module)
+            .unwrap_or(self.default)
+    }
+
+    pub(crate) fn record(&self, module: &str, entry_point: &str, overrun: Overrun) {
+        let key = (module.to_string(), entry_point.to_string());
+        let mut overruns = self.overruns.lock();
+        let stats = overruns.entry(key).or_default();
+        stats.count += 1;
+        stats.last_limit = Some(overrun.limit);
+        stats.last = overrun.by;
+        stats.worst = stats.worst.max(overrun.by);
+    }
+
+    pub(crate) fn overruns(&self) -> Vec<(String, OverrunStats)> {
+        let mut list: Vec<_> = self
+            .overruns
+            .lock()
+            .iter()
+            .map(|((module, entry_point), stats)| {
+                (format!("{module}.{entry_point}"), stats.clone())
+            })
+            .collect();
+        list.sort_by(|a, b| a.0.cmp(&b.0));
+        list
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::buffers::counting::allocations;
+
+    fn budget(ms: u64) -> Budget {
+        Budget {
+            wall: Duration::from_millis(ms),
+            cpu: Duration::from_millis(ms),
+        }
+    }
+
+    #[test]
+    fn lookup() {
+        let mut budgets = Budgets::default();
+        budgets.set_default(budget(1));
+        budgets.set("m", None, budget(2));
+        budgets.set("m", Some("slow"), budget(3));
+        assert_eq!(budgets.get("other", "f"), budget(1));
+        assert_eq!(budgets.get("m", "f"), budget(2));
+        assert_eq!(budgets.get("m", "slow"), budget(3));
+        assert_eq!(allocations(|| budgets.get("m", "slow")), 0);
+    }
+}
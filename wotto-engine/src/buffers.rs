@@ -0,0 +1,140 @@
+//! Recycled buffers for the input and output of calls.
+//!
+//! Every call needs a buffer for its arguments and one for its output. They
+//! are taken from a pool and given back after the call, so that a warm call
+//! does not allocate them again.
+
+use parking_lot::Mutex;
+
+/// Buffers kept in the pool. More than this are only needed when many calls
+/// run at the same time, and can be allocated again.
+const MAX_BUFFERS: usize = 64;
+/// Buffers that grew larger than this are not kept.
+const MAX_BUFFER_CAPACITY: usize = 64 << 10;
+
+pub(crate) struct BufferPool {
+    buffers: Mutex<Vec<String>>,
+    /// Capacity of new buffers.
+    capacity: usize,
+}
+
+impl BufferPool {
+    pub(crate) fn new(capacity: usize) -> Self {
+        Self {
+            buffers: Mutex::new(Vec::with_capacity(MAX_BUFFERS)),
+            capacity,
+        }
+    }
+
+    /// An empty buffer, with at least the capacity of the pool.
+    pub(crate) fn take(&self) -> String {
+        self.buffers
+            .lock()
+            .pop()
+            .unwrap_or_else(|| String::with_capacity(self.capacity))
+    }
+
+    /// Bytes held by the buffers in the pool.
+    pub(crate) fn retained(&self) -> usize {
+        self.buffers.lock().iter().map(String::capacity).sum()
+    }
+
+    /// Drop the buffers in the pool. Returns the bytes they held. The pool
+    /// fills up again as calls give their buffers back.
+    pub(crate) fn shrink(&self) -> usize {
+        let buffers = std::mem::take(&mut *self.buffers.lock());
+        buffers.iter().map(String::capacity).sum()
+    }
+
+    pub(crate) fn give_back(&self, mut buffer: String) {
+        if buffer.capacity() < self.capacity || buffer.capacity() > MAX_BUFFER_CAPACITY {
+            return;
+        }
+        buffer.clear();
+        let mut buffers = self.buffers.lock();
+        if buffers.len() < MAX_BUFFERS {
+            buffers.push(buffer);
+        }
+    }
+}
+
+/// A global allocator that counts the allocations made by each thread, for
+/// tests that check that a path does not allocate.
+#[cfg(test)]
+pub(crate) mod counting {
+    use std::alloc::{GlobalAlloc, Layout, System};
+    use std::cell::Cell;
+
+    struct Counting;
+
+    thread_local! {
+        static ALLOCATIONS: Cell<usize> = const { Cell::new(0) };
+    }
+
+    unsafe impl GlobalAlloc for Counting {
+        unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+            let _ = ALLOCATIONS.try_with(|count| count.set(count.get() + 1));
+            System.alloc(layout)
+        }
+
+        unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+            System.dealloc(ptr, layout)
+        }
+
+        unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+            let _ = ALLOCATIONS.try_with(|count| count.set(count.get() + 1));
+            System.realloc(ptr, layout, new_size)
+        }
+    }
+
+    #[global_allocator]
+    static GLOBAL: Counting = Counting;
+
+    /// How many allocations `f` made on this thread.
+    pub(crate) fn allocations<T>(f: impl FnOnce() -> T) -> usize {
+        let before = ALLOCATIONS.with(Cell::get);
+        std::hint::black_box(f());
+        ALLOCATIONS.with(Cell::get) - before
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::counting::allocations;
+    use super::*;
+
+    #[test]
+    fn buffers_are_recycled() {
+        let pool = BufferPool::new(512);
+        let buffer = pool.take();
+        assert!(buffer.capacity() >= 512);
+        pool.give_back(buffer);
+        let count = allocations(|| {
+            let mut buffer = pool.take();
+            buffer.push_str("some arguments");
+            pool.give_back(buffer);
+        });
+        assert_eq!(count, 0);
+        assert!(pool.take().is_empty());
+    }
+
+    #[test]
+    fn shrink() {
+        let pool = BufferPool::new(512);
+        let (first, second) = (pool.take(), pool.take());
+        pool.give_back(first);
+        pool.give_back(second);
+        let retained = pool.retained();
+        assert!(retained >= 1024);
+        assert_eq!(pool.shrink(), retained);
+        assert_eq!(pool.retained(), 0);
+    }
+
+    #[test]
+    fn odd_buffers_are_dropped() {
+        let pool = BufferPool::new(512);
+        pool.give_back(String::new());
+        pool.give_back("x".repeat(MAX_BUFFER_CAPACITY + 1));
+        assert!(pool.buffers.lock().is_empty());
+    }
+}
@@ -0,0 +1,91 @@
+//! Bundles of precompiled modules.
+//!
+//! A bundle is a directory containing a `manifest.json` and one artifact per
+//! module, serialized by `Engine::precompile_module`. Bundles are produced at
+//! deploy time (see `Service::write_bundle`) so that the bot can load them
+//! with `Service::load_bundle` without compiling anything.
+
+use std::ffi::OsStr;
+use std::fs;
+use std::path::Path;
+
+use serde::{Deserialize, Serialize};
+
+use crate::service::{Error, Result};
+
+const MANIFEST_FILE: &str = "manifest.json";
+
+/// Bump when the layout of the bundle or of the manifest changes.
+const BUNDLE_FORMAT: u32 = 1;
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct Manifest {
+    pub format: u32,
+    /// Fingerprint of the engine that compiled the artifacts.
+    pub engine: String,
+    pub modules: Vec<BundledModule>,
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct BundledModule {
+    /// Module name, as it will be registered in the service.
+    pub name: String,
+    /// File name of the artifact, relative to the bundle directory.
+    pub artifact: String,
+    /// Path of the original module, for reference only.
+    pub source: String,
+    pub source_size: u64,
+    pub artifact_size: u64,
+    pub compile_time_ms: f64,
+}
+
+impl Manifest {
+    pub(crate) fn new(engine: String) -> Self {
+        Self {
+            format: BUNDLE_FORMAT,
+            engine,
+            modules: vec![],
+        }
+    }
+
+    pub(crate) fn read(dir: &Path) -> Result<Self> {
+        let data = fs::read(dir.join(MANIFEST_FILE))?;
+        serde_json::from_slice(&data).map_err(|err| Error::InvalidBundle(err.to_string()))
+    }
+
+    pub(crate) fn write(&self, dir: &Path) -> Result<()> {
+        let data =
+            serde_json::to_vec_pretty(self).map_err(|err| Error::InvalidBundle(err.to_string()))?;
+        fs::write(dir.join(MANIFEST_FILE), data)?;
+        Ok(())
+    }
+
+    /// Check that the bundle was produced for an engine like the running one.
+    /// Wasmtime does its own checks when deserializing each artifact, but
+    /// this catches mismatches early and with a clearer error.
+    pub(crate) fn check_compatible(&self, engine: &str) -> Result<()> {
+        if self.format != BUNDLE_FORMAT {
+            return Err(Error::InvalidBundle(format!(
+                "unsupported bundle format {} (expected {BUNDLE_FORMAT})",
+                self.format
+            )));
+        }
+        if self.engine != engine {
+            return Err(Error::InvalidBundle(format!(
+                "bundle compiled for engine \"{}\", running \"{engine}\"",
+                self.engine
+            )));
+        }
+        for module in &self.modules {
+            let is_plain_file_name =
+                Path::new(&module.artifact).file_name() == Some(OsStr::new(&module.artifact));
+            if !is_plain_file_name {
+                return Err(Error::InvalidBundle(format!(
+                    "artifact {} is not in the bundle directory",
+                    module.artifact
+                )));
+            }
+        }
+        Ok(())
+    }
+}
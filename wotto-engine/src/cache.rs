@@ -0,0 +1,738 @@
+//! Key-value cache for guests.
+//!
+//! Each module gets its own namespace, so modules never see each other's
+//! keys. Entries live in a sharded LRU bounded by a total size, and each
+//! module has a quota on how many bytes it can hold. Optionally, writes are
+//! also appended to a memory-mapped log which is replayed at startup, so that
+//! the cache survives restarts.
+
+use std::collections::hash_map::RandomState;
+use std::collections::HashMap;
+use std::fs::{File, OpenOptions};
+use std::hash::BuildHasher;
+use std::io;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+
+use memmap2::MmapMut;
+use parking_lot::{Mutex, RwLock};
+use tracing::{info, warn};
+
+const SHARDS: usize = 16;
+
+#[derive(Debug, Clone)]
+pub struct CacheConfig {
+    /// Total size of the entries held in memory, across all modules.
+    pub capacity: usize,
+    /// Size of the entries each module can hold.
+    pub module_quota: usize,
+    /// Largest key or value accepted.
+    pub max_entry_size: usize,
+    /// Append-only log to persist the cache, if any.
+    pub log_path: Option<PathBuf>,
+    /// Size of the log file. When it is full, it is rewritten with only the
+    /// live entries, so it should be comfortably larger than `capacity`:
+    /// entries that do not fit in half of it are not persisted.
+    pub log_size: usize,
+}
+
+impl Default for CacheConfig {
+    fn default() -> Self {
+        Self {
+            capacity: 16 << 20,
+            module_quota: 256 << 10,
+            max_entry_size: 16 << 10,
+            log_path: None,
+            log_size: 64 << 20,
+        }
+    }
+}
+
+pub(crate) struct Cache {
+    config: CacheConfig,
+    hasher: RandomState,
+    shards: Box<[Mutex<Shard>]>,
+    namespaces: RwLock<HashMap<Box<str>, Arc<Namespace>>>,
+    log: Option<Mutex<Log>>,
+}
+
+/// Per-module state shared by all the entries of the module.
+struct Namespace {
+    name: Box<str>,
+    usage: AtomicUsize,
+}
+
+/// A key qualified with its namespace, as stored in the shards.
+pub(crate) struct CacheKey(Box<[u8]>);
+
+/// The cache as seen by one module.
+#[derive(Clone)]
+pub(crate) struct CacheScope {
+    cache: Arc<Cache>,
+    namespace: Arc<Namespace>,
+}
+
+impl Cache {
+    pub(crate) fn new(config: CacheConfig) -> io::Result<Arc<Self>> {
+        let shard_capacity = config.capacity / SHARDS;
+        let log = match &config.log_path {
+            Some(path) => Some(Log::open(path, config.log_size)?),
+            None => None,
+        };
+        let cache = Arc::new(Self {
+            hasher: RandomState::new(),
+            shards: (0..SHARDS)
+                .map(|_| Mutex::new(Shard::new(shard_capacity)))
+                .collect(),
+            namespaces: RwLock::default(),
+            log: None,
+            config,
+        });
+        let Some(mut log) = log else { return Ok(cache); };
+        let mut records = 0;
+        log.replay(|record| {
+            let scope = cache.scope(record.namespace);
+            let key = scope.key(record.key);
+            match record.value {
+                Some(value) => scope.insert(key, value),
+                None => scope.remove(&key),
+            };
+            records += 1;
+        });
+        info!(records, path = ?log.path, "replayed cache log");
+        let mut cache = Arc::into_inner(cache).expect("cache should not be shared yet");
+        cache.log = Some(Mutex::new(log));
+        Ok(Arc::new(cache))
+    }
+
+    pub(crate) fn scope(self: &Arc<Self>, module: &str) -> CacheScope {
+        let namespace = self.namespaces.read().get(module).cloned();
+        let namespace = namespace.unwrap_or_else(|| {
+            self.namespaces
+                .write()
+                .entry(module.into())
+                .or_insert_with(|| {
+                    Arc::new(Namespace {
+                        name: module.into(),
+                        usage: AtomicUsize::new(0),
+                    })
+                })
+                .clone()
+        });
+        CacheScope {
+            cache: self.clone(),
+            namespace,
+        }
+    }
+
+    fn shard(&self, key: &CacheKey) -> &Mutex<Shard> {
+        &self.shards[self.hasher.hash_one(&key.0) as usize % SHARDS]
+    }
+
+    /// Bytes held in memory by the entries of all modules.
+    pub(crate) fn size(&self) -> usize {
+        self.shards.iter().map(|shard| shard.lock().size).sum()
+    }
+
+    /// Apply a change to the cache with `change`, and write `record` to the
+    /// log if there is one and the change was made. With a log, the change is
+    /// made under its lock, so that changes to the same key reach the log in
+    /// the same order as the cache. Compaction takes the locks in the same
+    /// order: the log, then the shards.
+    fn write(&self, record: &Record, change: impl FnOnce() -> bool) -> bool {
+        let Some(log) = &self.log else { return change(); };
+        let mut log = log.lock();
+        if !change() {
+            return false;
+        }
+        self.append(&mut log, record);
+        true
+    }
+
+    /// Write a record to the log. When the log is full, it is compacted from
+    /// the current contents of the cache.
+    fn append(&self, log: &mut Log, record: &Record) {
+        if log.append(record) {
+            return;
+        }
+        let result = log.compact(|write| {
+            for shard in self.shards.iter() {
+                let shard = shard.lock();
+                for node in shard.nodes.iter().flatten() {
+                    let key = &node.key[node.namespace.name.len() + 1..];
+                    write(&Record::put(&node.namespace.name, key, &node.value));
+                }
+            }
+        });
+        match result {
+            Ok(0) => info!(path = ?log.path, size = log.len, "compacted cache log"),
+            Ok(left_out) => warn!(
+                path = ?log.path,
+                size = log.len,
+                left_out,
+                "compacted cache log, but the cache does not fit"
+            ),
+            Err(err) => {
+                warn!(path = ?log.path, %err, "cannot compact cache log");
+                return;
+            }
+        }
+        // the record might have been left out of the snapshot, and a delete
+        // is not in it anyway
+        if !log.append(record) {
+            warn!(path = ?log.path, "cache record does not fit in the log");
+        }
+    }
+}
+
+impl CacheScope {
+    pub(crate) fn key(&self, key: &[u8]) -> CacheKey {
+        let name = self.namespace.name.as_bytes();
+        let mut qualified = Vec::with_capacity(name.len() + 1 + key.len());
+        qualified.extend_from_slice(name);
+        // never part of a valid UTF-8 name
+        qualified.push(0xff);
+        qualified.extend_from_slice(key);
+        CacheKey(qualified.into())
+    }
+
+    /// Pass the value for `key` to `f`, if there is one.
+    pub(crate) fn get<R>(&self, key: &CacheKey, f: impl FnOnce(&[u8]) -> R) -> Option<R> {
+        let mut shard = self.cache.shard(key).lock();
+        shard.get(&key.0).map(f)
+    }
+
+    /// Store a value. Fails if the key or value are too large, or if the
+    /// module would go over its quota.
+    pub(crate) fn put(&self, key: &[u8], value: &[u8]) -> bool {
+        let max = self.cache.config.max_entry_size;
+        if key.len() > max || value.len() > max {
+            return false;
+        }
+        let qualified = self.key(key);
+        let record = Record::put(&self.namespace.name, key, value);
+        self.cache.write(&record, || self.insert(qualified, value))
+    }
+
+    pub(crate) fn delete(&self, key: &[u8]) -> bool {
+        let qualified = self.key(key);
+        let record = Record::delete(&self.namespace.name, key);
+        self.cache.write(&record, || self.remove(&qualified))
+    }
+
+    fn insert(&self, key: CacheKey, value: &[u8]) -> bool {
+        let size = key.0.len() + value.len();
+        let quota = self.cache.config.module_quota;
+        let mut shard = self.cache.shard(&key).lock();
+        let old_size = shard.size_of(&key.0).unwrap_or(0);
+        let reserved =
+            self.namespace
+                .usage
+                .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |usage| {
+                    Some(usage + size - old_size).filter(|&usage| usage <= quota)
+                });
+        if reserved.is_err() {
+            return false;
+        }
+        // the size of a replaced entry was already taken into account
+        shard.insert(key.0, value.into(), self.namespace.clone());
+        while shard.size > shard.capacity {
+            let Some(evicted) = shard.pop_lru() else { break; };
+            evicted
+                .namespace
+                .usage
+                .fetch_sub(evicted.size(), Ordering::Relaxed);
+        }
+        true
+    }
+
+    fn remove(&self, key: &CacheKey) -> bool {
+        let mut shard = self.cache.shard(key).lock();
+        let Some(removed) = shard.remove(&key.0) else { return false; };
+        removed
+            .namespace
+            .usage
+            .fetch_sub(removed.size(), Ordering::Relaxed);
+        true
+    }
+
+    /// Bytes currently used by this module.
+    #[cfg(test)]
+    fn usage(&self) -> usize {
+        self.namespace.usage.load(Ordering::Relaxed)
+    }
+}
+
+const NIL: usize = usize::MAX;
+
+struct Node {
+    key: Box<[u8]>,
+    value: Box<[u8]>,
+    namespace: Arc<Namespace>,
+    prev: usize,
+    next: usize,
+}
+
+impl Node {
+    fn size(&self) -> usize {
+        self.key.len() + self.value.len()
+    }
+}
+
+/// LRU map, as a doubly linked list in a slab plus an index.
+struct Shard {
+    index: HashMap<Box<[u8]>, usize>,
+    nodes: Vec<Option<Node>>,
+    free: Vec<usize>,
+    /// Most recently used.
+    head: usize,
+    /// Least recently used.
+    tail: usize,
+    size: usize,
+    capacity: usize,
+}
+
+impl Shard {
+    fn new(capacity: usize) -> Self {
+        Self {
+            index: HashMap::new(),
+            nodes: Vec::new(),
+            free: Vec::new(),
+            head: NIL,
+            tail: NIL,
+            size: 0,
+            capacity,
+        }
+    }
+
+    fn node(&mut self, i: usize) -> &mut Node {
+        self.nodes[i].as_mut().expect("linked node should exist")
+    }
+
+    fn unlink(&mut self, i: usize) {
+        let Node { prev, next, .. } = *self.node(i);
+        match prev {
+            NIL => self.head = next,
+            prev => self.node(prev).next = next,
+        }
+        match next {
+            NIL => self.tail = prev,
+            next => self.node(next).prev = prev,
+        }
+    }
+
+    fn push_front(&mut self, i: usize) {
+        let head = self.head;
+        let node = self.node(i);
+        node.prev = NIL;
+        node.next = head;
+        match head {
+            NIL => self.tail = i,
+            head => self.node(head).prev = i,
+        }
+        self.head = i;
+    }
+
+    fn get(&mut self, key: &[u8]) -> Option<&[u8]> {
+        let i = *self.index.get(key)?;
+        if self.head != i {
+            self.unlink(i);
+            self.push_front(i);
+        }
+        Some(&self.node(i).value)
+    }
+
+    fn size_of(&self, key: &[u8]) -> Option<usize> {
+        let i = *self.index.get(key)?;
+        self.nodes[i].as_ref().map(Node::size)
+    }
+
+    fn insert(&mut self, key: Box<[u8]>, value: Box<[u8]>, namespace: Arc<Namespace>) {
+        self.remove(&key);
+        let node = Node {
+            key: key.clone(),
+            value,
+            namespace,
+            prev: NIL,
+            next: NIL,
+        };
+        self.size += node.size();
+        let i = match self.free.pop() {
+            Some(i) => {
+                self.nodes[i] = Some(node);
+                i
+            }
+            None => {
+                self.nodes.push(Some(node));
+                self.nodes.len() - 1
+            }
+        };
+        self.index.insert(key, i);
+        self.push_front(i);
+    }
+
+    fn remove(&mut self, key: &[u8]) -> Option<Node> {
+        let i = self.index.remove(key)?;
+        Some(self.take(i))
+    }
+
+    fn pop_lru(&mut self) -> Option<Node> {
+        if self.tail == NIL {
+            return None;
+        }
+        let i = self.tail;
+        let node = self.take(i);
+        self.index.remove(&node.key);
+        Some(node)
+    }
+
+    fn take(&mut self, i: usize) -> Node {
+        self.unlink(i);
+        self.free.push(i);
+        let node = self.nodes[i].take().expect("linked node should exist");
+        self.size -= node.size();
+        node
+    }
+}
+
+/// An entry of the log. A missing value means that the key was deleted.
+struct Record<'a> {
+    namespace: &'a str,
+    key: &'a [u8],
+    value: Option<&'a [u8]>,
+}
+
+impl<'a> Record<'a> {
+    fn put(namespace: &'a str, key: &'a [u8], value: &'a [u8]) -> Self {
+        Self {
+            namespace,
+            key,
+            value: Some(value),
+        }
+    }
+
+    fn delete(namespace: &'a str, key: &'a [u8]) -> Self {
+        Self {
+            namespace,
+            key,
+            value: None,
+        }
+    }
+
+    /// Length of the record in the log, not counting its own length.
+    fn len(&self) -> usize {
+        RECORD_HEADER + self.namespace.len() + self.key.len() + self.value.map_or(0, <[u8]>::len)
+    }
+}
+
+const LOG_MAGIC: &[u8; 8] = b"WOTTOKV1";
+const OP_PUT: u8 = 1;
+const OP_DELETE: u8 = 2;
+/// op, namespace length, key length
+const RECORD_HEADER: usize = 1 + 2 + 4;
+
+/// Append-only log in a memory-mapped file of fixed size.
+///
+/// Layout: the magic string, then records, then zeroes up to the end of the
+/// file. Each record is its length (u32, not counting itself), then the
+/// operation (u8), the length of the namespace (u16) and of the key (u32),
+/// followed by namespace, key and value. A zero length marks the end.
+struct Log {
+    path: PathBuf,
+    map: MmapMut,
+    /// Offset where the next record goes.
+    len: usize,
+}
+
+impl Log {
+    fn open(path: &Path, size: usize) -> io::Result<Self> {
+        let file = Self::open_file(path, size)?;
+        // Safety: the file is only supposed to be modified by this process;
+        // replay() checks every length it reads anyway.
+        let mut map = unsafe { MmapMut::map_mut(&file)? };
+        if map[..LOG_MAGIC.len()] != *LOG_MAGIC {
+            if map.iter().any(|&b| b != 0) {
+                return Err(io::Error::new(
+                    io::ErrorKind::InvalidData,
+                    "not a cache log",
+                ));
+            }
+            map[..LOG_MAGIC.len()].copy_from_slice(LOG_MAGIC);
+        }
+        Ok(Self {
+            path: path.to_path_buf(),
+            map,
+            len: LOG_MAGIC.len(),
+        })
+    }
+
+    fn open_file(path: &Path, size: usize) -> io::Result<File> {
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .open(path)?;
+        let size = size.max(LOG_MAGIC.len() + 4) as u64;
+        if file.metadata()?.len() < size {
+            file.set_len(size)?;
+        }
+        Ok(file)
+    }
+
+    /// Call `f` for each valid record and move the end of the log after the
+    /// last one. Anything after a truncated or malformed record is ignored.
+    fn replay(&mut self, mut f: impl FnMut(Record)) {
+        let mut pos = LOG_MAGIC.len();
+        while let Some((record, next)) = Self::read(&self.map, pos) {
+            f(record);
+            pos = next;
+        }
+        self.len = pos;
+        self.terminate();
+    }
+
+    /// Make sure that the log ends at `len`, even if there are leftovers of
+    /// a record that was only partially written.
+    fn terminate(&mut self) {
+        if let Some(end) = self.map.get_mut(self.len..self.len + 4) {
+            end.fill(0);
+        }
+    }
+
+    fn read(map: &[u8], pos: usize) -> Option<(Record<'_>, usize)> {
+        let len = u32::from_le_bytes(map.get(pos..pos + 4)?.try_into().ok()?) as usize;
+        let body = map.get(pos + 4..pos + 4 + len)?;
+        let header = body.get(..RECORD_HEADER)?;
+        let op = header[0];
+        let namespace_len = u16::from_le_bytes([header[1], header[2]]) as usize;
+        let key_len = u32::from_le_bytes(header[3..7].try_into().ok()?) as usize;
+        let rest = &body[RECORD_HEADER..];
+        let namespace = std::str::from_utf8(rest.get(..namespace_len)?).ok()?;
+        let key = rest.get(namespace_len..namespace_len.checked_add(key_len)?)?;
+        let value = &rest[namespace_len + key_len..];
+        let value = match op {
+            OP_PUT => Some(value),
+            OP_DELETE if value.is_empty() => None,
+            _ => return None,
+        };
+        let record = Record {
+            namespace,
+            key,
+            value,
+        };
+        Some((record, pos + 4 + len))
+    }
+
+    /// Returns false if the record does not fit.
+    fn append(&mut self, record: &Record) -> bool {
+        let value = record.value.unwrap_or_default();
+        let len = record.len();
+        let Some(out) = self.map.get_mut(self.len..self.len + 4 + len) else { return false; };
+        out[..4].copy_from_slice(&(len as u32).to_le_bytes());
+        out[4] = if record.value.is_some() {
+            OP_PUT
+        } else {
+            OP_DELETE
+        };
+        out[5..7].copy_from_slice(&(record.namespace.len() as u16).to_le_bytes());
+        out[7..11].copy_from_slice(&(record.key.len() as u32).to_le_bytes());
+        let rest = &mut out[11..];
+        let (namespace, rest) = rest.split_at_mut(record.namespace.len());
+        let (key, rest) = rest.split_at_mut(record.key.len());
+        namespace.copy_from_slice(record.namespace.as_bytes());
+        key.copy_from_slice(record.key);
+        rest.copy_from_slice(value);
+        self.len += 4 + len;
+        self.terminate();
+        true
+    }
+
+    /// Replace the log with a new one, written by `snapshot`. The snapshot
+    /// takes at most half of the log, to leave room for the records that
+    /// follow: records that do not fit are left out, and lost on restart.
+    /// Returns how many were left out. On error, the log is left as it was.
+    fn compact(&mut self, snapshot: impl FnOnce(&mut dyn FnMut(&Record))) -> io::Result<usize> {
+        let tmp_path = self.path.with_extension("compacting");
+        let _ = std::fs::remove_file(&tmp_path);
+        let result = self.replace_with_snapshot(&tmp_path, snapshot);
+        if result.is_err() {
+            let _ = std::fs::remove_file(&tmp_path);
+        }
+        result
+    }
+
+    fn replace_with_snapshot(
+        &mut self,
+        tmp_path: &Path,
+        snapshot: impl FnOnce(&mut dyn FnMut(&Record)),
+    ) -> io::Result<usize> {
+        let mut new = Self::open(tmp_path, self.map.len())?;
+        let limit = self.map.len() / 2;
+        let mut left_out = 0;
+        snapshot(&mut |record: &Record| {
+            if new.len + 4 + record.len() > limit || !new.append(record) {
+                left_out += 1;
+            }
+        });
+        new.map.flush()?;
+        std::fs::rename(tmp_path, &self.path)?;
+        new.path = self.path.clone();
+        *self = new;
+        Ok(left_out)
+    }
+}
+
+impl Drop for Log {
+    fn drop(&mut self) {
+        if let Err(err) = self.map.flush() {
+            warn!(path = ?self.path, %err, "cannot flush cache log");
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn cache(capacity: usize, module_quota: usize) -> Arc<Cache> {
+        Cache::new(CacheConfig {
+            capacity: capacity * SHARDS,
+            module_quota,
+            ..Default::default()
+        })
+        .unwrap()
+    }
+
+    fn get(scope: &CacheScope, key: &[u8]) -> Option<Vec<u8>> {
+        scope.get(&scope.key(key), <[u8]>::to_vec)
+    }
+
+    #[test]
+    fn put_get_delete() {
+        let cache = cache(1024, 1024);
+        let scope = cache.scope("foo");
+        assert_eq!(get(&scope, b"k"), None);
+        assert!(scope.put(b"k", b"v1"));
+        assert!(scope.put(b"k", b"v2"));
+        assert_eq!(get(&scope, b"k").as_deref(), Some(&b"v2"[..]));
+        assert!(scope.delete(b"k"));
+        assert!(!scope.delete(b"k"));
+        assert_eq!(get(&scope, b"k"), None);
+        assert_eq!(scope.usage(), 0);
+    }
+
+    #[test]
+    fn namespaces_are_separate() {
+        let cache = cache(1024, 1024);
+        let foo = cache.scope("foo");
+        let bar = cache.scope("bar");
+        assert!(foo.put(b"k", b"foo"));
+        assert_eq!(get(&bar, b"k"), None);
+        assert!(bar.put(b"k", b"bar"));
+        assert_eq!(get(&foo, b"k").as_deref(), Some(&b"foo"[..]));
+    }
+
+    #[test]
+    fn quota() {
+        let cache = cache(1024, 20);
+        let scope = cache.scope("foo");
+        // "foo" + separator + 1 byte key = 5 bytes of key per entry
+        assert!(scope.put(b"a", b"0123456789"));
+        assert!(!scope.put(b"b", b"0123456789"));
+        // replacing an entry only counts the difference
+        assert!(scope.put(b"a", b"01234567890123"));
+        assert_eq!(scope.usage(), 19);
+        assert!(scope.delete(b"a"));
+        assert!(scope.put(b"b", b"0123456789"));
+    }
+
+    #[test]
+    fn lru_eviction() {
+        let mut shard = Shard::new(12);
+        let namespace = Arc::new(Namespace {
+            name: "foo".into(),
+            usage: AtomicUsize::new(0),
+        });
+        for key in [b"a", b"b", b"c"] {
+            shard.insert(key[..].into(), b"xxx"[..].into(), namespace.clone());
+        }
+        // touch "a", so that "b" is the least recently used
+        assert!(shard.get(b"a").is_some());
+        shard.insert(b"d"[..].into(), b"xxx"[..].into(), namespace);
+        let evicted = shard.pop_lru().unwrap();
+        assert_eq!(&*evicted.key, b"b");
+        assert_eq!(shard.size, 12);
+        assert!(shard.get(b"c").is_some());
+        assert!(shard.get(b"b").is_none());
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)] // mmap is not supported
+    fn log_survives_restart() {
+        let dir = std::env::temp_dir().join(format!("wotto-cache-test-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("cache.log");
+        let _ = std::fs::remove_file(&path);
+        let config = CacheConfig {
+            log_path: Some(path.clone()),
+            log_size: 4096,
+            ..Default::default()
+        };
+        {
+            let cache = Cache::new(config.clone()).unwrap();
+            let scope = cache.scope("foo");
+            assert!(scope.put(b"kept", b"1"));
+            assert!(scope.put(b"deleted", b"2"));
+            assert!(scope.delete(b"deleted"));
+            // enough writes to fill the log and trigger compaction
+            for i in 0..300u32 {
+                assert!(scope.put(b"overwritten", &i.to_le_bytes()));
+            }
+        }
+        let cache = Cache::new(config).unwrap();
+        let scope = cache.scope("foo");
+        assert_eq!(get(&scope, b"kept").as_deref(), Some(&b"1"[..]));
+        assert_eq!(get(&scope, b"deleted"), None);
+        assert_eq!(
+            get(&scope, b"overwritten").as_deref(),
+            Some(&299u32.to_le_bytes()[..])
+        );
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)] // mmap is not supported
+    fn cache_larger_than_log() {
+        let dir = std::env::temp_dir().join(format!("wotto-cache-large-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("cache.log");
+        let _ = std::fs::remove_file(&path);
+        let config = CacheConfig {
+            log_path: Some(path.clone()),
+            log_size: 4096,
+            ..Default::default()
+        };
+        {
+            let cache = Cache::new(config.clone()).unwrap();
+            let scope = cache.scope("foo");
+            // about 16 KiB of entries, for a 4 KiB log
+            for i in 0..256u32 {
+                assert!(scope.put(&i.to_le_bytes(), &[0; 60]));
+            }
+            assert!(scope.delete(&0u32.to_le_bytes()));
+            assert!(scope.put(b"last", b"1"));
+        }
+        assert!(!path.with_extension("compacting").exists());
+        let cache = Cache::new(config).unwrap();
+        let scope = cache.scope("foo");
+        // the latest write always makes it, the rest as far as it fits
+        assert_eq!(get(&scope, b"last").as_deref(), Some(&b"1"[..]));
+        assert_eq!(get(&scope, &0u32.to_le_bytes()), None);
+        let kept = (1..256u32)
+            .filter(|i| get(&scope, &i.to_le_bytes()).is_some())
+            .count();
+        assert!(kept > 0 && kept < 255, "{kept}");
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -1,11 +1,38 @@
 #![feature(pointer_is_aligned)]
 
 mod assemblyscript;
+#[cfg(feature = "bench")]
+#[doc(hidden)]
+pub mod bench;
+mod blobs;
+mod breaker;
+mod budget;
+mod buffers;
+pub mod bundle;
+mod cache;
+mod memory;
+mod profiler;
+mod regexes;
 mod registry;
 #[cfg(feature = "repl")]
 pub mod repl;
+mod replay;
 mod runtime;
 mod service;
+mod slim;
+mod text;
+mod threads;
+mod usage;
 mod webload;
 
-pub use service::{Command, Error, Service};
+pub use blobs::BlobInfo;
+pub use breaker::{BreakerConfig, BreakerInfo, BreakerState};
+pub use budget::{Budget, Limit, OverrunStats};
+pub use cache::CacheConfig;
+pub use memory::{MemoryLimits, MemoryReport, Pressure};
+pub use profiler::ProfilerConfig;
+pub use replay::{ReloadGate, ReloadPolicy, ReplayReport};
+pub use service::{Command, Error, HostCallStats, LibraryInfo, RunStats, Service};
+pub use slim::{CustomSections, SlimReport};
+pub use threads::ThreadConfig;
+pub use usage::WarmStats;
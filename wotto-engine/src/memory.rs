@@ -0,0 +1,270 @@
+//! Keeping the memory used by the engine, and by whoever embeds it, under
+//! a limit.
+//!
+//! Nothing is measured: that would take a hook in the allocator. Instead,
+//! every subsystem reports an estimate of what it holds (compiled code, web
+//! content, buffers, cache entries, linear memory of running guests, and
+//! whatever the embedder adds with `Service::set_external_memory`), and the
+//! governor compares the total with two limits. Above the soft limit, it
+//! gives back what can be rebuilt (pooled buffers, downloaded sources,
+//! modules that have not been called in a while) and lets fewer guests run
+//! at the same time. Above the hard limit, it also refuses to load anything
+//! new, and lets a single guest run at a time.
+
+use std::collections::BTreeMap;
+use std::sync::atomic::{AtomicU64, AtomicU8, AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use parking_lot::Mutex;
+use tokio::sync::{OwnedSemaphorePermit, Semaphore};
+
+#[derive(Debug, Clone)]
+pub struct MemoryLimits {
+    pub soft: usize,
+    pub hard: usize,
+    /// Web modules that have not been called for this long can be unloaded
+    /// above the soft limit, until they are called again.
+    pub idle: Duration,
+}
+
+impl Default for MemoryLimits {
+    fn default() -> Self {
+        Self {
+            soft: 256 << 20,
+            hard: 512 << 20,
+            idle: Duration::from_secs(10 * 60),
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Default)]
+pub enum Pressure {
+    #[default]
+    Normal,
+    Soft,
+    Hard,
+}
+
+impl Pressure {
+    fn from_u8(value: u8) -> Self {
+        match value {
+            0 => Self::Normal,
+            1 => Self::Soft,
+            _ => Self::Hard,
+        }
+    }
+}
+
+#[derive(Debug, Clone, Default)]
+pub struct MemoryReport {
+    pub pressure: Pressure,
+    /// Estimated bytes used by each subsystem.
+    pub usage: BTreeMap<String, usize>,
+    pub total: usize,
+    pub soft_limit: usize,
+    pub hard_limit: usize,
+    /// Bytes given back by this check.
+    pub reclaimed: usize,
+    /// Modules unloaded because they were idle, since the start.
+    pub evicted_modules: u64,
+    /// Loads refused because of the hard limit, since the start.
+    pub rejected_loads: u64,
+    /// Execution slots held back to let fewer guests run.
+    pub held_slots: usize,
+}
+
+pub(crate) struct Governor {
+    limits: MemoryLimits,
+    start: Instant,
+    pressure: AtomicU8,
+    /// Total at the last check.
+    total: AtomicUsize,
+    /// Linear memory of the guests running right now.
+    guests: Arc<AtomicUsize>,
+    external: Mutex<BTreeMap<String, usize>>,
+    held: Mutex<Vec<OwnedSemaphorePermit>>,
+    evicted: AtomicU64,
+    rejected: AtomicU64,
+}
+
+impl Default for Governor {
+    fn default() -> Self {
+        Self::new(MemoryLimits::default())
+    }
+}
+
+impl Governor {
+    pub(crate) fn new(limits: MemoryLimits) -> Self {
+        Self {
+            limits,
+            start: Instant::now(),
+            pressure: AtomicU8::default(),
+            total: AtomicUsize::default(),
+            guests: Arc::default(),
+            external: Mutex::default(),
+            held: Mutex::default(),
+            evicted: AtomicU64::default(),
+            rejected: AtomicU64::default(),
+        }
+    }
+
+    pub(crate) fn limits(&self) -> &MemoryLimits {
+        &self.limits
+    }
+
+    pub(crate) fn pressure(&self) -> Pressure {
+        Pressure::from_u8(self.pressure.load(Ordering::Relaxed))
+    }
+
+    fn pressure_at(&self, total: usize) -> Pressure {
+        if total >= self.limits.hard {
+            Pressure::Hard
+        } else if total >= self.limits.soft {
+            Pressure::Soft
+        } else {
+            Pressure::Normal
+        }
+    }
+
+    /// Gauge of the linear memory of running guests, kept up to date by
+    /// their stores.
+    pub(crate) fn guests(&self) -> Arc<AtomicUsize> {
+        self.guests.clone()
+    }
+
+    /// Milliseconds since the governor was created, the clock of `is_idle`.
+    pub(crate) fn now(&self) -> u64 {
+        self.start.elapsed().as_millis() as u64
+    }
+
+    /// Whether something last used at `last_used` (from `now`) is idle.
+    pub(crate) fn is_idle(&self, last_used: u64) -> bool {
+        Duration::from_millis(self.now().saturating_sub(last_used)) >= self.limits.idle
+    }
+
+    pub(crate) fn set_external(&self, subsystem: &str, bytes: usize) {
+        self.external.lock().insert(subsystem.to_string(), bytes);
+    }
+
+    /// Add the guests and the external subsystems to `usage`.
+    pub(crate) fn add_usage(&self, usage: &mut BTreeMap<String, usize>) {
+        usage.insert("guests".to_string(), self.guests.load(Ordering::Relaxed));
+        for (subsystem, bytes) in self.external.lock().iter() {
+            usage.insert(subsystem.clone(), *bytes);
+        }
+    }
+
+    /// Whether something of `size` bytes can be loaded, given the total at
+    /// the last check. Counts the refusal if it cannot. Without checks,
+    /// everything is admitted.
+    pub(crate) fn admit_load(&self, size: usize) -> bool {
+        let total = self.total.load(Ordering::Relaxed).saturating_add(size);
+        let admitted = self.pressure() < Pressure::Hard && total < self.limits.hard;
+        if !admitted {
+            self.rejected.fetch_add(1, Ordering::Relaxed);
+        }
+        admitted
+    }
+
+    pub(crate) fn evicted(&self) {
+        self.evicted.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Record the total after a check, and hold back execution slots
+    /// accordingly: half of them above the soft limit, all but one above the
+    /// hard limit. `slots` is the total number of slots, if they are
+    /// limited.
+    pub(crate) fn settle(&self, total: usize, slots: Option<(&Arc<Semaphore>, usize)>) -> Pressure {
+        let pressure = self.pressure_at(total);
+        self.total.store(total, Ordering::Relaxed);
+        self.pressure.store(pressure as u8, Ordering::Relaxed);
+        let mut held = self.held.lock();
+        let Some((semaphore, count)) = slots else { return pressure; };
+        let target = match pressure {
+            Pressure::Normal => 0,
+            Pressure::Soft => count / 2,
+            Pressure::Hard => count.saturating_sub(1),
+        };
+        held.truncate(target);
+        // only take free slots, running guests are left alone
+        while held.len() < target {
+            let Ok(permit) = semaphore.clone().try_acquire_owned() else { break; };
+            held.push(permit);
+        }
+        pressure
+    }
+
+    pub(crate) fn report(&self, usage: BTreeMap<String, usize>, reclaimed: usize) -> MemoryReport {
+        MemoryReport {
+            pressure: self.pressure(),
+            total: usage.values().sum(),
+            usage,
+            soft_limit: self.limits.soft,
+            hard_limit: self.limits.hard,
+            reclaimed,
+            evicted_modules: self.evicted.load(Ordering::Relaxed),
+            rejected_loads: self.rejected.load(Ordering::Relaxed),
+            held_slots: self.held.lock().len(),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn governor() -> Governor {
+        Governor::new(MemoryLimits {
+            soft: 100,
+            hard: 200,
+            idle: Duration::from_secs(60),
+        })
+    }
+
+    #[test]
+    fn pressure() {
+        let governor = governor();
+        assert_eq!(governor.settle(99, None), Pressure::Normal);
+        assert!(governor.admit_load(100));
+        assert!(governor.admit_load(100));
+        assert_eq!(governor.settle(150, None), Pressure::Soft);
+        assert!(governor.admit_load(49));
+        assert!(!governor.admit_load(50));
+        assert_eq!(governor.settle(200, None), Pressure::Hard);
+        assert!(!governor.admit_load(0));
+        assert_eq!(governor.report(BTreeMap::new(), 0).rejected_loads, 2);
+        assert_eq!(governor.settle(0, None), Pressure::Normal);
+        assert!(governor.admit_load(0));
+    }
+
+    #[test]
+    fn slots_held_back() {
+        let governor = governor();
+        let slots = Arc::new(Semaphore::new(4));
+        governor.settle(150, Some((&slots, 4)));
+        assert_eq!(slots.available_permits(), 2);
+        // a running guest keeps its slot
+        let running = slots.clone().try_acquire_owned().unwrap();
+        governor.settle(250, Some((&slots, 4)));
+        assert_eq!(slots.available_permits(), 0);
+        assert_eq!(governor.report(BTreeMap::new(), 0).held_slots, 3);
+        drop(running);
+        governor.settle(250, Some((&slots, 4)));
+        assert_eq!(slots.available_permits(), 1);
+        governor.settle(0, Some((&slots, 4)));
+        assert_eq!(slots.available_permits(), 4);
+    }
+
+    #[test]
+    fn usage() {
+        let governor = governor();
+        governor.set_external("queue", 10);
+        governor.guests().fetch_add(5, Ordering::Relaxed);
+        let mut usage = BTreeMap::from([("modules".to_string(), 1)]);
+        governor.add_usage(&mut usage);
+        let report = governor.report(usage, 0);
+        assert_eq!(report.total, 16);
+        assert_eq!(report.usage["queue"], 10);
+    }
+}
@@ -0,0 +1,175 @@
+//! Sampling profiler for guest code.
+//!
+//! Samples are taken from the epoch deadline callback, so they come for free
+//! with the epoch ticks that already drive async yielding in `run_module`.
+//! Each sample is a wasm backtrace, aggregated per module as a "folded stack"
+//! profile (one `frame;frame;frame count` line per distinct stack), which is
+//! the input format of most flamegraph tools.
+
+use std::collections::HashMap;
+use std::fmt::Write;
+use std::fs;
+use std::io;
+use std::path::Path;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+
+use parking_lot::Mutex;
+use wasmtime::WasmBacktrace;
+
+/// Pseudo-frame used to account for samples that could not be stored because
+/// the profile was full.
+const DROPPED_FRAME: &str = "[dropped]";
+
+#[derive(Debug, Clone)]
+pub struct ProfilerConfig {
+    /// Take one sample every `sample_interval` epoch ticks.
+    pub sample_interval: u64,
+    /// Maximum number of distinct stacks stored for each module. Samples for
+    /// new stacks are counted as dropped once the limit is reached.
+    pub max_stacks: usize,
+    /// Maximum number of frames recorded for each sample. Deeper stacks keep
+    /// their outermost frames.
+    pub max_depth: usize,
+}
+
+impl Default for ProfilerConfig {
+    fn default() -> Self {
+        Self {
+            sample_interval: 1,
+            max_stacks: 4096,
+            max_depth: 64,
+        }
+    }
+}
+
+#[derive(Debug)]
+pub(crate) struct Profiler {
+    config: ProfilerConfig,
+    profiles: Mutex<HashMap<String, Arc<ModuleProfile>>>,
+}
+
+impl Profiler {
+    pub(crate) fn new(config: ProfilerConfig) -> Self {
+        Self {
+            config,
+            profiles: Mutex::default(),
+        }
+    }
+
+    pub(crate) fn sample_interval(&self) -> u64 {
+        self.config.sample_interval.max(1)
+    }
+
+    /// Get the profile for a module, creating an empty one if needed.
+    pub(crate) fn module_profile(&self, module: &str) -> Arc<ModuleProfile> {
+        let mut profiles = self.profiles.lock();
+        if let Some(profile) = profiles.get(module) {
+            return profile.clone();
+        }
+        let profile = Arc::new(ModuleProfile::new(
+            self.config.max_stacks,
+            self.config.max_depth,
+        ));
+        profiles.insert(module.to_string(), profile.clone());
+        profile
+    }
+
+    pub(crate) fn modules(&self) -> Vec<String> {
+        let mut names: Vec<_> = self.profiles.lock().keys().cloned().collect();
+        names.sort();
+        names
+    }
+
+    pub(crate) fn folded(&self, module: &str) -> Option<String> {
+        let profile = self.profiles.lock().get(module)?.clone();
+        Some(profile.folded())
+    }
+
+    pub(crate) fn reset(&self, module: &str) -> bool {
+        self.profiles.lock().remove(module).is_some()
+    }
+
+    /// Write every profile as `<module>.folded` in the given directory.
+    /// Namespace separators in module names are replaced so that each
+    /// profile is a single file.
+    pub(crate) fn save(&self, dir: &Path) -> io::Result<usize> {
+        fs::create_dir_all(dir)?;
+        let profiles: Vec<_> = self
+            .profiles
+            .lock()
+            .iter()
+            .map(|(name, profile)| (name.clone(), profile.clone()))
+            .collect();
+        for (name, profile) in &profiles {
+            let file_name = format!("{}.folded", name.replace('/', "__"));
+            fs::write(dir.join(file_name), profile.folded())?;
+        }
+        Ok(profiles.len())
+    }
+}
+
+#[derive(Debug)]
+pub(crate) struct ModuleProfile {
+    stacks: Mutex<HashMap<String, u64>>,
+    max_stacks: usize,
+    max_depth: usize,
+    dropped: AtomicU64,
+}
+
+impl ModuleProfile {
+    fn new(max_stacks: usize, max_depth: usize) -> Self {
+        Self {
+            stacks: Mutex::default(),
+            max_stacks,
+            max_depth,
+            dropped: AtomicU64::new(0),
+        }
+    }
+
+    /// Record the current guest stack. Must be called while the guest is
+    /// suspended in the epoch callback, so that the backtrace is meaningful.
+    pub(crate) fn sample(&self, backtrace: &WasmBacktrace) {
+        let frames = backtrace.frames();
+        if frames.is_empty() {
+            return;
+        }
+        // frames are innermost first, folded stacks are outermost first
+        let mut stack = String::new();
+        for frame in frames.iter().rev().take(self.max_depth) {
+            if !stack.is_empty() {
+                stack.push(';');
+            }
+            match frame.func_name() {
+                Some(name) => stack.push_str(name),
+                None => {
+                    let _ = write!(stack, "wasm-function[{}]", frame.func_index());
+                }
+            }
+        }
+
+        let mut stacks = self.stacks.lock();
+        if let Some(count) = stacks.get_mut(&stack) {
+            *count += 1;
+        } else if stacks.len() < self.max_stacks {
+            stacks.insert(stack, 1);
+        } else {
+            self.dropped.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    pub(crate) fn folded(&self) -> String {
+        let stacks = self.stacks.lock();
+        let mut lines: Vec<_> = stacks.iter().collect();
+        lines.sort();
+        let mut out = String::new();
+        for (stack, count) in lines {
+            let _ = writeln!(out, "{stack} {count}");
+        }
+        let dropped = self.dropped.load(Ordering::Relaxed);
+        if dropped > 0 {
+            let _ = writeln!(out, "{DROPPED_FRAME} {dropped}");
+        }
+        out
+    }
+}
@@ -0,0 +1,301 @@
+//! Regular expressions for WASM modules, as the `wotto.regex` imports.
+//!
+//! Modules compile patterns through the host instead of bundling their own
+//! regex engine. Instances only live for one call, so modules compile the
+//! same few patterns over and over: compiled patterns are kept in a small LRU
+//! per module, and only the first call pays for compilation. Patterns come
+//! from untrusted code, so their length, their nesting and the size of the
+//! compiled program are limited.
+
+use std::collections::HashMap;
+use std::sync::Arc;
+
+use parking_lot::{Mutex, RwLock};
+use regex::bytes::{CaptureLocations, Regex, RegexBuilder};
+use tracing::debug;
+use wasmtime::*;
+
+use crate::runtime::guest_range;
+use crate::service::{get_memory, HasRegexes, WResult};
+
+const MODULE: &str = "wotto.regex";
+
+/// Longest pattern accepted, in bytes.
+const MAX_PATTERN_LEN: usize = 4 << 10;
+/// Limit on the size of a compiled pattern.
+const SIZE_LIMIT: usize = 1 << 20;
+/// Limit on the lazy DFA cache of a compiled pattern.
+const DFA_SIZE_LIMIT: usize = 1 << 20;
+/// Limit on the nesting of groups and repetitions.
+const NEST_LIMIT: u32 = 50;
+/// Compiled patterns kept for each module.
+const PATTERNS_PER_MODULE: usize = 32;
+/// Patterns one instance can have open at the same time.
+const MAX_HANDLES: usize = 64;
+
+fn compile(pattern: &str) -> Option<Regex> {
+    if pattern.len() > MAX_PATTERN_LEN {
+        debug!(len = pattern.len(), "rejected pattern: too long");
+        return None;
+    }
+    RegexBuilder::new(pattern)
+        .size_limit(SIZE_LIMIT)
+        .dfa_size_limit(DFA_SIZE_LIMIT)
+        .nest_limit(NEST_LIMIT)
+        .build()
+        .map_err(|err| debug!(%err, "rejected pattern"))
+        .ok()
+}
+
+/// Compiled patterns of one module, least recently used first. Patterns that
+/// failed to compile are kept too (as `None`), so that retrying them is
+/// cheap.
+#[derive(Default)]
+pub(crate) struct PatternCache {
+    patterns: Mutex<Vec<(Box<str>, Option<Arc<Regex>>)>>,
+}
+
+impl PatternCache {
+    fn lookup(&self, pattern: &str) -> Option<Option<Arc<Regex>>> {
+        let mut patterns = self.patterns.lock();
+        let index = patterns.iter().position(|(p, _)| **p == *pattern)?;
+        let entry = patterns.remove(index);
+        let regex = entry.1.clone();
+        patterns.push(entry);
+        Some(regex)
+    }
+
+    pub(crate) fn get_or_compile(&self, pattern: &str) -> Option<Arc<Regex>> {
+        if let Some(regex) = self.lookup(pattern) {
+            return regex;
+        }
+        // compiling can take a while, don't hold the lock
+        let regex = compile(pattern).map(Arc::new);
+        let mut patterns = self.patterns.lock();
+        if !patterns.iter().any(|(p, _)| **p == *pattern) {
+            if patterns.len() >= PATTERNS_PER_MODULE {
+                patterns.remove(0);
+            }
+            patterns.push((pattern.into(), regex.clone()));
+        }
+        regex
+    }
+}
+
+/// Pattern caches of all modules.
+#[derive(Default)]
+pub(crate) struct Regexes {
+    modules: RwLock<HashMap<Box<str>, Arc<PatternCache>>>,
+}
+
+impl Regexes {
+    pub(crate) fn scope(&self, module: &str) -> Arc<PatternCache> {
+        let cache = self.modules.read().get(module).cloned();
+        cache.unwrap_or_else(|| {
+            self.modules
+                .write()
+                .entry(module.into())
+                .or_default()
+                .clone()
+        })
+    }
+}
+
+/// Patterns compiled by one instance. Handles are indices into `open`, so
+/// that matching does not need to go through the cache.
+pub(crate) struct RegexHandles {
+    cache: Arc<PatternCache>,
+    open: Vec<(Arc<Regex>, CaptureLocations)>,
+}
+
+impl RegexHandles {
+    pub(crate) fn new(cache: Arc<PatternCache>) -> Self {
+        Self {
+            cache,
+            open: Vec::new(),
+        }
+    }
+
+    fn compile(&mut self, pattern: &str) -> Option<i32> {
+        let regex = self.cache.get_or_compile(pattern)?;
+        let handle = match self
+            .open
+            .iter()
+            .position(|(open, _)| Arc::ptr_eq(open, &regex))
+        {
+            Some(handle) => handle,
+            None if self.open.len() < MAX_HANDLES => {
+                let locations = regex.capture_locations();
+                self.open.push((regex, locations));
+                self.open.len() - 1
+            }
+            None => return None,
+        };
+        handle.try_into().ok()
+    }
+
+    fn get(&mut self, handle: i32) -> Option<(&Regex, &mut CaptureLocations)> {
+        let (regex, locations) = self.open.get_mut(usize::try_from(handle).ok()?)?;
+        Some((regex, locations))
+    }
+}
+
+/// Compile a regular expression, with the syntax of the Rust `regex` crate.
+///
+/// ```c
+/// int regex_compile(const char *pattern, int pattern_len);
+/// ```
+///
+/// Returns a handle for the other `regex_*` functions, or -1 if the pattern
+/// is not valid, or too long or complex.
+fn regex_compile<T: HasRegexes>(
+    mut caller: Caller<'_, T>,
+    pattern_ptr: u32,
+    pattern_len: u32,
+) -> WResult<i32> {
+    let (memory, runtime_data) = get_memory(&mut caller)?.data_and_store_mut(&mut caller);
+    let pattern = &memory[guest_range(memory, pattern_ptr, pattern_len)?];
+    let Ok(pattern) = std::str::from_utf8(pattern) else { return Ok(-1); };
+    Ok(runtime_data.regexes().compile(pattern).unwrap_or(-1))
+}
+
+/// Check whether a pattern matches anywhere in a buffer.
+///
+/// ```c
+/// int regex_is_match(int handle, const u8 *haystack, int haystack_len);
+/// ```
+///
+/// Returns 1 if it does, 0 if it does not, or -1 if the handle is not valid.
+fn regex_is_match<T: HasRegexes>(
+    mut caller: Caller<'_, T>,
+    handle: i32,
+    haystack_ptr: u32,
+    haystack_len: u32,
+) -> WResult<i32> {
+    let (memory, runtime_data) = get_memory(&mut caller)?.data_and_store_mut(&mut caller);
+    let Some((regex, _)) = runtime_data.regexes().get(handle) else { return Ok(-1); };
+    let haystack = &memory[guest_range(memory, haystack_ptr, haystack_len)?];
+    Ok(i32::from(regex.is_match(haystack)))
+}
+
+/// Find the first match of a pattern in a buffer, starting at offset `start`.
+///
+/// ```c
+/// int regex_find(int handle, const u8 *haystack, int haystack_len, int start,
+///                int *spans, int max_spans);
+/// ```
+///
+/// On a match, writes up to `max_spans` pairs of start and end offsets into
+/// `spans`: the whole match first, then each capture group (-1, -1 for
+/// groups that did not participate). Returns the number of pairs the pattern
+/// has, which can be more than `max_spans`, or -1 if there is no match (or
+/// the handle or `start` are not valid). To find all matches, call it again
+/// starting at the end of the previous match (or one byte later, if it was
+/// empty).
+fn regex_find<T: HasRegexes>(
+    mut caller: Caller<'_, T>,
+    handle: i32,
+    haystack_ptr: u32,
+    haystack_len: u32,
+    start: u32,
+    spans_ptr: u32,
+    max_spans: u32,
+) -> WResult<i32> {
+    let (memory, runtime_data) = get_memory(&mut caller)?.data_and_store_mut(&mut caller);
+    let Some((regex, locations)) = runtime_data.regexes().get(handle) else { return Ok(-1); };
+    let haystack = &memory[guest_range(memory, haystack_ptr, haystack_len)?];
+    let start = start as usize;
+    if start > haystack.len() || regex.captures_read_at(locations, haystack, start).is_none() {
+        return Ok(-1);
+    }
+    let spans_range = guest_range(memory, spans_ptr, max_spans.saturating_mul(8))?;
+    let spans = &mut memory[spans_range];
+    for (group, span) in spans.chunks_exact_mut(8).enumerate().take(locations.len()) {
+        let (start, end) = locations
+            .get(group)
+            .map_or((-1, -1), |(start, end)| (start as i32, end as i32));
+        span[..4].copy_from_slice(&start.to_le_bytes());
+        span[4..].copy_from_slice(&end.to_le_bytes());
+    }
+    Ok(locations.len() as i32)
+}
+
+pub(crate) fn add_to_linker<T: HasRegexes + 'static>(linker: &mut Linker<T>) -> WResult<()> {
+    linker.func_wrap(MODULE, "compile", regex_compile)?;
+    linker.func_wrap(MODULE, "is_match", regex_is_match)?;
+    linker.func_wrap(MODULE, "find", regex_find)?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn compiled_once() {
+        let cache = PatternCache::default();
+        let a = cache.get_or_compile(r"\d+").unwrap();
+        let b = cache.get_or_compile(r"\d+").unwrap();
+        assert!(Arc::ptr_eq(&a, &b));
+        assert!(a.is_match(b"abc 123"));
+    }
+
+    #[test]
+    fn least_recently_used_evicted() {
+        let cache = PatternCache::default();
+        let first = cache.get_or_compile("p0").unwrap();
+        let second = cache.get_or_compile("p1").unwrap();
+        for i in 2..PATTERNS_PER_MODULE {
+            cache.get_or_compile(&format!("p{i}")).unwrap();
+        }
+        // p0 is now the most recently used, so p1 goes first
+        cache.get_or_compile("p0").unwrap();
+        cache.get_or_compile("one more").unwrap();
+        assert!(Arc::ptr_eq(&first, &cache.get_or_compile("p0").unwrap()));
+        assert!(!Arc::ptr_eq(&second, &cache.get_or_compile("p1").unwrap()));
+    }
+
+    #[test]
+    fn invalid_patterns() {
+        let cache = PatternCache::default();
+        assert!(cache.get_or_compile("(unclosed").is_none());
+        assert!(cache.get_or_compile("(unclosed").is_none());
+        assert!(cache
+            .get_or_compile(&"a".repeat(MAX_PATTERN_LEN + 1))
+            .is_none());
+        let nested = format!("{}a{}", "(".repeat(100), ")".repeat(100));
+        assert!(cache.get_or_compile(&nested).is_none());
+        assert!(cache.get_or_compile(r"\w{1000}{1000}").is_none());
+    }
+
+    #[test]
+    fn scopes_are_separate() {
+        let regexes = Regexes::default();
+        let a = regexes.scope("a").get_or_compile("x").unwrap();
+        let b = regexes.scope("b").get_or_compile("x").unwrap();
+        let again = regexes.scope("a").get_or_compile("x").unwrap();
+        assert!(!Arc::ptr_eq(&a, &b));
+        assert!(Arc::ptr_eq(&a, &again));
+    }
+
+    #[test]
+    fn handles() {
+        let mut handles = RegexHandles::new(Arc::default());
+        let digits = handles.compile(r"(\d+)(x)?").unwrap();
+        assert_eq!(handles.compile(r"(\d+)(x)?"), Some(digits));
+        assert_ne!(handles.compile("other"), Some(digits));
+        assert_eq!(handles.compile("(bad"), None);
+        assert!(handles.get(-1).is_none());
+        assert!(handles.get(2).is_none());
+
+        let (regex, locations) = handles.get(digits).unwrap();
+        assert!(regex.captures_read_at(locations, b"ab 42 c", 0).is_some());
+        assert_eq!(locations.get(0), Some((3, 5)));
+        assert_eq!(locations.get(2), None);
+
+        for i in handles.open.len()..MAX_HANDLES {
+            handles.compile(&format!("p{i}")).unwrap();
+        }
+        assert_eq!(handles.compile("too many"), None);
+    }
+}
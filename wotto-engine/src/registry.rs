@@ -1,6 +1,16 @@
+//! Entries that can be locked for a long time (while a module is fetched
+//! and compiled, for instance) without blocking access to the others.
+//!
+//! The map is split in shards, each behind its own short-lived mutex, so that
+//! looking up unrelated entries does not serialize. Entries that hold no
+//! value and are not locked by anybody are dead: they are removed when taken,
+//! and swept from a shard whenever it has doubled in size since the last
+//! sweep, so that lookups for names that never existed don't accumulate.
+
 use std::borrow::Borrow;
+use std::collections::hash_map::RandomState;
 use std::collections::HashMap;
-use std::hash::Hash;
+use std::hash::{BuildHasher, Hash};
 use std::sync::Arc;
 
 use parking_lot::Mutex;
@@ -10,18 +20,66 @@ pub(crate) type RegistryEntry<V> = Arc<RwLock<Option<V>>>;
 pub(crate) type ValueRef<V> = OwnedRwLockReadGuard<Option<V>>;
 pub(crate) type ValueRefMut<V> = OwnedRwLockWriteGuard<Option<V>>;
 
+const SHARDS: usize = 16;
+/// Shards are not swept until they have at least this many entries.
+const MIN_SWEEP: usize = 32;
+
+struct Shard<K, V> {
+    entries: HashMap<K, RegistryEntry<V>>,
+    /// Sweep when the shard grows past this size.
+    sweep_at: usize,
+}
+
+impl<K, V> Default for Shard<K, V> {
+    fn default() -> Self {
+        Self {
+            entries: HashMap::new(),
+            sweep_at: MIN_SWEEP,
+        }
+    }
+}
+
+impl<K, V> Shard<K, V> {
+    fn sweep(&mut self) -> usize {
+        let before = self.entries.len();
+        self.entries.retain(|_, entry| !is_dead(entry));
+        self.sweep_at = MIN_SWEEP.max(2 * self.entries.len());
+        before - self.entries.len()
+    }
+}
+
+/// Whether an entry holds no value and nobody else can reach it. New
+/// references to an entry are only made with its shard locked, so this
+/// stays true as long as the shard is locked.
+fn is_dead<V>(entry: &RegistryEntry<V>) -> bool {
+    Arc::strong_count(entry) == 1 && entry.try_read().map_or(false, |value| value.is_none())
+}
+
 pub(crate) struct Registry<K, V> {
-    entries: Mutex<HashMap<K, RegistryEntry<V>>>,
+    shards: Box<[Mutex<Shard<K, V>>]>,
+    hasher: RandomState,
 }
 
 impl<K, V> Registry<K, V>
 where
     K: Hash + Eq,
 {
+    fn shard<Q>(&self, key: &Q) -> &Mutex<Shard<K, V>>
+    where
+        Q: Hash + ?Sized,
+    {
+        &self.shards[self.hasher.hash_one(key) as usize % SHARDS]
+    }
+
     async fn entry_or_default(&self, key: K) -> ValueRefMut<V> {
         let entry = {
-            let mut map = self.entries.lock();
-            map.entry(key)
+            let mut shard = self.shard(&key).lock();
+            if shard.entries.len() >= shard.sweep_at {
+                shard.sweep();
+            }
+            shard
+                .entries
+                .entry(key)
                 .or_insert_with(RegistryEntry::default)
                 .clone()
         };
@@ -33,10 +91,7 @@ where
         K: Borrow<Q>,
         Q: Hash + Eq + ?Sized,
     {
-        let entry = {
-            let map = self.entries.lock();
-            map.get(key)?.clone()
-        };
+        let entry = self.shard(key).lock().entries.get(key)?.clone();
         Some(entry.read_owned().await)
     }
 
@@ -45,10 +100,7 @@ where
         K: Borrow<Q>,
         Q: Hash + Eq + ?Sized,
     {
-        let entry = {
-            let map = self.entries.lock();
-            map.get(key)?.clone()
-        };
+        let entry = self.shard(key).lock().entries.get(key)?.clone();
         Some(entry.write_owned().await)
     }
 
@@ -56,6 +108,15 @@ where
         self.entry_or_default(key).await
     }
 
+    /// Like `lock_entry_mut`, but only if the entry exists already.
+    pub(crate) async fn lock_existing_entry_mut<Q>(&self, key: &Q) -> Option<ValueRefMut<V>>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq + ?Sized,
+    {
+        self.entry_mut(key).await
+    }
+
     /// Wait until no writers are touching the entry, if it exists; otherwise
     /// return immediately.
     pub(crate) async fn wait_entry<Q>(&self, key: &Q)
@@ -71,14 +132,48 @@ where
         K: Borrow<Q>,
         Q: Hash + Eq + ?Sized,
     {
-        self.entry_mut(key).await?.take()
+        let value = self.entry_mut(key).await?.take();
+        let mut shard = self.shard(key).lock();
+        if shard.entries.get(key).map_or(false, is_dead) {
+            shard.entries.remove(key);
+        }
+        value
+    }
+
+    /// Call `f` on the values that nobody has locked right now. Locked
+    /// entries are skipped rather than waited for.
+    pub(crate) fn for_each_unlocked(&self, mut f: impl FnMut(&mut V)) {
+        for shard in self.shards.iter() {
+            for entry in shard.lock().entries.values() {
+                if let Ok(mut value) = entry.try_write() {
+                    if let Some(value) = &mut *value {
+                        f(value);
+                    }
+                }
+            }
+        }
+    }
+
+    /// Remove all the dead entries. Returns how many were removed.
+    #[cfg(test)]
+    fn collect_garbage(&self) -> usize {
+        self.shards.iter().map(|shard| shard.lock().sweep()).sum()
+    }
+
+    #[cfg(test)]
+    fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.lock().entries.len())
+            .sum()
     }
 }
 
 impl<K, V> Default for Registry<K, V> {
     fn default() -> Self {
         Self {
-            entries: Default::default(),
+            shards: (0..SHARDS).map(|_| Mutex::default()).collect(),
+            hasher: RandomState::new(),
         }
     }
 }
@@ -130,6 +225,18 @@ mod tests {
         let entry = block_on(async { m.lock_entry_mut("hello".to_owned()).await });
         assert!(entry.is_none());
     }
+
+    #[test]
+    fn test_lock_existing() {
+        let m = R::default();
+        assert!(block_on(async { m.lock_existing_entry_mut("hello").await }).is_none());
+        // looking does not create the entry
+        assert_eq!(m.len(), 0);
+        *block_on(async { m.lock_entry_mut("hello".to_owned()).await }) = Some(100);
+        let entry = block_on(async { m.lock_existing_entry_mut("hello").await });
+        assert_eq!(*entry.unwrap(), Some(100));
+    }
+
     #[test]
     fn test_grow() {
         // Inserting many entries. This tests a case that used to trigger bad
@@ -174,6 +281,70 @@ mod tests {
         });
     }
 
+    #[test]
+    fn test_take_removes_entry() {
+        let m = R::default();
+        block_on(async {
+            *m.lock_entry_mut("hello".to_owned()).await = Some(100);
+            assert_eq!(m.len(), 1);
+            assert_eq!(m.take_entry("hello").await, Some(100));
+            assert_eq!(m.len(), 0);
+            assert_eq!(m.take_entry("hello").await, None);
+        });
+    }
+
+    #[test]
+    fn test_for_each_unlocked() {
+        let m = R::default();
+        block_on(async {
+            *m.lock_entry_mut("one".to_owned()).await = Some(1);
+            *m.lock_entry_mut("two".to_owned()).await = Some(2);
+            let _locked = m.lock_entry_mut("two".to_owned()).await;
+            drop(m.lock_entry_mut("none".to_owned()).await);
+            let mut seen = vec![];
+            m.for_each_unlocked(|value| {
+                seen.push(*value);
+                *value += 10;
+            });
+            assert_eq!(seen, [1]);
+            assert!(matches!(
+                *m.lock_entry_mut("one".to_owned()).await,
+                Some(11)
+            ));
+        });
+    }
+
+    #[test]
+    fn test_collect_garbage() {
+        let m = R::default();
+        block_on(async {
+            // a failed load leaves an empty entry behind
+            drop(m.lock_entry_mut("typo".to_owned()).await);
+            *m.lock_entry_mut("full".to_owned()).await = Some(1);
+            let locked = m.lock_entry_mut("locked".to_owned()).await;
+            assert_eq!(m.len(), 3);
+            assert_eq!(m.collect_garbage(), 1);
+            assert_eq!(m.len(), 2);
+            drop(locked);
+            assert_eq!(m.collect_garbage(), 1);
+            assert!(matches!(
+                *m.lock_entry_mut("full".to_owned()).await,
+                Some(1)
+            ));
+        });
+    }
+
+    #[test]
+    fn test_dead_entries_are_bounded() {
+        let m = R::default();
+        block_on(async {
+            for i in 0..SHARDS * MIN_SWEEP * 4 {
+                drop(m.lock_entry_mut(format!("typo{i}")).await);
+            }
+        });
+        assert!(m.len() <= SHARDS * MIN_SWEEP);
+    }
+
     #[allow(dead_code)]
     async fn assert_entry_lifetimes() {
         async fn returning_an_entry(m: &R) -> ValueRefMut<i32> {
@@ -1,11 +1,14 @@
 // Command parser
 
 use std::sync::Arc;
+use std::time::{Duration, Instant};
 
-use anyhow::Result;
+use anyhow::{bail, Result};
+use parking_lot::Mutex;
 use rustyline::error::ReadlineError;
 use rustyline::DefaultEditor;
-use tokio::sync::mpsc;
+use tokio::io::{AsyncBufRead, AsyncBufReadExt};
+use tokio::sync::{mpsc, Semaphore};
 
 use crate::service::{Command, Result as EngineResult, Service};
 
@@ -93,10 +96,125 @@ fn command_parser(tx: ReqTx, mut resp: RespRx) -> Result<(ReqTx, RespRx)> {
     Ok((tx, resp))
 }
 
+/// Run commands from a script, without interaction.
+///
+/// The script has one command per line, with the same syntax as the
+/// interactive shell, plus:
+///
+/// - `sync` waits until all the commands before it are done
+/// - `repeat N <command>` submits the command N times
+///
+/// Empty lines and lines starting with `#` are ignored.
+///
+/// Up to `jobs` commands run at the same time. Responses are printed as they
+/// complete, tagged with the line number of the command (and the repetition
+/// for `repeat`) and with the time the command took. A summary follows at the
+/// end. Note that a `load` does not wait for earlier commands: put a `sync`
+/// after loading modules that later lines depend on.
+pub async fn batch<R: AsyncBufRead + Unpin>(script: R, jobs: u32) -> Result<()> {
+    let svc = Arc::new(Service::new());
+    let weak = Arc::downgrade(&svc);
+    let _epoch_timer = Service::epoch_timer(move || weak.upgrade());
+
+    let jobs = jobs.max(1);
+    let slots = Arc::new(Semaphore::new(jobs as usize));
+    let summary = Arc::new(Mutex::new(Summary::default()));
+    let start = Instant::now();
+
+    let mut lines = script.lines();
+    let mut lineno = 0;
+    while let Some(line) = lines.next_line().await? {
+        lineno += 1;
+        let line = line.trim();
+        if line.is_empty() || line.starts_with('#') {
+            continue;
+        }
+        if line == "sync" {
+            // all slots are free once all the pending commands are done
+            drop(slots.acquire_many(jobs).await?);
+            continue;
+        }
+        let (count, line) = match line.strip_prefix("repeat ") {
+            Some(rest) => match rest.trim_start().split_once(char::is_whitespace) {
+                Some((count, line)) => (count.parse::<u64>().ok(), line),
+                None => (None, rest),
+            },
+            None => (Some(1), line),
+        };
+        let (Some(count), Some(cmd)) = (count, parse_command(line.to_string())) else {
+            bail!("line {lineno}: cannot parse command: {line}");
+        };
+        for i in 0..count {
+            let tag = if count > 1 {
+                format!("{lineno}.{i}")
+            } else {
+                lineno.to_string()
+            };
+            let permit = slots.clone().acquire_owned().await?;
+            let svc = svc.clone();
+            let cmd = cmd.clone();
+            let summary = summary.clone();
+            tokio::spawn(async move {
+                let cmd_start = Instant::now();
+                let result = svc.execute(cmd).await;
+                let elapsed = cmd_start.elapsed();
+                match &result {
+                    Some(Ok(response)) => println!("[{tag}] ++ {elapsed:.2?} {response}"),
+                    Some(Err(error)) => println!("[{tag}] !! {elapsed:.2?} {error}"),
+                    None => {}
+                }
+                summary
+                    .lock()
+                    .record(elapsed, matches!(result, Some(Err(_))));
+                drop(permit);
+            });
+        }
+    }
+    drop(slots.acquire_many(jobs).await?);
+
+    summary.lock().print(start.elapsed());
+    Ok(())
+}
+
+#[derive(Default)]
+struct Summary {
+    latencies: Vec<Duration>,
+    errors: usize,
+}
+
+impl Summary {
+    fn record(&mut self, elapsed: Duration, is_error: bool) {
+        self.latencies.push(elapsed);
+        self.errors += usize::from(is_error);
+    }
+
+    fn print(&mut self, wall_time: Duration) {
+        let count = self.latencies.len();
+        println!(
+            "-- {count} commands ({} failed) in {wall_time:.2?}, {:.1} commands/s",
+            self.errors,
+            count as f64 / wall_time.as_secs_f64()
+        );
+        if count == 0 {
+            return;
+        }
+        self.latencies.sort();
+        let percentile = |p: usize| self.latencies[(count * p).div_ceil(100).max(1) - 1];
+        println!(
+            "-- latency: min {:.2?}  p50 {:.2?}  p99 {:.2?}  max {:.2?}",
+            self.latencies[0],
+            percentile(50),
+            percentile(99),
+            self.latencies[count - 1]
+        );
+    }
+}
+
 fn parse_command(cmd: String) -> Option<Command> {
     let args: Vec<_> = cmd.split_whitespace().collect();
     match &args[..] {
         ["load", module] => Some(Command::LoadModule(module.to_string())),
+        ["library", library] => Some(Command::LoadLibrary(library.to_string())),
         ["run", module, entry_point, ..] => Some(Command::RunModule {
             module: module.to_string(),
             entry_point: entry_point.to_string(),
@@ -0,0 +1,253 @@
+//! Replaying recent calls against a new version of a module before it
+//! replaces the old one.
+//!
+//! A sample of recent successful calls (entry point and arguments) is kept
+//! for every module. When a module is reloaded, the samples are run against
+//! both versions, and the new one is compared with the old one: how long the
+//! guest ran, how much memory it used, and whether the output or the outcome
+//! changed. Depending on the policy, a version that is significantly worse is
+//! loaded with a warning or refused.
+
+use std::collections::{HashMap, VecDeque};
+use std::time::Duration;
+
+use parking_lot::Mutex;
+
+/// Calls kept for each module.
+const SAMPLES_PER_MODULE: usize = 8;
+/// Calls with longer arguments are not kept.
+const MAX_ARGS_LEN: usize = 4 << 10;
+/// Differences in memory below a WebAssembly page are noise.
+const MIN_MEMORY: usize = 64 << 10;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum ReloadPolicy {
+    /// Reload without replaying anything.
+    Off,
+    /// Replay, and log a warning if the new version regressed.
+    #[default]
+    Flag,
+    /// Replay, and keep the old version if the new one regressed.
+    Refuse,
+}
+
+#[derive(Debug, Clone)]
+pub struct ReloadGate {
+    pub policy: ReloadPolicy,
+    /// How many times slower the new version can be.
+    pub max_slowdown: f64,
+    /// How many times more memory the new version can use.
+    pub max_memory_growth: f64,
+    /// Differences in running time below this are noise.
+    pub min_time: Duration,
+}
+
+impl Default for ReloadGate {
+    fn default() -> Self {
+        Self {
+            policy: ReloadPolicy::default(),
+            max_slowdown: 2.0,
+            max_memory_growth: 2.0,
+            min_time: Duration::from_millis(1),
+        }
+    }
+}
+
+impl ReloadGate {
+    /// Why the new version is worse than the old one, if it is.
+    pub(crate) fn judge(&self, report: &ReplayReport) -> Option<String> {
+        if report.new_failures > 0 {
+            return Some(format!(
+                "{} of {} calls fail",
+                report.new_failures, report.samples
+            ));
+        }
+        // a baseline below the noise counts as the noise, so that calls too
+        // fast to time or guests without memory do not divide by zero
+        let old_time = report.old_time.max(self.min_time);
+        let slowdown = report.new_time.as_secs_f64() / old_time.as_secs_f64();
+        if report.new_time > self.min_time && slowdown > self.max_slowdown {
+            return Some(format!(
+                "{slowdown:.1}x slower ({:?} instead of {:?})",
+                report.new_time, report.old_time
+            ));
+        }
+        let growth = report.new_memory as f64 / report.old_memory.max(MIN_MEMORY) as f64;
+        if report.new_memory > report.old_memory && growth > self.max_memory_growth {
+            return Some(format!(
+                "{growth:.1}x more memory ({} instead of {} bytes)",
+                report.new_memory, report.old_memory
+            ));
+        }
+        None
+    }
+}
+
+/// Comparison of two versions of a module on the same calls.
+#[derive(Debug, Clone, Default)]
+pub struct ReplayReport {
+    pub module: String,
+    /// Calls replayed. Calls that fail on the old version too are not
+    /// counted.
+    pub samples: usize,
+    /// Time spent running the guest, over all the calls (the fastest of a
+    /// few runs for each call).
+    pub old_time: Duration,
+    pub new_time: Duration,
+    /// Largest linear memory over all the calls, in bytes.
+    pub old_memory: usize,
+    pub new_memory: usize,
+    /// Calls that gave a different output.
+    pub changed_outputs: usize,
+    /// Calls that succeed with the old version and fail with the new one.
+    pub new_failures: usize,
+    /// Why the new version was considered a regression, if it was.
+    pub regression: Option<String>,
+    /// Whether the new version was loaded.
+    pub loaded: bool,
+}
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub(crate) struct Sample {
+    pub(crate) entry_point: String,
+    pub(crate) args: String,
+}
+
+/// Recent calls of every module, most recent last.
+#[derive(Default)]
+pub(crate) struct Samples {
+    modules: Mutex<HashMap<String, VecDeque<Sample>>>,
+}
+
+impl Samples {
+    pub(crate) fn record(&self, module: &str, entry_point: &str, args: &str) {
+        if args.len() > MAX_ARGS_LEN {
+            return;
+        }
+        let mut modules = self.modules.lock();
+        if !modules.contains_key(module) {
+            modules.insert(
+                module.to_string(),
+                VecDeque::with_capacity(SAMPLES_PER_MODULE),
+            );
+        }
+        let samples = modules.get_mut(module).unwrap();
+        // the same call twice tells nothing new
+        if let Some(index) = samples
+            .iter()
+            .position(|s| s.entry_point == entry_point && s.args == args)
+        {
+            let sample = samples.remove(index).unwrap();
+            samples.push_back(sample);
+            return;
+        }
+        let sample = if samples.len() >= SAMPLES_PER_MODULE {
+            // reuse the buffers of the oldest sample
+            let mut sample = samples.pop_front().unwrap();
+            sample.entry_point.clear();
+            sample.entry_point.push_str(entry_point);
+            sample.args.clear();
+            sample.args.push_str(args);
+            sample
+        } else {
+            Sample {
+                entry_point: entry_point.to_string(),
+                args: args.to_string(),
+            }
+        };
+        samples.push_back(sample);
+    }
+
+    pub(crate) fn get(&self, module: &str) -> Vec<Sample> {
+        let modules = self.modules.lock();
+        modules
+            .get(module)
+            .map(|samples| samples.iter().cloned().collect())
+            .unwrap_or_default()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::buffers::counting::allocations;
+
+    #[test]
+    fn samples() {
+        let samples = Samples::default();
+        for i in 0..SAMPLES_PER_MODULE {
+            samples.record("m", "f", &i.to_string());
+        }
+        // repeated calls move to the end instead of taking a new slot
+        samples.record("m", "f", "0");
+        samples.record("m", "g", "");
+        samples.record("m", "f", &"x".repeat(MAX_ARGS_LEN + 1));
+        let args: Vec<_> = samples.get("m").into_iter().map(|s| s.args).collect();
+        assert_eq!(args.len(), SAMPLES_PER_MODULE);
+        assert_eq!(args[0], "2");
+        assert_eq!(args[SAMPLES_PER_MODULE - 2], "0");
+        assert!(samples.get("other").is_empty());
+        assert_eq!(allocations(|| samples.record("m", "g", "")), 0);
+    }
+
+    #[test]
+    fn judge() {
+        let gate = ReloadGate::default();
+        let report = ReplayReport {
+            samples: 2,
+            old_time: Duration::from_millis(10),
+            new_time: Duration::from_millis(15),
+            old_memory: 1 << 16,
+            new_memory: 1 << 16,
+            ..Default::default()
+        };
+        assert_eq!(gate.judge(&report), None);
+
+        let slower = ReplayReport {
+            new_time: Duration::from_millis(50),
+            ..report.clone()
+        };
+        assert!(gate.judge(&slower).unwrap().contains("slower"));
+
+        // too fast to tell
+        let noise = ReplayReport {
+            old_time: Duration::from_micros(10),
+            new_time: Duration::from_micros(100),
+            ..report.clone()
+        };
+        assert_eq!(gate.judge(&noise), None);
+
+        let bigger = ReplayReport {
+            new_memory: 1 << 20,
+            ..report.clone()
+        };
+        assert!(gate.judge(&bigger).unwrap().contains("memory"));
+
+        // nothing to compare with
+        let zero = ReplayReport {
+            old_time: Duration::ZERO,
+            new_time: Duration::from_micros(500),
+            old_memory: 0,
+            new_memory: 1 << 16,
+            ..report.clone()
+        };
+        assert_eq!(gate.judge(&zero), None);
+        let from_zero = ReplayReport {
+            new_time: Duration::from_millis(5),
+            new_memory: 1 << 20,
+            ..zero
+        };
+        assert!(gate.judge(&from_zero).unwrap().contains("slower"));
+        let from_zero = ReplayReport {
+            new_time: Duration::ZERO,
+            ..from_zero
+        };
+        assert!(gate.judge(&from_zero).unwrap().contains("memory"));
+
+        let failing = ReplayReport {
+            new_failures: 1,
+            ..report
+        };
+        assert!(gate.judge(&failing).unwrap().contains("fail"));
+    }
+}
@@ -1,9 +1,68 @@
 //! Functions exported to WASM modules.
 
 use crate::assemblyscript::{env_abort, AssemblyScriptString};
-use crate::service::{get_memory, Error, HasInput, HasOutput, WResult};
+use crate::service::{
+    get_memory, Error, HasBlobs, HasCache, HasExecutionSlot, HasHostCalls, HasInput, HasOutput,
+    HasRegexes, HasThreads, WResult,
+};
+use std::future::Future;
+use std::ops::Range;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use tokio::sync::{OwnedSemaphorePermit, Semaphore};
+use tracing::trace;
 use wasmtime::*;
 
+/// The right of a guest to run while the number of running guests is
+/// limited. The slot is held from instantiation to the end of the call,
+/// except while the guest waits in an async host import.
+pub(crate) struct ExecutionSlot {
+    slots: Option<Arc<Semaphore>>,
+    permit: Option<OwnedSemaphorePermit>,
+    /// Time spent in async host imports, including the time it took to get
+    /// the slot back.
+    pub(crate) suspended: Duration,
+}
+
+impl ExecutionSlot {
+    pub(crate) fn new(slots: Option<Arc<Semaphore>>) -> Self {
+        Self {
+            slots,
+            permit: None,
+            suspended: Duration::ZERO,
+        }
+    }
+
+    pub(crate) async fn acquire(&mut self) {
+        let Some(slots) = &self.slots else { return; };
+        if self.permit.is_none() {
+            let permit = slots.clone().acquire_owned().await;
+            self.permit = Some(permit.expect("execution slots are never closed"));
+        }
+    }
+
+    fn release(&mut self) {
+        self.permit = None;
+    }
+}
+
+/// Wait for `fut` on behalf of the guest, giving its execution slot to
+/// somebody else in the meantime. Async host imports should use this for
+/// anything that can wait, so that I/O-bound guests don't keep CPU-bound
+/// ones from running.
+pub(crate) async fn suspend<T: HasExecutionSlot, F: Future>(
+    caller: &mut Caller<'_, T>,
+    fut: F,
+) -> F::Output {
+    let start = Instant::now();
+    caller.data_mut().execution_slot().release();
+    let output = fut.await;
+    let slot = caller.data_mut().execution_slot();
+    slot.acquire().await;
+    slot.suspended += start.elapsed();
+    output
+}
+
 /// AssemblyScript-style print
 ///
 /// ```ts
@@ -16,18 +75,59 @@ fn print<T>(mut caller: Caller<'_, T>, ptr: u32) -> WResult<()> {
     Ok(())
 }
 
-fn output<T: HasOutput>(mut caller: Caller<'_, T>, ptr: u32, len: u32) -> WResult<()> {
+fn output<T: HasOutput + HasHostCalls>(
+    mut caller: Caller<'_, T>,
+    ptr: u32,
+    len: u32,
+) -> WResult<()> {
+    let start = Instant::now();
     let (memory, runtime_data) = get_memory(&mut caller)?.data_and_store_mut(&mut caller);
     let offset = ptr as usize;
     let size = len as usize;
     let strdata = &memory[offset..][..size];
     let txt = std::str::from_utf8(strdata)?;
-    println!("wotto.output {txt}");
+    trace!(txt, "wotto.output");
     runtime_data.output(txt);
+    runtime_data.host_calls().record(start, 0, size);
+    if runtime_data.stop_when_full() && runtime_data.output_remaining() == 0 {
+        return Err(OutputFull.into());
+    }
     Ok(())
 }
 
-fn input<T: HasInput>(mut caller: Caller<'_, T>, ptr: u32, len: u32) -> WResult<u32> {
+/// Return how many more bytes `output` accepts before the output is
+/// truncated (0 if it has been truncated already).
+///
+/// ```c
+/// int output_capacity(void);
+/// ```
+fn output_capacity<T: HasOutput>(caller: Caller<'_, T>) -> i32 {
+    caller
+        .data()
+        .output_remaining()
+        .try_into()
+        .unwrap_or(i32::MAX)
+}
+
+/// The output of a stoppable module is full. Returned by `output` to stop
+/// the guest; the call still succeeds.
+#[derive(Debug)]
+pub(crate) struct OutputFull;
+
+impl std::fmt::Display for OutputFull {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str("output is full")
+    }
+}
+
+impl std::error::Error for OutputFull {}
+
+fn input<T: HasInput + HasHostCalls>(
+    mut caller: Caller<'_, T>,
+    ptr: u32,
+    len: u32,
+) -> WResult<u32> {
+    let start = Instant::now();
     let (memory, runtime_data) = get_memory(&mut caller)?.data_and_store_mut(&mut caller);
 
     let offset = ptr as usize;
@@ -36,24 +136,199 @@ fn input<T: HasInput>(mut caller: Caller<'_, T>, ptr: u32, len: u32) -> WResult<
 
     let message = runtime_data.input().as_bytes();
     let actual_size = message.len();
-    if size >= actual_size {
+    let copied = if size >= actual_size {
         buf[..actual_size].copy_from_slice(message);
+        actual_size
     } else {
         buf.copy_from_slice(&message[..size]);
-    }
+        size
+    };
+    runtime_data.host_calls().record(start, copied, 0);
 
     Ok(actual_size.try_into().unwrap())
 }
 
+/// Bounds-checked range of guest memory.
+pub(crate) fn guest_range(memory: &[u8], ptr: u32, len: u32) -> WResult<Range<usize>> {
+    let start = ptr as usize;
+    let end = start
+        .checked_add(len as usize)
+        .ok_or(Error::InvalidPointer)?;
+    if end > memory.len() {
+        return Err(Error::InvalidPointer.into());
+    }
+    Ok(start..end)
+}
+
+/// Look up a key in the module's cache and copy the value into the buffer,
+/// up to `buf_len` bytes.
+///
+/// ```c
+/// int cache_get(const u8 *key, int key_len, u8 *buf, int buf_len);
+/// ```
+///
+/// Returns the length of the value (which can be larger than `buf_len`), or
+/// -1 if the key is not in the cache.
+fn cache_get<T: HasCache>(
+    mut caller: Caller<'_, T>,
+    key_ptr: u32,
+    key_len: u32,
+    buf_ptr: u32,
+    buf_len: u32,
+) -> WResult<i32> {
+    let (memory, runtime_data) = get_memory(&mut caller)?.data_and_store_mut(&mut caller);
+    let Some(cache) = runtime_data.cache() else { return Ok(-1); };
+    let key = cache.key(&memory[guest_range(memory, key_ptr, key_len)?]);
+    let buf_range = guest_range(memory, buf_ptr, buf_len)?;
+    let buf = &mut memory[buf_range];
+    let found = cache.get(&key, |value| {
+        let size = value.len().min(buf.len());
+        buf[..size].copy_from_slice(&value[..size]);
+        value.len()
+    });
+    Ok(found.map_or(-1, |len| len as i32))
+}
+
+/// Store a value in the module's cache.
+///
+/// ```c
+/// int cache_put(const u8 *key, int key_len, const u8 *value, int value_len);
+/// ```
+///
+/// Returns 0 on success, or -1 if the value was not stored (too large, or
+/// over the module's quota).
+fn cache_put<T: HasCache>(
+    mut caller: Caller<'_, T>,
+    key_ptr: u32,
+    key_len: u32,
+    value_ptr: u32,
+    value_len: u32,
+) -> WResult<i32> {
+    let (memory, runtime_data) = get_memory(&mut caller)?.data_and_store_mut(&mut caller);
+    let Some(cache) = runtime_data.cache() else { return Ok(-1); };
+    let key = &memory[guest_range(memory, key_ptr, key_len)?];
+    let value = &memory[guest_range(memory, value_ptr, value_len)?];
+    Ok(if cache.put(key, value) { 0 } else { -1 })
+}
+
+/// Remove a key from the module's cache.
+///
+/// ```c
+/// int cache_delete(const u8 *key, int key_len);
+/// ```
+///
+/// Returns 1 if the key was in the cache, 0 otherwise.
+fn cache_delete<T: HasCache>(
+    mut caller: Caller<'_, T>,
+    key_ptr: u32,
+    key_len: u32,
+) -> WResult<i32> {
+    let (memory, runtime_data) = get_memory(&mut caller)?.data_and_store_mut(&mut caller);
+    let Some(cache) = runtime_data.cache() else { return Ok(0); };
+    let key = &memory[guest_range(memory, key_ptr, key_len)?];
+    Ok(i32::from(cache.delete(key)))
+}
+
+/// Open a blob registered by the operator.
+///
+/// ```c
+/// int blob_open(const char *name, int name_len);
+/// ```
+///
+/// Returns a handle for the other `blob_*` functions, or -1 if there is no
+/// blob with that name.
+fn blob_open<T: HasBlobs>(mut caller: Caller<'_, T>, name_ptr: u32, name_len: u32) -> WResult<i32> {
+    let (memory, runtime_data) = get_memory(&mut caller)?.data_and_store_mut(&mut caller);
+    let name = std::str::from_utf8(&memory[guest_range(memory, name_ptr, name_len)?])?;
+    Ok(runtime_data.blobs().open(name).unwrap_or(-1))
+}
+
+/// Size of a blob in bytes, or -1 if the handle is not valid.
+///
+/// ```c
+/// int blob_len(int handle);
+/// ```
+fn blob_len<T: HasBlobs>(mut caller: Caller<'_, T>, handle: i32) -> i32 {
+    caller
+        .data_mut()
+        .blobs()
+        .get(handle)
+        .map_or(-1, |blob| blob.data().len() as i32)
+}
+
+/// Copy up to `buf_len` bytes of a blob, starting at `offset`, into `buf`.
+///
+/// ```c
+/// int blob_read(int handle, int offset, u8 *buf, int buf_len);
+/// ```
+///
+/// Returns the number of bytes copied, which is less than `buf_len` only at
+/// the end of the blob, or -1 if the handle or the offset are not valid.
+fn blob_read<T: HasBlobs>(
+    mut caller: Caller<'_, T>,
+    handle: i32,
+    offset: u32,
+    buf_ptr: u32,
+    buf_len: u32,
+) -> WResult<i32> {
+    let (memory, runtime_data) = get_memory(&mut caller)?.data_and_store_mut(&mut caller);
+    let Some(blob) = runtime_data.blobs().get(handle) else { return Ok(-1); };
+    let buf_range = guest_range(memory, buf_ptr, buf_len)?;
+    Ok(blob
+        .read(offset, &mut memory[buf_range])
+        .map_or(-1, |size| size as i32))
+}
+
+/// Longest time a guest can sleep in a single call to `sleep`.
+const MAX_SLEEP: Duration = Duration::from_secs(1);
+
+/// Suspend the guest for `ms` milliseconds, at most one second per call.
+///
+/// ```c
+/// void sleep(int ms);
+/// ```
+///
+/// The guest does not hold an execution slot while it sleeps, but the time
+/// still counts towards its time limit.
+fn sleep<T: HasExecutionSlot + Send>(
+    mut caller: Caller<'_, T>,
+    ms: u32,
+) -> Box<dyn Future<Output = ()> + Send + '_> {
+    Box::new(async move {
+        let duration = Duration::from_millis(ms.into()).min(MAX_SLEEP);
+        suspend(&mut caller, tokio::time::sleep(duration)).await;
+    })
+}
+
 pub(crate) fn add_to_linker<T>(
     linker: &mut Linker<T>,
     enable_assembly_script_support: bool,
 ) -> WResult<()>
 where
-    T: HasInput + HasOutput + 'static,
+    T: HasInput
+        + HasOutput
+        + HasHostCalls
+        + HasCache
+        + HasBlobs
+        + HasRegexes
+        + HasExecutionSlot
+        + HasThreads
+        + Send
+        + 'static,
 {
     linker.func_wrap("wotto", "output", output)?;
     linker.func_wrap("wotto", "input", input)?;
+    linker.func_wrap("wotto", "output_capacity", output_capacity)?;
+    linker.func_wrap("wotto", "cache_get", cache_get)?;
+    linker.func_wrap("wotto", "cache_put", cache_put)?;
+    linker.func_wrap("wotto", "cache_delete", cache_delete)?;
+    linker.func_wrap("wotto", "blob_open", blob_open)?;
+    linker.func_wrap("wotto", "blob_len", blob_len)?;
+    linker.func_wrap("wotto", "blob_read", blob_read)?;
+    linker.func_wrap1_async("wotto", "sleep", sleep)?;
+    crate::text::add_to_linker(linker)?;
+    crate::regexes::add_to_linker(linker)?;
+    crate::threads::add_to_linker(linker)?;
 
     if enable_assembly_script_support {
         linker.func_wrap("wotto", "print", print)?;
@@ -1,18 +1,35 @@
 use std::borrow::Borrow;
-use std::collections::HashMap;
+use std::collections::{BTreeMap, HashMap, HashSet};
 use std::fmt::Display;
 use std::future::Future;
 use std::hash::Hash;
+use std::ops::Deref;
 use std::path::{Path, PathBuf};
 use std::str::FromStr;
-use std::sync::Arc;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, OnceLock};
+use std::time::{Duration, Instant};
 
 use thiserror::Error;
-use tokio::sync::{mpsc, Mutex};
-use tracing::info;
+use tokio::sync::{mpsc, Mutex, Semaphore};
+use tracing::{info, warn};
 use wasmtime::*;
 
+use crate::blobs::{BlobHandles, BlobInfo, BlobRegistry};
+use crate::breaker::{BreakerConfig, BreakerInfo, Breakers, Outcome};
+use crate::budget::{Budget, Budgets, Limit, Overrun, OverrunStats};
+use crate::buffers::BufferPool;
+use crate::bundle::{BundledModule, Manifest};
+use crate::cache::{Cache, CacheConfig, CacheScope};
+use crate::memory::{Governor, MemoryLimits, MemoryReport, Pressure};
+use crate::profiler::{Profiler, ProfilerConfig};
+use crate::regexes::{PatternCache, RegexHandles, Regexes};
 use crate::registry::Registry;
+use crate::replay::{ReloadGate, ReloadPolicy, ReplayReport, Sample, Samples};
+use crate::runtime::{ExecutionSlot, OutputFull};
+use crate::slim::{self, CustomSections, SlimReport};
+use crate::threads::{self, Tasks, ThreadConfig, ThreadPool, Threads};
+use crate::usage::{Usage, WarmCounters, WarmStats};
 use crate::webload::{Domain, InvalidUrl, ResolvedModule, WebError};
 use crate::{runtime as rt, webload};
 
@@ -36,20 +53,43 @@ pub enum Error {
     InvalidPointer,
     #[error("execution timed out")]
     TimedOut,
+    #[error("module is failing too often and has been disabled for a while")]
+    CircuitOpen,
+    #[error("shared memory is only available to trusted modules, as the wotto.shared import")]
+    SharedMemory,
+    #[error("modules cannot define more than one memory")]
+    TooManyMemories,
+    #[error("not enough memory to load the module")]
+    OutOfMemory,
+    #[error("new version of the module is worse than the old one ({0})")]
+    Regression(String),
     #[error("invalid url ({0}")]
     InvalidUrl(#[from] InvalidUrl),
     #[error("error while fetching url ({0})")]
     CannotFetch(#[from] WebError),
     #[error("module {0} previously at url {1} not found")]
     ModuleGone(String, url::Url),
+    #[error("i/o error ({0})")]
+    Io(#[from] std::io::Error),
+    #[error("library {0} not found")]
+    LibraryNotFound(String),
+    #[error("library {library} cannot be used by {module} ({reason})")]
+    IncompatibleLibrary {
+        library: String,
+        module: String,
+        reason: String,
+    },
+    #[error("invalid bundle ({0})")]
+    InvalidBundle(String),
 }
 
 pub(crate) type Result<T> = std::result::Result<T, Error>;
 pub(crate) type WResult<T> = std::result::Result<T, anyhow::Error>;
 
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum Command {
     LoadModule(String),
+    LoadLibrary(String),
     RunModule {
         module: String,
         entry_point: String,
@@ -193,10 +233,54 @@ impl Display for FullyQualifiedName {
 
 pub struct Service {
     engine: Engine,
-    modules: Mutex<HashMap<FullyQualifiedNameBuf, Module>>,
-    linker: Linker<RuntimeData>,
+    modules: Mutex<HashMap<FullyQualifiedNameBuf, LoadedModule>>,
+    /// Always lock after `modules` when both are needed.
+    libraries: Mutex<HashMap<String, Library>>,
+    linker: Arc<Linker<RuntimeData>>,
     registry: Registry<FullyQualifiedNameBuf, ResolvedModule>,
     epoch_timer: Arc<EpochTimer>,
+    profiler: Option<Profiler>,
+    cache: Option<Arc<Cache>>,
+    blobs: Arc<BlobRegistry>,
+    regexes: Regexes,
+    /// Limits how many guests run at the same time, if set.
+    execution_slots: Option<Arc<Semaphore>>,
+    execution_slot_count: usize,
+    budgets: Budgets,
+    breakers: Breakers,
+    usage: parking_lot::Mutex<Usage>,
+    warm_counters: WarmCounters,
+    samples: Samples,
+    reload_gate: ReloadGate,
+    reload_reports: parking_lot::Mutex<HashMap<String, ReplayReport>>,
+    buffers: BufferPool,
+    /// Modules that are stopped as soon as their output is full.
+    stoppable: parking_lot::RwLock<HashSet<String>>,
+    custom_sections: CustomSections,
+    slim_reports: parking_lot::Mutex<HashMap<String, SlimReport>>,
+    threads: Option<Arc<ThreadPool>>,
+    /// Modules trusted with shared memory and threads.
+    threaded: parking_lot::RwLock<HashSet<String>>,
+    memory: Governor,
+}
+
+/// How often the epoch is incremented while guests are running. Guests are
+/// checked against their budget (and can be interrupted) once per tick.
+const EPOCH_INTERVAL: Duration = Duration::from_millis(5);
+
+/// Bump when changing `make_engine` in a way that affects compiled code, so
+/// that bundles compiled with the previous configuration are rejected.
+const ENGINE_CONFIG_REVISION: u32 = 2;
+
+/// Identifies the engine configuration for precompiled artifacts.
+fn engine_fingerprint() -> String {
+    format!(
+        "wotto-engine {} config {} {}-{}",
+        env!("CARGO_PKG_VERSION"),
+        ENGINE_CONFIG_REVISION,
+        std::env::consts::ARCH,
+        std::env::consts::OS,
+    )
 }
 
 fn make_engine() -> Engine {
@@ -206,6 +290,11 @@ fn make_engine() -> Engine {
         .wasm_backtrace_details(WasmBacktraceDetails::Enable)
         .async_support(true)
         .epoch_interruption(true)
+        // for threaded modules only, see `threads`: they import a shared
+        // memory besides their own, and `slim_and_compile` refuses modules
+        // that define more than one
+        .wasm_threads(true)
+        .wasm_multi_memory(true)
         .cranelift_opt_level(OptLevel::Speed);
 
     Engine::new(&config).unwrap()
@@ -222,10 +311,570 @@ impl Service {
         Service {
             engine,
             modules: Mutex::default(),
-            linker,
+            libraries: Mutex::default(),
+            linker: Arc::new(linker),
             registry: Registry::default(),
             epoch_timer: Arc::default(),
+            profiler: None,
+            cache: None,
+            blobs: Arc::default(),
+            regexes: Regexes::default(),
+            execution_slots: None,
+            execution_slot_count: 0,
+            budgets: Budgets::default(),
+            breakers: Breakers::default(),
+            usage: parking_lot::Mutex::default(),
+            warm_counters: WarmCounters::default(),
+            samples: Samples::default(),
+            reload_gate: ReloadGate::default(),
+            reload_reports: parking_lot::Mutex::default(),
+            buffers: BufferPool::new(OUTPUT_CAPACITY),
+            stoppable: parking_lot::RwLock::default(),
+            custom_sections: CustomSections::default(),
+            slim_reports: parking_lot::Mutex::default(),
+            threads: None,
+            threaded: parking_lot::RwLock::default(),
+            memory: Governor::default(),
+        }
+    }
+
+    /// Let at most `slots` guests run at the same time; other calls to
+    /// `run_module` wait for their turn. Guests waiting in an async host
+    /// import (like `wotto.sleep`) give back their slot while they wait, so
+    /// modules that spend most of their time waiting don't count against
+    /// the limit.
+    pub fn set_execution_slots(&mut self, slots: usize) {
+        self.execution_slots = Some(Arc::new(Semaphore::new(slots)));
+        self.execution_slot_count = slots;
+    }
+
+    /// Number of execution slots currently free, if they are limited.
+    pub fn available_execution_slots(&self) -> Option<usize> {
+        self.execution_slots
+            .as_ref()
+            .map(|slots| slots.available_permits())
+    }
+
+    /// Budget for the modules and entry points that don't have their own.
+    pub fn set_default_budget(&mut self, budget: Budget) {
+        self.budgets.set_default(budget);
+    }
+
+    /// Set the budget of a module, or of one of its entry points if
+    /// `entry_point` is given. Entry point budgets take precedence.
+    pub fn set_budget(&self, module_name: &str, entry_point: Option<&str>, budget: Budget) {
+        self.budgets.set(module_name, entry_point, budget);
+    }
+
+    pub fn budget(&self, module_name: &str, entry_point: &str) -> Budget {
+        self.budgets.get(module_name, entry_point)
+    }
+
+    /// Entry points that ran past their budget, as `module.entry_point`.
+    pub fn overruns(&self) -> Vec<(String, OverrunStats)> {
+        self.budgets.overruns()
+    }
+
+    pub fn set_breaker_config(&mut self, config: BreakerConfig) {
+        self.breakers.set_config(config);
+    }
+
+    /// Circuit breakers of the entry points that have been called.
+    pub fn breakers(&self) -> Vec<BreakerInfo> {
+        self.breakers.list()
+    }
+
+    /// Close the breaker of an entry point and forget its failures.
+    pub fn reset_breaker(&self, module_name: &str, entry_point: &str) -> bool {
+        self.breakers.reset(module_name, entry_point)
+    }
+
+    /// Configure how reloaded modules are compared with the version they
+    /// replace. See `ReloadGate`.
+    pub fn set_reload_gate(&mut self, gate: ReloadGate) {
+        self.reload_gate = gate;
+    }
+
+    /// The last comparison made for each reloaded module.
+    pub fn reload_reports(&self) -> Vec<ReplayReport> {
+        let mut reports: Vec<_> = self.reload_reports.lock().values().cloned().collect();
+        reports.sort_by(|a, b| a.module.cmp(&b.module));
+        reports
+    }
+
+    /// Stop calls to a module as soon as their output is full, instead of
+    /// letting them run to the end for output that would be thrown away.
+    /// Only for modules that don't need to finish, e.g. to update their
+    /// cache. Calls that are stopped this way succeed, with `RunStats::stopped`
+    /// set.
+    pub fn set_stoppable(&self, module_name: &str, stoppable: bool) {
+        let mut modules = self.stoppable.write();
+        if stoppable {
+            modules.insert(module_name.to_string());
+        } else {
+            modules.remove(module_name);
+        }
+    }
+
+    /// Which custom sections to strip from modules before compiling them.
+    /// Only applies to modules loaded afterwards.
+    pub fn set_custom_sections(&mut self, policy: CustomSections) {
+        self.custom_sections = policy;
+    }
+
+    /// Sizes and compile times of the modules compiled so far, by name.
+    pub fn slim_reports(&self) -> Vec<(String, SlimReport)> {
+        let mut reports: Vec<_> = self
+            .slim_reports
+            .lock()
+            .iter()
+            .map(|(name, report)| (name.clone(), report.clone()))
+            .collect();
+        reports.sort_by(|a, b| a.0.cmp(&b.0));
+        reports
+    }
+
+    /// Let modules trusted with `set_threaded` run tasks in parallel, on
+    /// memory shared between instances. See `ThreadConfig`.
+    pub fn enable_threads(&mut self, config: ThreadConfig) {
+        self.threads = Some(Arc::new(ThreadPool::new(config)));
+    }
+
+    /// Trust a module with shared memory and threads. Modules can race on
+    /// shared memory and block in `memory.atomic.wait` without being
+    /// interrupted, so only trust modules you wrote or reviewed.
+    pub fn set_threaded(&self, module_name: &str, threaded: bool) {
+        let mut modules = self.threaded.write();
+        if threaded {
+            modules.insert(module_name.to_string());
+        } else {
+            modules.remove(module_name);
+        }
+    }
+
+    /// Limits for `check_memory`. See `MemoryLimits`.
+    pub fn set_memory_limits(&mut self, limits: MemoryLimits) {
+        self.memory = Governor::new(limits);
+    }
+
+    /// Count memory held outside of the engine (for the bot, its IRC queues
+    /// and pending commands) towards the limits, as `subsystem`.
+    pub fn set_external_memory(&self, subsystem: &str, bytes: usize) {
+        self.memory.set_external(subsystem, bytes);
+    }
+
+    /// Pressure found by the last `check_memory`.
+    pub fn memory_pressure(&self) -> Pressure {
+        self.memory.pressure()
+    }
+
+    /// Estimate the memory used by each subsystem, and react if it is over
+    /// the limits. Above the soft limit, pooled buffers and the sources of
+    /// web modules are dropped, web modules that have been idle for a while
+    /// are unloaded until their next call (least recently used first), and
+    /// half of the execution slots are held back. Above the hard limit, all
+    /// slots but one are held back and no module can be loaded. Meant to be
+    /// called periodically; the reactions last until the next call.
+    pub async fn check_memory(&self) -> MemoryReport {
+        let mut usage = self.memory_usage().await;
+        let soft_limit = self.memory.limits().soft;
+        let mut reclaimed = 0;
+        if usage.values().sum::<usize>() >= soft_limit {
+            reclaimed += self.buffers.shrink();
+            self.registry
+                .for_each_unlocked(|webmodule| reclaimed += webmodule.drop_content());
+            let excess = usage
+                .values()
+                .sum::<usize>()
+                .saturating_sub(soft_limit + reclaimed);
+            reclaimed += self.evict_idle_modules(excess).await;
+            usage = self.memory_usage().await;
+        }
+        let total = usage.values().sum();
+        let previous = self.memory.pressure();
+        let slots = self
+            .execution_slots
+            .as_ref()
+            .map(|slots| (slots, self.execution_slot_count));
+        let pressure = self.memory.settle(total, slots);
+        if pressure != previous {
+            match pressure {
+                Pressure::Normal => info!(total, "memory pressure is over"),
+                _ => warn!(total, ?pressure, reclaimed, "memory pressure"),
+            }
+        }
+        self.memory.report(usage, reclaimed)
+    }
+
+    /// Estimated bytes used by each subsystem.
+    async fn memory_usage(&self) -> BTreeMap<String, usize> {
+        let modules = self
+            .modules
+            .lock()
+            .await
+            .values()
+            .map(|module| code_size(module))
+            .sum();
+        let libraries = self
+            .libraries
+            .lock()
+            .await
+            .values()
+            .map(|library| code_size(&library.module))
+            .sum();
+        let mut web_sources = 0;
+        self.registry.for_each_unlocked(|webmodule| {
+            web_sources += webmodule.content().map_or(0, <[u8]>::len);
+        });
+        let cache = self.cache.as_ref().map_or(0, |cache| cache.size());
+        let mut usage = BTreeMap::from([
+            ("modules".to_string(), modules),
+            ("libraries".to_string(), libraries),
+            ("web_sources".to_string(), web_sources),
+            ("buffers".to_string(), self.buffers.retained()),
+            ("cache".to_string(), cache),
+        ]);
+        self.memory.add_usage(&mut usage);
+        usage
+    }
+
+    /// Unload web modules that have not been called for a while, least
+    /// recently used first, until `excess` bytes of code are freed. Returns
+    /// the bytes freed. They keep their registry entry, and are compiled
+    /// again on their next call (see `reload_evicted`). Other modules have
+    /// nothing to be loaded again from, so they are never unloaded.
+    async fn evict_idle_modules(&self, excess: usize) -> usize {
+        let mut modules = self.modules.lock().await;
+        let mut idle: Vec<_> = modules
+            .iter()
+            .filter(|(_, module)| module.web)
+            .map(|(fqn, module)| (module.last_used.load(Ordering::Relaxed), fqn.clone()))
+            .filter(|&(last_used, _)| self.memory.is_idle(last_used))
+            .collect();
+        idle.sort();
+        let mut freed = 0;
+        for (_, fqn) in idle {
+            if freed >= excess {
+                break;
+            }
+            let Some(module) = modules.remove(&fqn) else { continue; };
+            freed += code_size(&module);
+            self.memory.evicted();
+            info!(module = %fqn, "unloaded idle module");
+        }
+        freed
+    }
+
+    /// Compile a web module again from its registry entry, after it was
+    /// unloaded by `evict_idle_modules`. The source is fetched again if it
+    /// was dropped.
+    async fn reload_evicted(&self, key: &FullyQualifiedName) -> Result<LoadedModule> {
+        let mut entry = self
+            .registry
+            .lock_existing_entry_mut(key)
+            .await
+            .ok_or(Error::ModuleNotFound)?;
+        let webmodule = entry.as_mut().ok_or(Error::ModuleNotFound)?;
+        // another call might have done it while this one waited for the entry
+        if let Some(module) = self.modules.lock().await.get(key) {
+            return Ok(module.clone());
+        }
+        webmodule.ensure_content().await?;
+        let bytes = webmodule
+            .content()
+            .expect("loaded module should already have content");
+        let mut module =
+            LoadedModule::new(self.compile(&key.to_string(), bytes)?, self.memory.now());
+        module.web = true;
+        self.check_libraries(key, &module).await?;
+        self.modules
+            .lock()
+            .await
+            .insert(key.to_owned(), module.clone());
+        info!(module = %key, "reloaded evicted module");
+        Ok(module)
+    }
+
+    /// Shared memory and workers for a call to a module that imports
+    /// `wotto.shared`, if it does. Fails if the module is not trusted with
+    /// threads, or asks for too much memory.
+    fn threads_for(
+        &self,
+        key: &FullyQualifiedName,
+        module: &Module,
+        deadline: Instant,
+    ) -> Result<Option<Threads>> {
+        let Some(ty) = threads::shared_memory_import(module) else { return Ok(None); };
+        let pool = match &self.threads {
+            Some(pool)
+                if self.threaded.read().contains(&*key.fqn)
+                    && threads::shared_memory_allowed(&ty) =>
+            {
+                pool.clone()
+            }
+            _ => return Err(Error::SharedMemory),
+        };
+        let memory = SharedMemory::new(&self.engine, ty).map_err(Error::Wasm)?;
+        let engine = self.engine.clone();
+        let linker = self.linker.clone();
+        let module = module.clone();
+        let shared = memory.clone();
+        let blobs = self.blobs.clone();
+        let regexes = self.regexes.scope(&key.fqn);
+        let guests = self.memory.guests();
+        let spawn = move |tasks: Arc<Tasks>| -> threads::Worker {
+            // workers have no input, and their output is thrown away
+            let mut runtime_data = RuntimeData::new(
+                String::new(),
+                String::new(),
+                0,
+                blobs.clone(),
+                regexes.clone(),
+                ExecutionSlot::new(None),
+            );
+            runtime_data.limits.gauge = Some((guests.clone(), 0));
+            Box::pin(run_worker(
+                engine.clone(),
+                linker.clone(),
+                module.clone(),
+                shared.clone(),
+                runtime_data,
+                deadline,
+                tasks,
+            ))
+        };
+        Ok(Some(Threads::new(
+            pool,
+            self.execution_slots.clone(),
+            memory,
+            spawn,
+        )))
+    }
+
+    /// Compile a module or library, after stripping the custom sections
+    /// that the policy does not keep.
+    fn compile(&self, name: &str, bytes: &[u8]) -> Result<Module> {
+        // compiled code is usually a few times larger, but this is only
+        // until the next check
+        if !self.memory.admit_load(bytes.len()) {
+            return Err(Error::OutOfMemory);
+        }
+        self.slim_and_compile(name, bytes, |slimmed| Module::new(&self.engine, slimmed))
+    }
+
+    /// Strip the custom sections that the policy does not keep, pass what is
+    /// left to `compile`, and keep a `SlimReport` of it under `name`. Refuses
+    /// modules that define their own shared memory, or more than one memory.
+    fn slim_and_compile<T>(
+        &self,
+        name: &str,
+        bytes: &[u8],
+        compile: impl FnOnce(&[u8]) -> anyhow::Result<T>,
+    ) -> Result<T> {
+        // the checks below only understand the binary format
+        let bytes = &*wat::parse_bytes(bytes).map_err(|err| Error::Wasm(err.into()))?;
+        // shared memory is only given to trusted modules, through an import
+        if threads::defines_shared_memory(bytes) {
+            return Err(Error::SharedMemory);
+        }
+        // the limits of a store apply to each memory
+        if threads::count_defined_memories(bytes) > 1 {
+            return Err(Error::TooManyMemories);
+        }
+        let (slimmed, stripped) = slim::slim(bytes, self.custom_sections);
+        let start = Instant::now();
+        let compiled = compile(&slimmed).map_err(Error::Wasm)?;
+        let report = SlimReport {
+            original_size: bytes.len(),
+            size: slimmed.len(),
+            stripped,
+            compile_time: start.elapsed(),
+        };
+        if !report.stripped.is_empty() {
+            info!(
+                module = name,
+                original_size = report.original_size,
+                size = report.size,
+                compile_time = ?report.compile_time,
+                "stripped custom sections"
+            );
+        }
+        self.slim_reports.lock().insert(name.to_string(), report);
+        Ok(compiled)
+    }
+
+    /// Sample guest stacks on epoch ticks during `run_module`.
+    pub fn enable_profiler(&mut self, config: ProfilerConfig) {
+        self.profiler = Some(Profiler::new(config));
+    }
+
+    /// Names of the modules that have a profile.
+    pub fn profiled_modules(&self) -> Vec<String> {
+        self.profiler
+            .as_ref()
+            .map(Profiler::modules)
+            .unwrap_or_default()
+    }
+
+    /// Folded-stack profile of a module, if the profiler is enabled and the
+    /// module has been run since the last reset.
+    pub fn profile(&self, module: &str) -> Option<String> {
+        self.profiler.as_ref()?.folded(module)
+    }
+
+    pub fn reset_profile(&self, module: &str) -> bool {
+        self.profiler
+            .as_ref()
+            .map_or(false, |profiler| profiler.reset(module))
+    }
+
+    /// Save all profiles to a directory, one file per module. Returns the
+    /// number of profiles written.
+    pub fn save_profiles<P: AsRef<Path>>(&self, dir: P) -> std::io::Result<usize> {
+        match &self.profiler {
+            Some(profiler) => profiler.save(dir.as_ref()),
+            None => Ok(0),
+        }
+    }
+
+    /// Give modules a key-value cache through the `wotto.cache_*` imports.
+    /// Without it, lookups always miss and stores always fail. If the
+    /// configuration has a log path, the log is replayed here.
+    pub fn enable_cache(&mut self, config: CacheConfig) -> std::io::Result<()> {
+        self.cache = Some(Cache::new(config)?);
+        Ok(())
+    }
+
+    /// Count an invocation of a module in a context (for the bot, the
+    /// channel), to find out which modules are worth prewarming. Only for
+    /// modules that exist: only so many modules are counted, and the least
+    /// used ones are forgotten to make room.
+    pub fn record_invocation(&self, context: Option<&str>, module_name: &str) {
+        self.usage.lock().record(context, module_name);
+    }
+
+    /// Modules by number of invocations, most used first, in a context or
+    /// overall.
+    pub fn popular_modules(&self, context: Option<&str>) -> Vec<(String, u64)> {
+        self.usage.lock().popular(context)
+    }
+
+    /// Replace the invocation counts with the ones saved by `save_usage`.
+    pub fn load_usage<P: AsRef<Path>>(&self, path: P) -> std::io::Result<()> {
+        *self.usage.lock() = Usage::load(path.as_ref())?;
+        Ok(())
+    }
+
+    pub fn save_usage<P: AsRef<Path>>(&self, path: P) -> std::io::Result<()> {
+        self.usage.lock().save(path.as_ref())
+    }
+
+    /// How many calls so far found their module cold.
+    pub fn warm_stats(&self) -> WarmStats {
+        self.warm_counters.get()
+    }
+
+    /// Warm up the modules that are most used in a context (or overall),
+    /// within a memory budget. See `prewarm`.
+    pub async fn prewarm_popular(
+        &self,
+        context: Option<&str>,
+        memory_budget: usize,
+    ) -> Vec<String> {
+        let names: Vec<_> = self
+            .popular_modules(context)
+            .into_iter()
+            .map(|(name, _)| name)
+            .collect();
+        self.prewarm(&names, memory_budget).await
+    }
+
+    /// Warm up modules before anybody calls them, so that their first call
+    /// does not pay for resolving imports and paging in code. Modules are
+    /// taken in order until their estimated memory (code and initial linear
+    /// memory) would go over `memory_budget`; modules that are already warm
+    /// count towards it. Returns the modules warmed up by this call.
+    pub async fn prewarm(&self, module_names: &[String], memory_budget: usize) -> Vec<String> {
+        let mut used = 0;
+        let mut warmed = vec![];
+        for name in module_names {
+            let Ok(key) = FullyQualifiedName::from_str(name) else { continue; };
+            let Some(module) = self.modules.lock().await.get(key).cloned() else { continue; };
+            if let Some(warm) = module.warm.get() {
+                used += warm.cost;
+                continue;
+            }
+            if used + code_size(&module) > memory_budget {
+                continue;
+            }
+            match self.warm_up(key, &module).await {
+                Ok(cost) => {
+                    used += cost;
+                    warmed.push(name.clone());
+                }
+                Err(err) => warn!(module = name, %err, "cannot prewarm module"),
+            }
         }
+        info!(?warmed, used, "prewarmed modules");
+        warmed
+    }
+
+    /// Instantiate a module once, without calling it.
+    async fn warm_up(&self, key: &FullyQualifiedName, module: &LoadedModule) -> Result<usize> {
+        let runtime_data = RuntimeData::new(
+            String::new(),
+            String::new(),
+            0,
+            self.blobs.clone(),
+            self.regexes.scope(&key.fqn),
+            ExecutionSlot::new(None),
+        );
+        let mut store = Store::new(&self.engine, runtime_data);
+        store.data_mut().threads =
+            self.threads_for(key, module, Instant::now() + PREWARM_TIMEOUT)?;
+        store.limiter(|state| &mut state.limits);
+        store.epoch_deadline_async_yield_and_update(1);
+        // in case of a start function that does not return
+        let _timer = self.epoch_timer.start();
+        tokio::time::timeout(PREWARM_TIMEOUT, self.instantiate(&mut store, module))
+            .await
+            .map_err(|_| Error::TimedOut)??;
+        Ok(self.warmed(module, store.data().limits.peak_memory))
+    }
+
+    /// Mark a module as warm after its first instantiation, which used
+    /// `memory` bytes of linear memory. Returns its estimated cost.
+    fn warmed(&self, module: &LoadedModule, memory: usize) -> usize {
+        let warm = module.warm.get_or_init(|| {
+            // modules that import from libraries are linked by hand
+            let pre = library_names(module)
+                .next()
+                .is_none()
+                .then(|| self.linker.instantiate_pre(module).ok())
+                .flatten();
+            Warm {
+                pre,
+                cost: code_size(module) + memory,
+            }
+        });
+        warm.cost
+    }
+
+    /// Make a file available to all modules as a read-only blob, through
+    /// the `wotto.blob_*` imports. The file is memory-mapped, and must not be
+    /// modified in place while registered. Returns the size of the blob.
+    pub fn register_blob<P: AsRef<Path>>(&self, name: &str, path: P) -> Result<usize> {
+        let size = self.blobs.register(name, path.as_ref())?;
+        info!(blob = name, size, "registered blob");
+        Ok(size)
+    }
+
+    pub fn unregister_blob(&self, name: &str) -> bool {
+        self.blobs.unregister(name)
+    }
+
+    pub fn blobs(&self) -> Vec<BlobInfo> {
+        self.blobs.list()
     }
 
     pub fn increment_epoch(&self) {
@@ -238,14 +887,11 @@ impl Service {
         P: AsRef<Self>,
     {
         let epoch_timer = myself().unwrap().as_ref().epoch_timer.clone();
-        tokio::task::spawn_blocking(move || {
-            let interval = std::time::Duration::from_millis(5);
-            loop {
-                epoch_timer.wait();
-                std::thread::sleep(interval);
-                let Some(slf) = myself() else { break; };
-                slf.as_ref().engine.increment_epoch();
-            }
+        tokio::task::spawn_blocking(move || loop {
+            epoch_timer.wait();
+            std::thread::sleep(EPOCH_INTERVAL);
+            let Some(slf) = myself() else { break; };
+            slf.as_ref().engine.increment_epoch();
         })
     }
 
@@ -253,18 +899,13 @@ impl Service {
         // used for manual testing, maybe deprecate?
         while let Some(cmd) = rx.recv().await {
             let result = match cmd {
-                Command::LoadModule(name) => self.load_module(name).await,
-                Command::RunModule {
-                    module,
-                    entry_point,
-                    args,
-                } => self.run_module(&module, &entry_point, &args).await,
-                Command::Idle => {
-                    continue;
-                }
                 Command::Quit => {
                     break;
                 }
+                cmd => match self.execute(cmd).await {
+                    Some(result) => result,
+                    None => continue,
+                },
             };
             if tx.send(result).await.is_err() {
                 break;
@@ -272,24 +913,338 @@ impl Service {
         }
     }
 
-    async fn add_module(&self, fqn: FullyQualifiedNameBuf, module: Module) {
-        let mut modules = self.modules.lock().await;
-        modules.insert(fqn, module);
+    /// Execute a single command. Control commands (`Idle`, `Quit`) have no
+    /// effect here and return `None`.
+    pub async fn execute(&self, cmd: Command) -> Option<Result<String>> {
+        match cmd {
+            Command::LoadModule(name) => Some(self.load_module(name).await),
+            Command::LoadLibrary(name) => Some(self.load_library(name).await),
+            Command::RunModule {
+                module,
+                entry_point,
+                args,
+            } => Some(self.run_module(&module, &entry_point, &args).await),
+            Command::Idle | Command::Quit => None,
+        }
+    }
+
+    /// Replace the current version of a module, if any, once the new one
+    /// passed the reload gate. Calls are replayed with no lock held, so the
+    /// old version keeps running meanwhile. The registry entry of a web module
+    /// is only locked to swap it along with the code.
+    async fn add_module(
+        &self,
+        fqn: FullyQualifiedNameBuf,
+        module: Module,
+        webmodule: Option<ResolvedModule>,
+    ) -> Result<()> {
+        let mut module = LoadedModule::new(module, self.memory.now());
+        module.web = webmodule.is_some();
+        loop {
+            let old = self.check_reload(&fqn, &module).await?;
+            let entry = match webmodule {
+                Some(_) => Some(self.registry.lock_entry_mut(fqn.clone()).await),
+                None => None,
+            };
+            let mut modules = self.modules.lock().await;
+            if modules.get(&fqn).map(LoadedModule::id) != old.as_ref().map(LoadedModule::id) {
+                // another version was swapped in during the replay, which is
+                // the one to compare with now
+                continue;
+            }
+            self.check_libraries(&fqn, &module).await?;
+            // failures of the old version say nothing about the new one
+            self.breakers.reset_module(&fqn.fqn);
+            modules.insert(fqn, module);
+            if let Some(mut entry) = entry {
+                *entry = webmodule;
+            }
+            return Ok(());
+        }
+    }
+
+    /// Check that the libraries a module imports are loaded and provide
+    /// what it imports.
+    async fn check_libraries(&self, fqn: &FullyQualifiedName, module: &Module) -> Result<()> {
+        let libraries = self.libraries.lock().await;
+        for name in library_names(module) {
+            let library = libraries
+                .get(name)
+                .ok_or_else(|| Error::LibraryNotFound(name.to_string()))?;
+            check_library_imports(module, name, &library.module).map_err(|reason| {
+                Error::IncompatibleLibrary {
+                    library: name.to_string(),
+                    module: fqn.to_string(),
+                    reason,
+                }
+            })?;
+        }
+        Ok(())
+    }
+
+    /// Replay the recent calls of a module against a new version of it,
+    /// before it replaces the old one. Returns the version it was compared
+    /// with (the current one), and fails if the new version regressed and
+    /// the policy is to refuse it.
+    async fn check_reload(
+        &self,
+        key: &FullyQualifiedName,
+        new: &LoadedModule,
+    ) -> Result<Option<LoadedModule>> {
+        let current = self.modules.lock().await.get(key).cloned();
+        if self.reload_gate.policy == ReloadPolicy::Off {
+            return Ok(current);
+        }
+        self.reload_reports.lock().remove(&key.to_string());
+        let Some(old) = &current else { return Ok(None); };
+        let samples = self.samples.get(&key.fqn);
+        if samples.is_empty() {
+            return Ok(current);
+        }
+        let mut report = ReplayReport {
+            module: key.to_string(),
+            ..Default::default()
+        };
+        for sample in &samples {
+            let Some((old_output, old_time, old_memory)) = self.replay(key, old, sample).await?
+            else {
+                continue;
+            };
+            report.samples += 1;
+            report.old_time += old_time;
+            report.old_memory = report.old_memory.max(old_memory);
+            let Some((new_output, new_time, new_memory)) = self.replay(key, new, sample).await?
+            else {
+                report.new_failures += 1;
+                continue;
+            };
+            report.new_time += new_time;
+            report.new_memory = report.new_memory.max(new_memory);
+            if new_output != old_output {
+                report.changed_outputs += 1;
+            }
+        }
+        if report.samples > 0 {
+            report.regression = self.reload_gate.judge(&report);
+        }
+        report.loaded =
+            report.regression.is_none() || self.reload_gate.policy != ReloadPolicy::Refuse;
+        match &report.regression {
+            Some(reason) => {
+                warn!(module = %key, %reason, loaded = report.loaded, "new version regressed")
+            }
+            None => info!(
+                module = %key,
+                samples = report.samples,
+                old_time = ?report.old_time,
+                new_time = ?report.new_time,
+                changed_outputs = report.changed_outputs,
+                "replayed calls on new version"
+            ),
+        }
+        let refused = match report.loaded {
+            true => None,
+            false => report.regression.clone(),
+        };
+        self.reload_reports
+            .lock()
+            .insert(report.module.clone(), report);
+        match refused {
+            Some(reason) => Err(Error::Regression(reason)),
+            None => Ok(current),
+        }
+    }
+
+    /// Run a recorded call a few times on a version of a module. Returns the
+    /// output, the shortest time spent running the guest and the largest
+    /// memory it used, or `None` if the call fails.
+    async fn replay(
+        &self,
+        key: &FullyQualifiedName,
+        module: &LoadedModule,
+        sample: &Sample,
+    ) -> Result<Option<(String, Duration, usize)>> {
+        let mut best: Option<(String, Duration, usize)> = None;
+        for _ in 0..REPLAY_RUNS {
+            let result = self
+                .run_loaded(key, module, &sample.entry_point, &sample.args, true)
+                .await;
+            let (output, stats) = match result {
+                Ok(run) => run,
+                Err(
+                    Error::Wasm(_)
+                    | Error::TimedOut
+                    | Error::FunctionNotFound
+                    | Error::WrongFunctionType
+                    | Error::MemoryNotExported
+                    | Error::InvalidPointer,
+                ) => return Ok(None),
+                Err(err) => return Err(err),
+            };
+            let time = stats.execute.saturating_sub(stats.suspended);
+            let memory = stats.peak_memory.max(best.as_ref().map_or(0, |b| b.2));
+            best = match best {
+                Some((best_output, best_time, _)) if best_time <= time => {
+                    Some((best_output, best_time, memory))
+                }
+                _ => Some((output, time, memory)),
+            };
+        }
+        Ok(best)
+    }
+
+    /// Load a library module from the local modules directory. See
+    /// `add_library`.
+    #[tracing::instrument(skip(self))]
+    pub async fn load_library(&self, name: String) -> Result<String> {
+        self.load_library_from_file(&local_module_path(&name)?)
+            .await
+    }
+
+    /// Load a library module from any local file, without the restrictions
+    /// applied by `load_library`.
+    #[tracing::instrument(skip(self))]
+    pub async fn load_library_from_file(&self, path: &Path) -> Result<String> {
+        let name = CanonicalName::try_from(path)?.to_string();
+        let module = self.compile(&name, &std::fs::read(path)?)?;
+        self.add_library(name, module).await
+    }
+
+    /// Make a library available to command modules, which import from it
+    /// with the `lib:<name>` module name. The library is compiled once, and
+    /// instantiated next to each command that uses it, in the same store.
+    ///
+    /// Libraries can only import host functions, not other libraries.
+    /// Replacing a library bumps its generation, and fails if any loaded
+    /// module imports something that the new version does not provide.
+    pub async fn add_library(&self, name: String, module: Module) -> Result<String> {
+        if let Some(import) = library_names(&module).next() {
+            return Err(Error::IncompatibleLibrary {
+                library: import.to_string(),
+                module: name,
+                reason: "libraries cannot import other libraries".to_string(),
+            });
+        }
+        let modules = self.modules.lock().await;
+        let mut libraries = self.libraries.lock().await;
+        for (fqn, dependent) in modules.iter() {
+            check_library_imports(dependent, &name, &module).map_err(|reason| {
+                Error::IncompatibleLibrary {
+                    library: name.clone(),
+                    module: fqn.to_string(),
+                    reason,
+                }
+            })?;
+        }
+        let generation = libraries.get(&name).map_or(1, |old| old.generation + 1);
+        info!(library = name, generation, "loaded library");
+        libraries.insert(name.clone(), Library { module, generation });
+        Ok(name)
+    }
+
+    /// Loaded libraries, with their generation and the modules that import
+    /// from them.
+    pub async fn libraries(&self) -> Vec<LibraryInfo> {
+        let modules = self.modules.lock().await;
+        let libraries = self.libraries.lock().await;
+        let mut infos: Vec<_> = libraries
+            .iter()
+            .map(|(name, library)| LibraryInfo {
+                name: name.clone(),
+                generation: library.generation,
+                dependents: modules
+                    .iter()
+                    .filter(|(_, module)| library_names(module).any(|lib| lib == name))
+                    .map(|(fqn, _)| fqn.to_string())
+                    .collect(),
+            })
+            .collect();
+        infos.sort_by(|a, b| a.name.cmp(&b.name));
+        infos
+    }
+
+    async fn library(&self, name: &str) -> Result<Module> {
+        let libraries = self.libraries.lock().await;
+        libraries
+            .get(name)
+            .map(|library| library.module.clone())
+            .ok_or_else(|| Error::LibraryNotFound(name.to_string()))
+    }
+
+    /// Instantiate a command module, along with the libraries it imports.
+    async fn instantiate(
+        &self,
+        store: &mut Store<RuntimeData>,
+        module: &Module,
+    ) -> Result<Instance> {
+        if library_names(module).next().is_none() && threads::shared_memory_import(module).is_none()
+        {
+            return self
+                .linker
+                .instantiate_async(store, module)
+                .await
+                .map_err(Error::Wasm);
+        }
+        // each library is instantiated at most once per store
+        let mut instances: Vec<(&str, Instance)> = vec![];
+        let mut imports = Vec::with_capacity(module.imports().len());
+        for import in module.imports() {
+            let export = match import.module().strip_prefix(LIBRARY_NAMESPACE) {
+                Some(name) => {
+                    let instance = match instances.iter().find(|(lib, _)| *lib == name) {
+                        Some((_, instance)) => *instance,
+                        None => {
+                            let library = self.library(name).await?;
+                            let instance = self
+                                .linker
+                                .instantiate_async(&mut *store, &library)
+                                .await
+                                .map_err(Error::Wasm)?;
+                            instances.push((name, instance));
+                            instance
+                        }
+                    };
+                    instance.get_export(&mut *store, import.name())
+                }
+                None if threads::is_shared_memory(&import) => store
+                    .data()
+                    .threads
+                    .as_ref()
+                    .map(|threads| threads.memory.clone().into()),
+                None => self.linker.get_by_import(&mut *store, &import),
+            };
+            let export = export.ok_or_else(|| {
+                Error::Wasm(anyhow::anyhow!(
+                    "unknown import: `{}::{}`",
+                    import.module(),
+                    import.name()
+                ))
+            })?;
+            imports.push(export);
+        }
+        Instance::new_async(store, module, &imports)
+            .await
+            .map_err(Error::Wasm)
     }
 
     #[tracing::instrument(skip(self))]
     pub async fn load_module(&self, name: String) -> Result<String> {
         let key = FullyQualifiedName::from_str(&name)?;
-        let mut entry = self.registry.lock_entry_mut(key.to_owned()).await;
-        if let Some(webmodule) = &mut *entry {
-            let url = webmodule.url().clone();
+        // the entry is not held while the new version is fetched, compiled
+        // and replayed, so that calls keep running the old one
+        let known = {
+            let entry = self.registry.lock_entry_mut(key.to_owned()).await;
+            entry
+                .as_ref()
+                .map(|webmodule| (webmodule.url().clone(), self.fqn_for_module(webmodule)))
+        };
+        if let Some((url, new_fqn)) = known {
             info!(module = name, %url, "reloading module");
             // TODO should we make explicit an distinction between the case
             // when the user requests re-resolution (e.g. same URL gives a
             // newer version) vs when we want to just attempt a reload?
             // unsure if the "just reload" case actually exists
             let new_webmodule = webload::resolve(url.clone()).await?;
-            let new_fqn = self.fqn_for_module(webmodule);
             if new_fqn != name {
                 // a given url used to provide a module name, but it
                 // doesn't anymore. the resolver is supposed to make sure
@@ -297,24 +1252,110 @@ impl Service {
                 // mess with the registry state here.
                 return Err(Error::ModuleGone(name, url));
             }
-            self.load_web_module_with_lock(&mut entry, key, new_webmodule)
-                .await?;
+            self.load_web_module(key.to_owned(), new_webmodule).await?;
             return Ok(name);
         }
-        // quick and dirty name validation + path loading
-        const MODULES_PATH: &str = "examples";
-        let name_as_path = PathBuf::from_str(&name).map_err(|_| Error::InvalidModuleName)?;
-        let file_name = name_as_path.file_name().ok_or(Error::InvalidModuleName)?;
-        let path = Path::new(MODULES_PATH).join(file_name);
+        self.load_module_from_file(&local_module_path(&name)?).await
+    }
+
+    /// Load a module from any local file, without the restrictions applied by
+    /// `load_module`. Meant for tools and benchmarks, not for user input.
+    #[tracing::instrument(skip(self))]
+    pub async fn load_module_from_file(&self, path: &Path) -> Result<String> {
         // "builtin" modules have a short fqn with no namespace or prefix
         // TODO: unify the builtin and web code paths
-        let canonical_name = CanonicalName::try_from(&path)?;
+        let canonical_name = CanonicalName::try_from(path)?;
+        let fqn = FullyQualifiedNameBuf::new_builtin(canonical_name);
+        let module = self.compile(&fqn.to_string(), &std::fs::read(path)?)?;
+        self.add_module(fqn.clone(), module, None).await?;
+        Ok(fqn.to_string())
+    }
+
+    /// Load a module from memory as a builtin module named after `name`
+    /// (without extension). Accepts both binary and text format.
+    #[tracing::instrument(skip(self, bytes))]
+    pub async fn load_module_from_bytes(&self, name: &str, bytes: &[u8]) -> Result<String> {
+        let canonical_name = CanonicalName::try_from(name)?;
         let fqn = FullyQualifiedNameBuf::new_builtin(canonical_name);
-        let module = Module::from_file(&self.engine, &path).map_err(Error::Wasm)?;
-        self.add_module(fqn.clone(), module).await;
+        let module = self.compile(&fqn.to_string(), bytes)?;
+        self.add_module(fqn.clone(), module, None).await?;
         Ok(fqn.to_string())
     }
 
+    /// Compile modules ahead of time into a bundle in `dir`, which can later
+    /// be loaded with `load_bundle` without compiling anything. Modules are
+    /// named after their file name, like with `load_module_from_file`.
+    pub fn write_bundle<P: AsRef<Path>>(&self, dir: &Path, sources: &[P]) -> Result<Manifest> {
+        std::fs::create_dir_all(dir)?;
+        let mut manifest = Manifest::new(engine_fingerprint());
+        for source in sources {
+            let source = source.as_ref();
+            let name = CanonicalName::try_from(source)?.to_string();
+            if manifest.modules.iter().any(|module| module.name == name) {
+                return Err(Error::InvalidBundle(format!(
+                    "duplicate module name {name}"
+                )));
+            }
+            let bytes = std::fs::read(source)?;
+            let artifact = self.slim_and_compile(&name, &bytes, |slimmed| {
+                self.engine.precompile_module(slimmed)
+            })?;
+            let compile_time = self.slim_reports.lock()[&name].compile_time;
+            let artifact_name = format!("{name}.cwasm");
+            std::fs::write(dir.join(&artifact_name), &artifact)?;
+            info!(module = name, ?compile_time, "precompiled module");
+            manifest.modules.push(BundledModule {
+                name,
+                artifact: artifact_name,
+                source: source.display().to_string(),
+                source_size: bytes.len() as u64,
+                artifact_size: artifact.len() as u64,
+                compile_time_ms: compile_time.as_secs_f64() * 1e3,
+            });
+        }
+        manifest.write(dir)?;
+        Ok(manifest)
+    }
+
+    /// Load every module in a bundle written by `write_bundle`. Artifacts are
+    /// memory-mapped rather than compiled. Fails without loading anything if
+    /// the bundle was compiled for a different engine.
+    #[tracing::instrument(skip(self))]
+    pub async fn load_bundle(&self, dir: &Path) -> Result<Vec<String>> {
+        let manifest = Manifest::read(dir)?;
+        manifest.check_compatible(&engine_fingerprint())?;
+        let mut modules = Vec::with_capacity(manifest.modules.len());
+        for bundled in &manifest.modules {
+            let canonical_name = CanonicalName::try_from(bundled.name.as_str())?;
+            let fqn = FullyQualifiedNameBuf::new_builtin(canonical_name);
+            if !self.memory.admit_load(bundled.artifact_size as usize) {
+                return Err(Error::OutOfMemory);
+            }
+            // Safety: artifacts are trusted as much as the operator who
+            // deploys the bundle. Wasmtime still checks that they were
+            // produced by a compatible version and configuration.
+            let module =
+                unsafe { Module::deserialize_file(&self.engine, dir.join(&bundled.artifact)) }
+                    .map_err(Error::Wasm)?;
+            // write_bundle refuses modules that define a shared memory, but
+            // the artifact might not come from there
+            if !threads::follows_shared_memory_rules(&module) {
+                return Err(Error::SharedMemory);
+            }
+            if module.resources_required().num_memories > 1 {
+                return Err(Error::TooManyMemories);
+            }
+            modules.push((fqn, module));
+        }
+        let mut names = Vec::with_capacity(modules.len());
+        for (fqn, module) in modules {
+            names.push(fqn.to_string());
+            self.add_module(fqn, module, None).await?;
+        }
+        info!(?names, "loaded bundle");
+        Ok(names)
+    }
+
     #[tracing::instrument(skip(self))]
     pub async fn load_module_from_url(&self, url: &str) -> Result<String> {
         let url: url::Url = url.parse().map_err(|_| InvalidUrl::ParseError)?;
@@ -337,31 +1378,20 @@ impl Service {
         Ok(key.to_string())
     }
 
+    /// Fetch and compile a web module, then add it. Its registry entry is
+    /// only locked to swap it in, see `add_module`.
     #[tracing::instrument(skip(self))]
     async fn load_web_module(
         &self,
         fqn: FullyQualifiedNameBuf,
-        webmodule: ResolvedModule,
-    ) -> Result<()> {
-        let mut entry = self.registry.lock_entry_mut(fqn.clone()).await;
-        self.load_web_module_with_lock(&mut entry, &fqn, webmodule)
-            .await
-    }
-
-    async fn load_web_module_with_lock<'a>(
-        &'a self,
-        entry: &'a mut Option<ResolvedModule>,
-        fqn: &FullyQualifiedName,
         mut webmodule: ResolvedModule,
     ) -> Result<()> {
         webmodule.ensure_content().await?;
         let bytes = webmodule
             .content()
             .expect("loaded module should already have content");
-        let wasm_module = Module::new(&self.engine, bytes).map_err(Error::Wasm)?;
-        self.add_module(fqn.to_owned(), wasm_module).await;
-        *entry = Some(webmodule);
-        Ok(())
+        let wasm_module = self.compile(&fqn.to_string(), bytes)?;
+        self.add_module(fqn, wasm_module, Some(webmodule)).await
     }
 
     fn fqn_for_module(&self, webmodule: &ResolvedModule) -> String {
@@ -380,56 +1410,491 @@ impl Service {
         }
     }
 
-    #[tracing::instrument(skip(self))]
     pub async fn run_module(
         &self,
         module_name: &str,
         entry_point: &str,
         args: &str,
     ) -> Result<String> {
-        // If module is being reloaded, wait until new code is available
+        self.run_module_with_stats(module_name, entry_point, args)
+            .await
+            .map(|(output, _)| output)
+    }
+
+    /// Like `run_module_with_stats`, but write the output into a buffer
+    /// owned by the caller (replacing its content). The buffer is swapped
+    /// with the one the guest wrote to, and the old one is recycled, so a
+    /// caller that reuses its buffer does not allocate one for each call.
+    pub async fn run_module_into(
+        &self,
+        module_name: &str,
+        entry_point: &str,
+        args: &str,
+        output: &mut String,
+    ) -> Result<RunStats> {
+        let (mut result, stats) = self
+            .run_module_with_stats(module_name, entry_point, args)
+            .await?;
+        std::mem::swap(output, &mut result);
+        self.buffers.give_back(result);
+        Ok(stats)
+    }
+
+    /// Give back an output buffer, once done with it, for a later call to
+    /// write to. Callers of `run_module_into` that don't keep their buffer
+    /// should give it back instead of dropping it.
+    pub fn recycle_output(&self, output: String) {
+        self.buffers.give_back(output);
+    }
+
+    /// Like `run_module`, but also return measurements about the call.
+    #[tracing::instrument(skip(self))]
+    pub async fn run_module_with_stats(
+        &self,
+        module_name: &str,
+        entry_point: &str,
+        args: &str,
+    ) -> Result<(String, RunStats)> {
         let key = FullyQualifiedName::from_str(module_name)?;
+        let admission = self
+            .breakers
+            .admit(&key.fqn, entry_point)
+            .ok_or(Error::CircuitOpen)?;
+        let result = self.run_admitted(key, entry_point, args).await;
+        if result.is_ok() {
+            self.samples.record(&key.fqn, entry_point, args);
+        }
+        admission.finish(match &result {
+            Ok(_) => Some(Outcome::Success),
+            Err(Error::TimedOut) => Some(Outcome::Timeout),
+            Err(Error::Wasm(_)) => Some(Outcome::Failure),
+            // say nothing about the module itself
+            Err(_) => None,
+        });
+        result
+    }
+
+    async fn run_admitted(
+        &self,
+        key: &FullyQualifiedName,
+        entry_point: &str,
+        args: &str,
+    ) -> Result<(String, RunStats)> {
+        // If module is being reloaded, wait until new code is available
         self.registry.wait_entry(key).await;
-        let module = {
-            let modules = self.modules.lock().await;
-            modules.get(key).ok_or(Error::ModuleNotFound)?.clone()
+        let loaded = self.modules.lock().await.get(key).cloned();
+        let module = match loaded {
+            Some(module) => module,
+            None => self.reload_evicted(key).await?,
         };
+        module.last_used.store(self.memory.now(), Ordering::Relaxed);
+        self.run_loaded(key, &module, entry_point, args, false)
+            .await
+    }
 
-        let runtime_data = RuntimeData::new(args.to_string(), 512);
+    /// Run an entry point of a version of a module. Replays don't use the
+    /// cache and are left out of the profiles and statistics of the module.
+    async fn run_loaded(
+        &self,
+        key: &FullyQualifiedName,
+        module: &LoadedModule,
+        entry_point: &str,
+        args: &str,
+        replay: bool,
+    ) -> Result<(String, RunStats)> {
+        let mut message = self.buffers.take();
+        message.push_str(args);
+        let mut runtime_data = RuntimeData::new(
+            message,
+            self.buffers.take(),
+            OUTPUT_CAPACITY,
+            self.blobs.clone(),
+            self.regexes.scope(&key.fqn),
+            ExecutionSlot::new(self.execution_slots.clone()),
+        );
+        if !replay {
+            runtime_data.cache = self.cache.as_ref().map(|cache| cache.scope(&key.fqn));
+        }
+        runtime_data.stop_when_full = self.stoppable.read().contains(&*key.fqn);
+        runtime_data.limits.gauge = Some((self.memory.guests(), 0));
         let mut store = Store::new(&self.engine, runtime_data);
         store.limiter(|state| &mut state.limits);
-        store.epoch_deadline_async_yield_and_update(1);
+        store.data_mut().execution_slot.acquire().await;
+
+        let budget = self.budget(&key.fqn, entry_point);
+        let instantiate_start = Instant::now();
+        store.data_mut().threads =
+            self.threads_for(key, module, instantiate_start + budget.wall)?;
+        let profile = self.profiler.as_ref().filter(|_| !replay).map(|profiler| {
+            (
+                profiler.module_profile(&key.fqn),
+                profiler.sample_interval(),
+            )
+        });
+        let mut ticks = 0u64;
+        store.epoch_deadline_callback(move |store| {
+            ticks += 1;
+            if let Some((profile, interval)) = &profile {
+                if ticks % interval == 0 {
+                    profile.sample(&WasmBacktrace::capture(&store));
+                }
+            }
+            // a guest that was waiting to be polled when the epoch changed
+            // also gets a tick, so this can overestimate under contention
+            let wall = instantiate_start.elapsed();
+            let running = wall.saturating_sub(store.data().execution_slot.suspended);
+            let cpu = (EPOCH_INTERVAL * ticks as u32).min(running);
+            budget.check(wall, cpu)?;
+            Ok(UpdateDeadline::Yield(1))
+        });
+
+        let interrupted = |overrun: Overrun| {
+            warn!(module = %key, entry_point, %overrun, replay, "module interrupted");
+            if !replay {
+                self.budgets.record(&key.fqn, entry_point, overrun);
+            }
+            Error::TimedOut
+        };
+        let wall_overrun = || Overrun {
+            limit: Limit::Wall,
+            by: instantiate_start.elapsed().saturating_sub(budget.wall),
+        };
 
-        let instance = self
-            .linker
-            .instantiate_async(&mut store, &module)
-            .await
-            .map_err(Error::Wasm)?;
+        // the wall budget includes instantiation, and start functions (of the
+        // module or of its libraries) can loop too
+        let _timer = self.epoch_timer.start();
+        let warm = module.warm.get();
+        let instantiating = async {
+            match warm.and_then(|warm| warm.pre.as_ref()) {
+                Some(pre) => pre.instantiate_async(&mut store).await.map_err(Error::Wasm),
+                None => self.instantiate(&mut store, module).await,
+            }
+        };
+        let instance = match tokio::time::timeout(budget.wall, instantiating).await {
+            Ok(Ok(instance)) => instance,
+            Ok(Err(Error::Wasm(err))) => match err.downcast_ref::<Overrun>() {
+                Some(overrun) => return Err(interrupted(*overrun)),
+                None => return Err(Error::Wasm(err)),
+            },
+            Ok(Err(err)) => return Err(err),
+            Err(_) => return Err(interrupted(wall_overrun())),
+        };
+        let cold = warm.is_none();
+        if cold {
+            self.warmed(module, store.data().limits.peak_memory);
+        }
+        if !replay {
+            self.warm_counters.record(cold);
+        }
 
         let func = instance
             .get_func(&mut store, entry_point)
             .ok_or(Error::FunctionNotFound)?;
-        let tyfunc = func
-            .typed::<(), ()>(&mut store)
-            .map_err(|_| Error::WrongFunctionType)?;
+        let entry = EntryPoint::new(func, &store)?;
+        let instantiate = instantiate_start.elapsed();
+
+        // the deadline callback only runs while the guest is executing, this
+        // catches guests that are still waiting in a host import
+        let remaining = budget.wall.saturating_sub(instantiate_start.elapsed());
+        let execute_start = Instant::now();
+        let fut = entry.call(&mut store);
+        let mut stopped = false;
+        let (returned, overrun) = match tokio::time::timeout(remaining, fut).await {
+            Ok(Ok(returned)) => (returned, None),
+            Ok(Err(err)) => match err.downcast_ref::<Overrun>() {
+                Some(overrun) => (None, Some(*overrun)),
+                None if err.is::<OutputFull>() => {
+                    stopped = true;
+                    (None, None)
+                }
+                None => return Err(Error::Wasm(err)),
+            },
+            Err(_) => (None, Some(wall_overrun())),
+        };
+        if let Some(overrun) = overrun {
+            return Err(interrupted(overrun));
+        }
+        if let Some((ptr, len)) = returned {
+            let memory = instance
+                .get_memory(&mut store, "memory")
+                .ok_or(Error::MemoryNotExported)?;
+            let (memory, runtime_data) = memory.data_and_store_mut(&mut store);
+            let range = rt::guest_range(memory, ptr, len).map_err(|_| Error::InvalidPointer)?;
+            let text =
+                std::str::from_utf8(&memory[range]).map_err(|err| Error::Wasm(err.into()))?;
+            runtime_data.output(text);
+        }
+        let execute = execute_start.elapsed();
+
+        let runtime_data = store.into_data();
+        self.buffers.give_back(runtime_data.message);
+        let stats = RunStats {
+            instantiate,
+            execute,
+            peak_memory: runtime_data.limits.peak_memory,
+            host_calls: runtime_data.host_calls,
+            suspended: runtime_data.execution_slot.suspended,
+            cold,
+            stopped,
+        };
+        Ok((runtime_data.output, stats))
+    }
+}
 
-        let _timer = self.epoch_timer.start();
-        let duration = std::time::Duration::from_millis(5000);
-        let fut = tyfunc.call_async(&mut store, ());
-        match tokio::time::timeout(duration, fut).await {
-            Ok(Ok(())) => {}
-            Ok(Err(err)) => {
-                return Err(Error::Wasm(err));
-            }
-            Err(_) => {
-                return Err(Error::TimedOut);
+/// Run tasks of a `parallel` call on a new instance of a threaded module,
+/// until there are none left.
+async fn run_worker(
+    engine: Engine,
+    linker: Arc<Linker<RuntimeData>>,
+    module: Module,
+    memory: SharedMemory,
+    runtime_data: RuntimeData,
+    deadline: Instant,
+    tasks: Arc<Tasks>,
+) -> WResult<()> {
+    let mut store = Store::new(&engine, runtime_data);
+    store.limiter(|state| &mut state.limits);
+    store.epoch_deadline_callback(move |_| {
+        // reported like an overrun of the caller, which it is: the call to
+        // `parallel` traps with it, and the caller times out
+        let by = Instant::now().saturating_duration_since(deadline);
+        if !by.is_zero() {
+            return Err(Overrun {
+                limit: Limit::Wall,
+                by,
             }
+            .into());
+        }
+        Ok(UpdateDeadline::Yield(1))
+    });
+    // workers cannot use libraries
+    let mut imports = Vec::with_capacity(module.imports().len());
+    for import in module.imports() {
+        let export = if threads::is_shared_memory(&import) {
+            Some(memory.clone().into())
+        } else {
+            linker.get_by_import(&mut store, &import)
+        };
+        imports.push(export.ok_or_else(|| {
+            anyhow::anyhow!("unknown import: `{}::{}`", import.module(), import.name())
+        })?);
+    }
+    let instance = Instance::new_async(&mut store, &module, &imports).await?;
+    let function = instance.get_typed_func::<u32, ()>(&mut store, &tasks.function)?;
+    while let Some(task) = tasks.next() {
+        function.call_async(&mut store, task).await?;
+    }
+    Ok(())
+}
+
+/// Entry points take no arguments. They either write their output through
+/// `wotto.output`, or return the address and length of their output in
+/// linear memory, which saves the host calls (and is appended to anything
+/// they wrote through `wotto.output`).
+enum EntryPoint {
+    Plain(TypedFunc<(), ()>),
+    Returning(TypedFunc<(), (u32, u32)>),
+}
+
+impl EntryPoint {
+    fn new(func: Func, store: &Store<RuntimeData>) -> Result<Self> {
+        if let Ok(func) = func.typed(store) {
+            return Ok(Self::Plain(func));
+        }
+        func.typed(store)
+            .map(Self::Returning)
+            .map_err(|_| Error::WrongFunctionType)
+    }
+
+    /// Returns the output returned by the guest, if it returns one.
+    async fn call(&self, store: &mut Store<RuntimeData>) -> WResult<Option<(u32, u32)>> {
+        match self {
+            Self::Plain(func) => func.call_async(store, ()).await.map(|()| None),
+            Self::Returning(func) => func.call_async(store, ()).await.map(Some),
+        }
+    }
+}
+
+/// Measurements taken during a single `run_module` call.
+#[derive(Debug, Clone, Default)]
+pub struct RunStats {
+    /// Time spent instantiating the module and looking up the entry point.
+    pub instantiate: Duration,
+    /// Time spent running the entry point.
+    pub execute: Duration,
+    /// Largest size reached by the guest linear memory, in bytes.
+    pub peak_memory: usize,
+    /// Calls from the guest into `wotto.input` and `wotto.output`.
+    pub host_calls: HostCallStats,
+    /// Time spent waiting in async host imports, included in `execute`.
+    pub suspended: Duration,
+    /// Whether this was the first call of the module since it was loaded,
+    /// and it had not been prewarmed.
+    pub cold: bool,
+    /// Whether the guest was stopped early because its output was full.
+    pub stopped: bool,
+}
+
+/// Counters for the calls a guest makes into the host functions that move
+/// data in and out of its memory.
+#[derive(Debug, Clone, Default)]
+pub struct HostCallStats {
+    pub calls: u32,
+    /// Time spent inside the host functions, included in `RunStats::execute`.
+    pub time: Duration,
+    /// Bytes copied from the host into guest memory.
+    pub bytes_in: usize,
+    /// Bytes copied from guest memory to the host.
+    pub bytes_out: usize,
+}
+
+impl HostCallStats {
+    pub(crate) fn record(&mut self, start: Instant, bytes_in: usize, bytes_out: usize) {
+        self.calls += 1;
+        self.time += start.elapsed();
+        self.bytes_in += bytes_in;
+        self.bytes_out += bytes_out;
+    }
+}
+
+/// A module loaded in the service.
+#[derive(Clone)]
+struct LoadedModule {
+    module: Module,
+    /// Set after the first instantiation. Replacing the module replaces the
+    /// whole `LoadedModule`, so it never refers to old code.
+    warm: Arc<OnceLock<Warm>>,
+    /// When the module was last called, as `Governor::now`.
+    last_used: Arc<AtomicU64>,
+    /// Whether it comes from a web module, which can be loaded again from
+    /// its registry entry.
+    web: bool,
+}
+
+impl LoadedModule {
+    fn new(module: Module, now: u64) -> Self {
+        Self {
+            module,
+            warm: Arc::default(),
+            last_used: Arc::new(AtomicU64::new(now)),
+            web: false,
+        }
+    }
+
+    /// Tells versions of a module apart. Clones share it.
+    fn id(&self) -> *const OnceLock<Warm> {
+        Arc::as_ptr(&self.warm)
+    }
+}
+
+impl Deref for LoadedModule {
+    type Target = Module;
+
+    fn deref(&self) -> &Module {
+        &self.module
+    }
+}
+
+/// A module that has been instantiated at least once: its code is paged in
+/// and its imports are resolved.
+struct Warm {
+    /// `None` for modules that import from libraries.
+    pre: Option<InstancePre<RuntimeData>>,
+    /// Estimated memory kept resident by the module: its code and its
+    /// initial linear memory.
+    cost: usize,
+}
+
+fn code_size(module: &Module) -> usize {
+    let image = module.image_range();
+    image.end as usize - image.start as usize
+}
+
+/// Largest output of a call, in bytes.
+const OUTPUT_CAPACITY: usize = 512;
+
+/// How many times each recorded call is run on each version of a module
+/// when it is reloaded. The fastest run is kept.
+const REPLAY_RUNS: usize = 3;
+
+/// How long prewarming a module can take, in case its start function does
+/// not return.
+const PREWARM_TIMEOUT: Duration = Duration::from_secs(1);
+
+/// Module name under which command modules import from libraries.
+const LIBRARY_NAMESPACE: &str = "lib:";
+
+struct Library {
+    module: Module,
+    /// Starts at 1 and is incremented every time the library is replaced.
+    generation: u64,
+}
+
+#[derive(Debug, Clone)]
+pub struct LibraryInfo {
+    pub name: String,
+    pub generation: u64,
+    /// Modules that import from the library.
+    pub dependents: Vec<String>,
+}
+
+/// Names of the libraries imported by a module (possibly repeated).
+fn library_names(module: &Module) -> impl Iterator<Item = &str> {
+    module
+        .imports()
+        .filter_map(|import| import.module().strip_prefix(LIBRARY_NAMESPACE))
+}
+
+/// Check that `library` provides everything `module` imports from the library
+/// called `name`, with compatible types.
+fn check_library_imports(
+    module: &Module,
+    name: &str,
+    library: &Module,
+) -> std::result::Result<(), String> {
+    for import in module.imports() {
+        if import.module().strip_prefix(LIBRARY_NAMESPACE) != Some(name) {
+            continue;
         }
+        let Some(export) = library.get_export(import.name()) else { return Err(format!("`{}` is not exported", import.name())); };
+        if !extern_type_matches(&import.ty(), &export) {
+            return Err(format!("`{}` has an incompatible type", import.name()));
+        }
+    }
+    Ok(())
+}
 
-        Ok(store.into_data().output)
+fn extern_type_matches(import: &ExternType, export: &ExternType) -> bool {
+    match (import, export) {
+        (ExternType::Func(import), ExternType::Func(export)) => import == export,
+        (ExternType::Global(import), ExternType::Global(export)) => {
+            import.content() == export.content() && import.mutability() == export.mutability()
+        }
+        (ExternType::Memory(import), ExternType::Memory(export)) => {
+            import.is_64() == export.is_64()
+                && import.is_shared() == export.is_shared()
+                && export.minimum() >= import.minimum()
+                && match import.maximum() {
+                    None => true,
+                    Some(max) => export.maximum().map_or(false, |export| export <= max),
+                }
+        }
+        (ExternType::Table(import), ExternType::Table(export)) => {
+            import.element() == export.element() && export.minimum() >= import.minimum()
+        }
+        _ => false,
     }
 }
 
+/// Path of a module in the local modules directory, with some quick and
+/// dirty validation of the name.
+fn local_module_path(name: &str) -> Result<PathBuf> {
+    const MODULES_PATH: &str = "examples";
+    let name_as_path = PathBuf::from_str(name).map_err(|_| Error::InvalidModuleName)?;
+    let file_name = name_as_path.file_name().ok_or(Error::InvalidModuleName)?;
+    Ok(Path::new(MODULES_PATH).join(file_name))
+}
+
 impl Default for Service {
     fn default() -> Self {
         Self::new()
@@ -446,31 +1911,156 @@ struct RuntimeData {
     message: String,
     output: String,
     capacity: usize,
-    limits: StoreLimits,
+    /// Set when some output did not fit.
+    output_full: bool,
+    stop_when_full: bool,
+    limits: Limits,
+    host_calls: HostCallStats,
+    cache: Option<CacheScope>,
+    blobs: BlobHandles,
+    regexes: RegexHandles,
+    execution_slot: ExecutionSlot,
+    /// Set for calls to threaded modules.
+    threads: Option<Threads>,
 }
 
 impl RuntimeData {
-    fn new(message: String, output_capacity: usize) -> Self {
-        let output = String::with_capacity(output_capacity);
-        let limits = StoreLimitsBuilder::new()
-            .memory_size(1 << 20)
-            .table_elements(10 << 10)
-            .build();
+    /// `output` is an empty buffer to reuse for the output, which is limited
+    /// to `output_capacity` bytes.
+    fn new(
+        message: String,
+        output: String,
+        output_capacity: usize,
+        blobs: Arc<BlobRegistry>,
+        regexes: Arc<PatternCache>,
+        execution_slot: ExecutionSlot,
+    ) -> Self {
+        let limits = Limits::new(
+            StoreLimitsBuilder::new()
+                .memory_size(1 << 20)
+                .table_elements(10 << 10)
+                .build(),
+        );
         Self {
             message,
             output,
             capacity: output_capacity,
+            output_full: false,
+            stop_when_full: false,
             limits,
+            host_calls: HostCallStats::default(),
+            cache: None,
+            blobs: BlobHandles::new(blobs),
+            regexes: RegexHandles::new(regexes),
+            execution_slot,
+            threads: None,
+        }
+    }
+}
+
+/// `StoreLimits` that also keep track of the peak memory usage.
+struct Limits {
+    inner: StoreLimits,
+    /// Linear memory of all the memories of the store (the module and the
+    /// libraries it imports), and the most it reached.
+    memory: usize,
+    peak_memory: usize,
+    /// Gauge of the memory of running guests, if the store counts towards
+    /// it, and what the store added to it.
+    gauge: Option<(Arc<AtomicUsize>, usize)>,
+}
+
+impl Limits {
+    fn new(inner: StoreLimits) -> Self {
+        Self {
+            inner,
+            memory: 0,
+            peak_memory: 0,
+            gauge: None,
+        }
+    }
+}
+
+impl Drop for Limits {
+    fn drop(&mut self) {
+        if let Some((gauge, counted)) = &self.gauge {
+            gauge.fetch_sub(*counted, Ordering::Relaxed);
         }
     }
 }
 
+impl ResourceLimiter for Limits {
+    fn memory_growing(
+        &mut self,
+        current: usize,
+        desired: usize,
+        maximum: Option<usize>,
+    ) -> WResult<bool> {
+        let allowed = self.inner.memory_growing(current, desired, maximum)?;
+        if allowed {
+            let grown = desired.saturating_sub(current);
+            self.memory += grown;
+            self.peak_memory = self.peak_memory.max(self.memory);
+            if let Some((gauge, counted)) = &mut self.gauge {
+                gauge.fetch_add(grown, Ordering::Relaxed);
+                *counted += grown;
+            }
+        }
+        Ok(allowed)
+    }
+
+    fn table_growing(&mut self, current: u32, desired: u32, maximum: Option<u32>) -> WResult<bool> {
+        self.inner.table_growing(current, desired, maximum)
+    }
+
+    fn instances(&self) -> usize {
+        self.inner.instances()
+    }
+
+    fn tables(&self) -> usize {
+        self.inner.tables()
+    }
+
+    fn memories(&self) -> usize {
+        self.inner.memories()
+    }
+}
+
 pub(crate) trait HasInput {
     fn input(&self) -> &str;
 }
 
 pub(crate) trait HasOutput {
     fn output(&mut self, text: &str);
+    /// Bytes that can still be written before the output is truncated; 0
+    /// once anything was truncated.
+    fn output_remaining(&self) -> usize;
+    /// Whether the guest should be stopped once its output is full.
+    fn stop_when_full(&self) -> bool;
+}
+
+pub(crate) trait HasHostCalls {
+    fn host_calls(&mut self) -> &mut HostCallStats;
+}
+
+pub(crate) trait HasCache {
+    fn cache(&self) -> Option<&CacheScope>;
+}
+
+pub(crate) trait HasBlobs {
+    fn blobs(&mut self) -> &mut BlobHandles;
+}
+
+pub(crate) trait HasRegexes {
+    fn regexes(&mut self) -> &mut RegexHandles;
+}
+
+pub(crate) trait HasThreads {
+    fn threads(&self) -> Option<&Threads>;
+}
+
+pub(crate) trait HasExecutionSlot {
+    fn execution_slot(&mut self) -> &mut ExecutionSlot;
 }
 
 impl HasInput for RuntimeData {
@@ -481,8 +2071,63 @@ impl HasInput for RuntimeData {
 
 impl HasOutput for RuntimeData {
     fn output(&mut self, text: &str) {
-        let Some(available) = self.capacity.checked_sub(self.output.len()) else { return; };
-        self.output += &text[..available.min(text.len())];
+        let available = self.output_remaining();
+        let mut end = available.min(text.len());
+        // don't cut a codepoint in half
+        while !text.is_char_boundary(end) {
+            end -= 1;
+        }
+        self.output += &text[..end];
+        if end < text.len() {
+            self.output_full = true;
+        }
+    }
+
+    fn output_remaining(&self) -> usize {
+        match self.output_full {
+            true => 0,
+            false => self.capacity.saturating_sub(self.output.len()),
+        }
+    }
+
+    fn stop_when_full(&self) -> bool {
+        self.stop_when_full
+    }
+}
+
+impl HasHostCalls for RuntimeData {
+    fn host_calls(&mut self) -> &mut HostCallStats {
+        &mut self.host_calls
+    }
+}
+
+impl HasCache for RuntimeData {
+    fn cache(&self) -> Option<&CacheScope> {
+        self.cache.as_ref()
+    }
+}
+
+impl HasBlobs for RuntimeData {
+    fn blobs(&mut self) -> &mut BlobHandles {
+        &mut self.blobs
+    }
+}
+
+impl HasRegexes for RuntimeData {
+    fn regexes(&mut self) -> &mut RegexHandles {
+        &mut self.regexes
+    }
+}
+
+impl HasThreads for RuntimeData {
+    fn threads(&self) -> Option<&Threads> {
+        self.threads.as_ref()
+    }
+}
+
+impl HasExecutionSlot for RuntimeData {
+    fn execution_slot(&mut self) -> &mut ExecutionSlot {
+        &mut self.execution_slot
     }
 }
 
@@ -556,3 +2201,198 @@ mod utils {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[tokio::test]
+    async fn text_modules_import_shared_memory() {
+        let service = Service::new();
+        let imports = r#"(module (import "wotto" "shared" (memory 1 16 shared)))"#;
+        service
+            .load_module_from_bytes("imports", imports.as_bytes())
+            .await
+            .unwrap();
+        let mentions = r#"(module (memory 1) (data (i32.const 0) "shared"))"#;
+        service
+            .load_module_from_bytes("mentions", mentions.as_bytes())
+            .await
+            .unwrap();
+        let defines = "(module (memory 1 16 shared))";
+        let result = service
+            .load_module_from_bytes("defines", defines.as_bytes())
+            .await;
+        assert!(matches!(result, Err(Error::SharedMemory)));
+    }
+
+    #[tokio::test]
+    async fn one_memory_per_module() {
+        let service = Service::new();
+        let two = "(module (memory 1) (memory 1))";
+        let result = service.load_module_from_bytes("two", two.as_bytes()).await;
+        assert!(matches!(result, Err(Error::TooManyMemories)));
+    }
+
+    #[tokio::test]
+    async fn start_functions_count_against_the_budget() {
+        let service = Service::new();
+        let spins = r#"(module (func $spin (loop (br 0))) (start $spin) (func (export "run")))"#;
+        service
+            .load_module_from_bytes("spins", spins.as_bytes())
+            .await
+            .unwrap();
+        let budget = Budget {
+            wall: Duration::from_millis(200),
+            cpu: Duration::from_millis(100),
+        };
+        service.set_budget("spins", None, budget);
+        let result = tokio::time::timeout(
+            Duration::from_secs(5),
+            service.run_module("spins", "run", ""),
+        )
+        .await
+        .expect("the call should be interrupted");
+        assert!(matches!(result, Err(Error::TimedOut)));
+        assert_eq!(service.overruns().len(), 1);
+    }
+
+    #[tokio::test]
+    async fn evicted_web_modules_are_loaded_again() {
+        let mut service = Service::new();
+        service.set_memory_limits(MemoryLimits {
+            soft: 0,
+            hard: usize::MAX,
+            idle: Duration::ZERO,
+        });
+        let foo = include_str!("../benches/fixtures/foo.wat");
+        service
+            .load_module_from_bytes("foo", foo.as_bytes())
+            .await
+            .unwrap();
+        let webmodule = ResolvedModule::fetched(
+            "https://gist.github.com/someone/0123abcd/raw/4567cdef/echo.wat",
+            foo.as_bytes().to_vec(),
+        );
+        let name = service.fqn_for_module(&webmodule);
+        let key = FullyQualifiedName::from_str(&name).unwrap();
+        service
+            .load_web_module(key.to_owned(), webmodule)
+            .await
+            .unwrap();
+
+        assert!(service.evict_idle_modules(usize::MAX).await > 0);
+        {
+            let modules = service.modules.lock().await;
+            assert!(modules.get(key).is_none());
+            // modules that cannot be loaded again are kept
+            assert!(modules
+                .get(FullyQualifiedName::from_str("foo").unwrap())
+                .is_some());
+        }
+        assert_eq!(
+            service.run_module(&name, "echo", "hello").await.unwrap(),
+            "hello"
+        );
+        assert!(service.modules.lock().await.get(key).unwrap().web);
+    }
+
+    #[tokio::test]
+    async fn new_versions_close_the_breakers() {
+        let mut service = Service::new();
+        service.set_breaker_config(BreakerConfig {
+            window: 4,
+            max_failures: 2,
+            max_timeouts: 2,
+            cooldown: Duration::from_secs(60),
+        });
+        let broken = r#"(module (func (export "run") unreachable))"#;
+        service
+            .load_module_from_bytes("flaky", broken.as_bytes())
+            .await
+            .unwrap();
+        for _ in 0..2 {
+            let result = service.run_module("flaky", "run", "").await;
+            assert!(matches!(result, Err(Error::Wasm(_))));
+        }
+        let result = service.run_module("flaky", "run", "").await;
+        assert!(matches!(result, Err(Error::CircuitOpen)));
+
+        let fixed = r#"(module (func (export "run")))"#;
+        service
+            .load_module_from_bytes("flaky", fixed.as_bytes())
+            .await
+            .unwrap();
+        assert_eq!(service.run_module("flaky", "run", "").await.unwrap(), "");
+        assert_eq!(service.breakers()[0].failures, 0);
+    }
+
+    /// A call with no bookkeeping around it: only what wasmtime allocates to
+    /// set up a store and instantiate the module.
+    async fn bare_call(service: &Service, module: &LoadedModule, entry_point: &str, args: &str) {
+        let mut message = service.buffers.take();
+        message.push_str(args);
+        let runtime_data = RuntimeData::new(
+            message,
+            service.buffers.take(),
+            OUTPUT_CAPACITY,
+            service.blobs.clone(),
+            service.regexes.scope("foo"),
+            ExecutionSlot::new(None),
+        );
+        let mut store = Store::new(&service.engine, runtime_data);
+        store.limiter(|state| &mut state.limits);
+        // captures something, like the real callback, so that it is boxed
+        let mut ticks = 0u64;
+        store.epoch_deadline_callback(move |_| {
+            ticks += 1;
+            Ok(UpdateDeadline::Yield(1))
+        });
+        let pre = module.warm.get().unwrap().pre.as_ref().unwrap();
+        let instance = pre.instantiate_async(&mut store).await.unwrap();
+        let func = instance
+            .get_typed_func::<(), ()>(&mut store, entry_point)
+            .unwrap();
+        func.call_async(&mut store, ()).await.unwrap();
+        let runtime_data = store.into_data();
+        service.buffers.give_back(runtime_data.message);
+        service.buffers.give_back(runtime_data.output);
+    }
+
+    #[test]
+    fn warm_calls_only_allocate_the_store() {
+        use crate::buffers::counting::allocations;
+
+        let rt = tokio::runtime::Builder::new_current_thread()
+            .enable_all()
+            .build()
+            .unwrap();
+        let service = Service::new();
+        let foo = include_str!("../benches/fixtures/foo.wat");
+        rt.block_on(service.load_module_from_bytes("foo", foo.as_bytes()))
+            .unwrap();
+        let mut output = String::new();
+        for _ in 0..2 {
+            rt.block_on(service.run_module_into("foo", "echo", "hello", &mut output))
+                .unwrap();
+        }
+        assert_eq!(output, "hello");
+        let module = rt
+            .block_on(service.modules.lock())
+            .get(FullyQualifiedName::from_str("foo").unwrap())
+            .unwrap()
+            .clone();
+        rt.block_on(bare_call(&service, &module, "echo", "hello"));
+
+        let store = allocations(|| rt.block_on(bare_call(&service, &module, "echo", "hello")));
+        let call = allocations(|| {
+            rt.block_on(service.run_module_into("foo", "echo", "hello", &mut output))
+                .unwrap()
+        });
+        assert!(
+            call <= store,
+            "{call} allocations, {store} for the store alone"
+        );
+        assert_eq!(output, "hello");
+    }
+}
@@ -0,0 +1,216 @@
+//! Stripping custom sections from modules before they are compiled.
+//!
+//! Modules built with debug information carry DWARF sections that are often
+//! much larger than their code, and are validated, compiled and kept in
+//! memory along with it. Custom sections are dropped according to a policy,
+//! always keeping the `name` section, which is all that backtraces and the
+//! profiler need to show function names.
+
+use std::borrow::Cow;
+use std::time::Duration;
+
+const MAGIC: &[u8] = b"\0asm";
+const HEADER_LEN: usize = 8;
+const CUSTOM_SECTION: u8 = 0;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum CustomSections {
+    /// Keep every section.
+    #[default]
+    Keep,
+    /// Strip DWARF and other sections only used by tools (`producers`,
+    /// source maps), losing line numbers in backtraces.
+    StripDebug,
+    /// Strip every custom section except `name`.
+    Strip,
+}
+
+impl CustomSections {
+    fn strips(self, name: &str) -> bool {
+        match self {
+            Self::Keep => false,
+            Self::StripDebug => {
+                name.starts_with(".debug_")
+                    || matches!(
+                        name,
+                        "producers" | "sourceMappingURL" | "external_debug_info"
+                    )
+            }
+            Self::Strip => name != "name",
+        }
+    }
+}
+
+/// What happened to a module when it was last compiled.
+#[derive(Debug, Clone, Default)]
+pub struct SlimReport {
+    pub original_size: usize,
+    pub size: usize,
+    /// Custom sections that were stripped, with their size in bytes.
+    pub stripped: Vec<(String, usize)>,
+    /// Time it took to compile what was left.
+    pub compile_time: Duration,
+}
+
+pub(crate) fn read_u32(bytes: &[u8], pos: &mut usize) -> Option<u32> {
+    let mut value = 0u32;
+    for shift in (0..35).step_by(7) {
+        let byte = *bytes.get(*pos)?;
+        *pos += 1;
+        value |= u32::from(byte & 0x7f).checked_shl(shift)?;
+        if byte & 0x80 == 0 {
+            return Some(value);
+        }
+    }
+    None
+}
+
+pub(crate) struct Section<'a> {
+    pub(crate) id: u8,
+    /// Name of custom sections.
+    pub(crate) name: Option<&'a str>,
+    /// The whole section, header included.
+    pub(crate) bytes: &'a [u8],
+    pub(crate) payload: &'a [u8],
+}
+
+/// Sections of a binary module, or `None` if it is malformed.
+pub(crate) fn sections(bytes: &[u8]) -> Option<Vec<Section<'_>>> {
+    let mut sections = vec![];
+    let mut pos = HEADER_LEN;
+    while pos < bytes.len() {
+        let start = pos;
+        let id = bytes[pos];
+        pos += 1;
+        let size = read_u32(bytes, &mut pos)? as usize;
+        let end = pos.checked_add(size).filter(|&end| end <= bytes.len())?;
+        let payload = &bytes[pos..end];
+        let name = if id == CUSTOM_SECTION {
+            let mut name_pos = 0;
+            let len = read_u32(payload, &mut name_pos)? as usize;
+            let name = payload.get(name_pos..name_pos.checked_add(len)?)?;
+            Some(std::str::from_utf8(name).ok()?)
+        } else {
+            None
+        };
+        sections.push(Section {
+            id,
+            name,
+            bytes: &bytes[start..end],
+            payload,
+        });
+        pos = end;
+    }
+    Some(sections)
+}
+
+/// Strip the custom sections of a module according to `policy`. Returns the
+/// module, and the stripped sections with their size. Modules in text
+/// format and malformed ones are returned as they are, and left for the
+/// compiler to deal with.
+pub(crate) fn slim(bytes: &[u8], policy: CustomSections) -> (Cow<'_, [u8]>, Vec<(String, usize)>) {
+    if policy == CustomSections::Keep || !bytes.starts_with(MAGIC) || bytes.len() < HEADER_LEN {
+        return (Cow::Borrowed(bytes), vec![]);
+    }
+    let Some(sections) = sections(bytes) else { return (Cow::Borrowed(bytes), vec![]); };
+    let stripped: Vec<_> = sections
+        .iter()
+        .filter_map(|section| Some((section.name?, section.bytes.len())))
+        .filter(|(name, _)| policy.strips(name))
+        .map(|(name, len)| (name.to_string(), len))
+        .collect();
+    if stripped.is_empty() {
+        return (Cow::Borrowed(bytes), vec![]);
+    }
+    let mut slimmed = Vec::with_capacity(bytes.len());
+    slimmed.extend_from_slice(&bytes[..HEADER_LEN]);
+    for section in sections {
+        if !section.name.map_or(false, |name| policy.strips(name)) {
+            slimmed.extend_from_slice(section.bytes);
+        }
+    }
+    (Cow::Owned(slimmed), stripped)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn custom(name: &str, payload_len: usize) -> Vec<u8> {
+        let mut payload = vec![name.len() as u8];
+        payload.extend_from_slice(name.as_bytes());
+        payload.resize(payload.len() + payload_len, 0xaa);
+        // two-byte LEB128 size, to exercise the decoder
+        let size = payload.len();
+        let mut section = vec![
+            CUSTOM_SECTION,
+            (size & 0x7f) as u8 | 0x80,
+            (size >> 7) as u8,
+        ];
+        section.extend(payload);
+        section
+    }
+
+    fn module() -> Vec<u8> {
+        let mut bytes = b"\0asm\x01\0\0\0".to_vec();
+        // empty type section
+        bytes.extend_from_slice(&[1, 1, 0]);
+        bytes.extend(custom("name", 10));
+        bytes.extend(custom(".debug_info", 300));
+        bytes.extend(custom("producers", 20));
+        bytes.extend(custom("other", 5));
+        bytes
+    }
+
+    fn names(bytes: &[u8]) -> Vec<String> {
+        sections(bytes)
+            .unwrap()
+            .into_iter()
+            .filter_map(|section| section.name.map(str::to_string))
+            .collect()
+    }
+
+    #[test]
+    fn keep() {
+        let bytes = module();
+        let (slimmed, stripped) = slim(&bytes, CustomSections::Keep);
+        assert!(matches!(slimmed, Cow::Borrowed(_)));
+        assert!(stripped.is_empty());
+    }
+
+    #[test]
+    fn strip_debug() {
+        let bytes = module();
+        let (slimmed, stripped) = slim(&bytes, CustomSections::StripDebug);
+        assert_eq!(names(&slimmed), ["name", "other"]);
+        let stripped_names: Vec<_> = stripped.iter().map(|(name, _)| name.as_str()).collect();
+        assert_eq!(stripped_names, [".debug_info", "producers"]);
+        let stripped_size: usize = stripped.iter().map(|(_, size)| size).sum();
+        assert_eq!(slimmed.len() + stripped_size, bytes.len());
+        // the type section is still there
+        assert_eq!(&slimmed[HEADER_LEN..HEADER_LEN + 3], &[1, 1, 0]);
+    }
+
+    #[test]
+    fn strip() {
+        let bytes = module();
+        let (slimmed, stripped) = slim(&bytes, CustomSections::Strip);
+        assert_eq!(names(&slimmed), ["name"]);
+        assert_eq!(stripped.len(), 3);
+    }
+
+    #[test]
+    fn left_alone() {
+        let text = b"(module)";
+        assert!(matches!(
+            slim(text, CustomSections::Strip).0,
+            Cow::Borrowed(_)
+        ));
+        let mut truncated = module();
+        truncated.truncate(truncated.len() - 1);
+        assert!(matches!(
+            slim(&truncated, CustomSections::Strip).0,
+            Cow::Borrowed(_)
+        ));
+    }
+}
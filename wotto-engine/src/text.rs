@@ -0,0 +1,147 @@
+//! Text functions exported to WASM modules, as the `wotto.text` imports.
+//!
+//! Guests get native (and, where the libraries support it, SIMD) versions of
+//! the string handling they would otherwise implement in scalar wasm. All
+//! functions work in place on guest memory. Lengths and offsets are in bytes.
+
+use unicode_segmentation::UnicodeSegmentation;
+use wasmtime::*;
+
+use crate::runtime::guest_range;
+use crate::service::{get_memory, WResult};
+
+const MODULE: &str = "wotto.text";
+
+/// Check that a buffer is valid UTF-8.
+///
+/// ```c
+/// int utf8_validate(const u8 *buf, int len);
+/// ```
+///
+/// Returns -1 if the buffer is valid, or the offset of the first invalid
+/// byte (which includes a truncated sequence at the end).
+fn utf8_validate<T>(mut caller: Caller<'_, T>, ptr: u32, len: u32) -> WResult<i32> {
+    let memory = get_memory(&mut caller)?.data(&caller);
+    let buf = &memory[guest_range(memory, ptr, len)?];
+    Ok(match simdutf8::compat::from_utf8(buf) {
+        Ok(_) => -1,
+        Err(err) => err.valid_up_to() as i32,
+    })
+}
+
+/// Count the codepoints in a UTF-8 buffer.
+///
+/// ```c
+/// int utf8_count(const u8 *buf, int len);
+/// ```
+///
+/// Returns -1 if the buffer is not valid UTF-8.
+fn utf8_count<T>(mut caller: Caller<'_, T>, ptr: u32, len: u32) -> WResult<i32> {
+    let memory = get_memory(&mut caller)?.data(&caller);
+    let buf = &memory[guest_range(memory, ptr, len)?];
+    if simdutf8::basic::from_utf8(buf).is_err() {
+        return Ok(-1);
+    }
+    // every codepoint has exactly one byte that is not a continuation byte;
+    // written this way, the loop is vectorized
+    Ok(buf.iter().filter(|&&b| (b as i8) >= -0x40).count() as i32)
+}
+
+/// Reverse a UTF-8 buffer in place, keeping grapheme clusters intact, so
+/// that "🇮🇹" or "é" written with a combining accent survive reversal.
+///
+/// ```c
+/// int reverse_graphemes(u8 *buf, int len);
+/// ```
+///
+/// Returns 0, or -1 if the buffer is not valid UTF-8 (and was not changed).
+fn reverse_graphemes<T>(mut caller: Caller<'_, T>, ptr: u32, len: u32) -> WResult<i32> {
+    let memory = get_memory(&mut caller)?.data_mut(&mut caller);
+    let range = guest_range(memory, ptr, len)?;
+    let buf = &mut memory[range];
+    let Ok(text) = simdutf8::basic::from_utf8(buf) else { return Ok(-1); };
+    let lengths: Vec<usize> = text.graphemes(true).map(str::len).collect();
+    // reversing the whole buffer puts the clusters in the right order, but
+    // each of them backwards; then put the bytes of each cluster back
+    buf.reverse();
+    let mut start = 0;
+    for len in lengths.into_iter().rev() {
+        buf[start..start + len].reverse();
+        start += len;
+    }
+    Ok(0)
+}
+
+/// Apply Unicode default case folding to a UTF-8 buffer, writing the result
+/// to another buffer (they must not overlap). Useful for case-insensitive
+/// comparisons.
+///
+/// ```c
+/// int casefold(const u8 *src, int src_len, u8 *dst, int dst_len);
+/// ```
+///
+/// Returns the length of the folded text, which can be larger than `dst_len`
+/// (in which case it is truncated at a codepoint boundary), or -1 if `src` is
+/// not valid UTF-8 or the buffers overlap.
+fn casefold<T>(
+    mut caller: Caller<'_, T>,
+    src_ptr: u32,
+    src_len: u32,
+    dst_ptr: u32,
+    dst_len: u32,
+) -> WResult<i32> {
+    let memory = get_memory(&mut caller)?.data_mut(&mut caller);
+    let src_range = guest_range(memory, src_ptr, src_len)?;
+    let dst_range = guest_range(memory, dst_ptr, dst_len)?;
+    let (src, dst) = if src_range.end <= dst_range.start {
+        let (head, tail) = memory.split_at_mut(dst_range.start);
+        (&head[src_range], &mut tail[..dst_range.len()])
+    } else if dst_range.end <= src_range.start {
+        let (head, tail) = memory.split_at_mut(src_range.start);
+        (&tail[..src_range.len()], &mut head[dst_range])
+    } else {
+        return Ok(-1);
+    };
+    let Ok(text) = simdutf8::basic::from_utf8(src) else { return Ok(-1); };
+    let mut written = 0;
+    let mut total = 0;
+    for c in caseless::Caseless::default_case_fold(text.chars()) {
+        let len = c.len_utf8();
+        if written == total && written + len <= dst.len() {
+            c.encode_utf8(&mut dst[written..]);
+            written += len;
+        }
+        total += len;
+    }
+    Ok(total as i32)
+}
+
+/// Find the first occurrence of `needle` in `haystack`.
+///
+/// ```c
+/// int find(const u8 *haystack, int haystack_len, const u8 *needle, int needle_len);
+/// ```
+///
+/// Returns the offset of the match, or -1 if there is none. Works on bytes,
+/// so it does not need valid UTF-8.
+fn find<T>(
+    mut caller: Caller<'_, T>,
+    haystack_ptr: u32,
+    haystack_len: u32,
+    needle_ptr: u32,
+    needle_len: u32,
+) -> WResult<i32> {
+    let memory = get_memory(&mut caller)?.data(&caller);
+    let haystack = &memory[guest_range(memory, haystack_ptr, haystack_len)?];
+    let needle = &memory[guest_range(memory, needle_ptr, needle_len)?];
+    Ok(memchr::memmem::find(haystack, needle).map_or(-1, |pos| pos as i32))
+}
+
+pub(crate) fn add_to_linker<T: 'static>(linker: &mut Linker<T>) -> WResult<()> {
+    linker.func_wrap(MODULE, "utf8_validate", utf8_validate)?;
+    linker.func_wrap(MODULE, "utf8_count", utf8_count)?;
+    linker.func_wrap(MODULE, "reverse_graphemes", reverse_graphemes)?;
+    linker.func_wrap(MODULE, "casefold", casefold)?;
+    linker.func_wrap(MODULE, "find", find)?;
+    Ok(())
+}
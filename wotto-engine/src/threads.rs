@@ -0,0 +1,370 @@
+//! Data-parallel execution for trusted modules, as the `wotto.parallel`
+//! import.
+//!
+//! A module that imports a shared memory as `wotto.shared` can split its work
+//! into tasks: `parallel` calls an exported worker function once per task, on
+//! other instances of the module that share that memory. Each instance keeps
+//! its own private memory (with its own stack), so the shared memory only
+//! holds the data; this needs the multi-memory proposal, which LLVM does not
+//! support yet, so for now this is for modules written by hand or generated
+//! by other tools.
+//!
+//! Workers run as tasks on the runtime threads, and count against two
+//! limits: a number of threads for the whole engine, and the execution slots
+//! (a worker is a running guest like any other). The first worker of a call
+//! runs in place of the calling guest, which waits for the workers without
+//! giving back its slot; a call that finds no spare threads or slots runs all
+//! of its tasks on that worker, one after the other.
+//!
+//! Nothing can prove that guests sharing memory are free of data races, and a
+//! guest blocked in `memory.atomic.wait` cannot be interrupted, so shared
+//! memory is only given to modules that are explicitly trusted with it.
+
+use std::future::Future;
+use std::pin::Pin;
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::Arc;
+
+use tokio::sync::{OwnedSemaphorePermit, Semaphore};
+use tokio::task::JoinSet;
+use wasmtime::*;
+
+use crate::runtime::guest_range;
+use crate::service::{get_memory, HasThreads, WResult};
+use crate::slim;
+
+const MODULE: &str = "wotto";
+/// Name of the shared memory import.
+const SHARED_MEMORY: &str = "shared";
+/// Largest shared memory a module can ask for.
+const MAX_SHARED_MEMORY: u64 = 16 << 20;
+
+const MEMORY_SECTION: u8 = 5;
+const WASM_PAGE_SIZE: u64 = 64 << 10;
+
+#[derive(Debug, Clone)]
+pub struct ThreadConfig {
+    /// Workers that can run at the same time over all calls, not counting
+    /// the first worker of each call.
+    pub max_threads: usize,
+    /// Workers a single call can use.
+    pub max_per_call: usize,
+}
+
+impl Default for ThreadConfig {
+    fn default() -> Self {
+        let cpus = std::thread::available_parallelism().map_or(1, usize::from);
+        Self {
+            max_threads: cpus.saturating_sub(1).max(1),
+            max_per_call: cpus.min(4),
+        }
+    }
+}
+
+/// Threads available to workers, shared by all calls.
+pub(crate) struct ThreadPool {
+    threads: Arc<Semaphore>,
+    max_per_call: usize,
+}
+
+/// What an extra worker holds while it runs.
+type Permits = (OwnedSemaphorePermit, Option<OwnedSemaphorePermit>);
+
+impl ThreadPool {
+    pub(crate) fn new(config: ThreadConfig) -> Self {
+        Self {
+            threads: Arc::new(Semaphore::new(config.max_threads)),
+            max_per_call: config.max_per_call.max(1),
+        }
+    }
+
+    /// Take what is free right now for the extra workers of a call with
+    /// `tasks` tasks: a thread, and an execution slot if they are limited.
+    /// Never waits, so that calls cannot deadlock each other.
+    fn reserve(&self, tasks: usize, slots: Option<&Arc<Semaphore>>) -> Vec<Permits> {
+        let wanted = tasks.min(self.max_per_call).saturating_sub(1);
+        let mut permits = Vec::with_capacity(wanted);
+        while permits.len() < wanted {
+            let Ok(thread) = self.threads.clone().try_acquire_owned() else { break; };
+            let slot = match slots.map(|slots| slots.clone().try_acquire_owned()) {
+                None => None,
+                Some(Ok(slot)) => Some(slot),
+                Some(Err(_)) => break,
+            };
+            permits.push((thread, slot));
+        }
+        permits
+    }
+}
+
+/// Tasks of one call to `parallel`, taken in order by its workers.
+pub(crate) struct Tasks {
+    pub(crate) function: String,
+    next: AtomicU32,
+    count: u32,
+}
+
+impl Tasks {
+    pub(crate) fn next(&self) -> Option<u32> {
+        let task = self.next.fetch_add(1, Ordering::Relaxed);
+        (task < self.count).then_some(task)
+    }
+}
+
+pub(crate) type Worker = Pin<Box<dyn Future<Output = WResult<()>> + Send>>;
+
+/// Shared memory of one call to a threaded module, and how to start workers
+/// for it.
+pub(crate) struct Threads {
+    pool: Arc<ThreadPool>,
+    slots: Option<Arc<Semaphore>>,
+    pub(crate) memory: SharedMemory,
+    spawn: Box<dyn Fn(Arc<Tasks>) -> Worker + Send + Sync>,
+}
+
+impl Threads {
+    pub(crate) fn new(
+        pool: Arc<ThreadPool>,
+        slots: Option<Arc<Semaphore>>,
+        memory: SharedMemory,
+        spawn: impl Fn(Arc<Tasks>) -> Worker + Send + Sync + 'static,
+    ) -> Self {
+        Self {
+            pool,
+            slots,
+            memory,
+            spawn: Box::new(spawn),
+        }
+    }
+}
+
+pub(crate) fn is_shared_memory(import: &ImportType<'_>) -> bool {
+    import.module() == MODULE && import.name() == SHARED_MEMORY
+}
+
+/// Type of the shared memory a module imports, if it imports one.
+pub(crate) fn shared_memory_import(module: &Module) -> Option<MemoryType> {
+    module
+        .imports()
+        .find(is_shared_memory)
+        .and_then(|import| import.ty().memory().cloned())
+        .filter(MemoryType::is_shared)
+}
+
+/// Whether a shared memory fits the limits.
+pub(crate) fn shared_memory_allowed(ty: &MemoryType) -> bool {
+    ty.maximum().map_or(false, |pages| {
+        pages.saturating_mul(WASM_PAGE_SIZE) <= MAX_SHARED_MEMORY
+    })
+}
+
+/// Whether a compiled module follows the rules on shared memory as far as
+/// its type tells: the only shared memory it imports is `wotto.shared`, and
+/// it does not export a shared memory unless it is that one. A shared memory
+/// that a module defines without exporting it only shows in its bytes (see
+/// `defines_shared_memory`).
+pub(crate) fn follows_shared_memory_rules(module: &Module) -> bool {
+    let is_shared = |ty: ExternType| ty.memory().map_or(false, MemoryType::is_shared);
+    let mut imports_shared = false;
+    for import in module.imports() {
+        if is_shared(import.ty()) {
+            if !is_shared_memory(&import) {
+                return false;
+            }
+            imports_shared = true;
+        }
+    }
+    imports_shared || !module.exports().any(|export| is_shared(export.ty()))
+}
+
+/// Whether a module in binary format defines a shared memory of its own,
+/// which no module is allowed to do. Imported memories are not looked at.
+pub(crate) fn defines_shared_memory(bytes: &[u8]) -> bool {
+    defined_memories(bytes)
+        .iter()
+        .any(|flags| flags & 0x02 != 0)
+}
+
+/// Number of memories a module in binary format defines, not counting the
+/// ones it imports. Threaded modules need a second memory besides their own,
+/// but they import it, so no module is allowed to define more than one.
+pub(crate) fn count_defined_memories(bytes: &[u8]) -> usize {
+    defined_memories(bytes).len()
+}
+
+/// Flags of the memories defined by a module in binary format, as far as
+/// they can be read.
+fn defined_memories(bytes: &[u8]) -> Vec<u8> {
+    let mut memories = vec![];
+    if !bytes.starts_with(b"\0asm") {
+        return memories;
+    }
+    let Some(sections) = slim::sections(bytes) else { return memories; };
+    let Some(section) = sections.iter().find(|s| s.id == MEMORY_SECTION) else { return memories; };
+    let payload = section.payload;
+    let mut pos = 0;
+    let Some(count) = slim::read_u32(payload, &mut pos) else { return memories; };
+    for _ in 0..count {
+        let Some(&flags) = payload.get(pos) else { break; };
+        memories.push(flags);
+        pos += 1;
+        // minimum and maximum, which can be 64-bit with memory64
+        let limits = 1 + usize::from(flags & 0x01 != 0);
+        for _ in 0..limits {
+            while payload.get(pos).map_or(false, |byte| byte & 0x80 != 0) {
+                pos += 1;
+            }
+            pos += 1;
+        }
+    }
+    memories
+}
+
+/// Run an exported function once for each of `tasks` tasks, in parallel on
+/// instances of the module that share its `wotto.shared` memory. The function
+/// takes the index of the task.
+///
+/// ```c
+/// int parallel(const char *function, int function_len, int tasks);
+/// ```
+///
+/// Returns the number of workers that ran the tasks, or -1 if the module
+/// cannot use threads. The calling guest traps if a worker traps.
+fn parallel<T: HasThreads + Send>(
+    mut caller: Caller<'_, T>,
+    function_ptr: u32,
+    function_len: u32,
+    tasks: u32,
+) -> Box<dyn Future<Output = WResult<i32>> + Send + '_> {
+    Box::new(async move {
+        let memory = get_memory(&mut caller)?.data(&caller);
+        let function = &memory[guest_range(memory, function_ptr, function_len)?];
+        let Ok(function) = std::str::from_utf8(function) else { return Ok(-1); };
+        let tasks = Arc::new(Tasks {
+            function: function.to_string(),
+            next: AtomicU32::new(0),
+            count: tasks,
+        });
+        let Some(threads) = caller.data().threads() else { return Ok(-1); };
+        if tasks.count == 0 {
+            return Ok(0);
+        }
+        let permits = threads
+            .pool
+            .reserve(tasks.count as usize, threads.slots.as_ref());
+        let count = permits.len() + 1;
+        // dropping the set (if the call times out) aborts the workers
+        let mut workers = JoinSet::new();
+        workers.spawn((threads.spawn)(tasks.clone()));
+        for permits in permits {
+            let worker = (threads.spawn)(tasks.clone());
+            workers.spawn(async move {
+                let _permits = permits;
+                worker.await
+            });
+        }
+        while let Some(result) = workers.join_next().await {
+            result??;
+        }
+        Ok(count as i32)
+    })
+}
+
+pub(crate) fn add_to_linker<T: HasThreads + Send + 'static>(linker: &mut Linker<T>) -> WResult<()> {
+    linker.func_wrap3_async(MODULE, "parallel", parallel)?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn module(memories: &[u8]) -> Vec<u8> {
+        let mut bytes = b"\0asm\x01\0\0\0".to_vec();
+        bytes.extend_from_slice(&[MEMORY_SECTION, memories.len() as u8]);
+        bytes.extend_from_slice(memories);
+        bytes
+    }
+
+    #[test]
+    fn shared_memories() {
+        assert!(!defines_shared_memory(b"\0asm\x01\0\0\0"));
+        // (memory 1) (memory 1 16)
+        assert!(!defines_shared_memory(&module(&[2, 0, 1, 1, 1, 16])));
+        // (memory 1 16) (memory 1 16 shared)
+        assert!(defines_shared_memory(&module(&[2, 1, 1, 16, 3, 1, 16])));
+        // (memory i64 200 300), with multi-byte limits
+        assert!(!defines_shared_memory(&module(&[1, 5, 0xc8, 1, 0xac, 2])));
+        let text = |wat| wat::parse_str(wat).unwrap();
+        assert!(defines_shared_memory(&text("(module (memory 1 1 shared))")));
+        assert!(!defines_shared_memory(&text(
+            r#"(module (import "wotto" "shared" (memory 1 16 shared)))"#
+        )));
+    }
+
+    #[test]
+    fn memory_counts() {
+        assert_eq!(count_defined_memories(b"\0asm\x01\0\0\0"), 0);
+        assert_eq!(count_defined_memories(&module(&[2, 0, 1, 1, 1, 16])), 2);
+        let text = |wat| wat::parse_str(wat).unwrap();
+        assert_eq!(count_defined_memories(&text("(module (memory 1))")), 1);
+        assert_eq!(
+            count_defined_memories(&text(
+                r#"(module (import "wotto" "shared" (memory 1 16 shared)) (memory 1))"#
+            )),
+            1
+        );
+    }
+
+    #[test]
+    fn compiled_modules() {
+        let mut config = Config::new();
+        config.wasm_threads(true);
+        let engine = Engine::new(&config).unwrap();
+        let follows = |wat: &str| follows_shared_memory_rules(&Module::new(&engine, wat).unwrap());
+        assert!(follows(
+            r#"(module (import "wotto" "shared" (memory 1 16 shared)) (export "m" (memory 0)))"#
+        ));
+        assert!(follows(r#"(module (memory 1) (export "m" (memory 0)))"#));
+        assert!(!follows(
+            r#"(module (memory 1 16 shared) (export "m" (memory 0)))"#
+        ));
+        assert!(!follows(
+            r#"(module (import "env" "m" (memory 1 16 shared)))"#
+        ));
+    }
+
+    #[test]
+    fn reserve() {
+        let pool = ThreadPool::new(ThreadConfig {
+            max_threads: 3,
+            max_per_call: 4,
+        });
+        assert!(pool.reserve(1, None).is_empty());
+        let first = pool.reserve(10, None);
+        assert_eq!(first.len(), 3);
+        assert!(pool.reserve(10, None).is_empty());
+        drop(first);
+
+        let slots = Arc::new(Semaphore::new(1));
+        let second = pool.reserve(2, Some(&slots));
+        assert_eq!(second.len(), 1);
+        // no slot left, so no more workers even if there are threads
+        assert!(pool.reserve(10, Some(&slots)).is_empty());
+        drop(second);
+        assert_eq!(slots.available_permits(), 1);
+        assert_eq!(pool.threads.available_permits(), 3);
+    }
+
+    #[test]
+    fn tasks() {
+        let tasks = Tasks {
+            function: String::new(),
+            next: AtomicU32::new(0),
+            count: 2,
+        };
+        assert_eq!(tasks.next(), Some(0));
+        assert_eq!(tasks.next(), Some(1));
+        assert_eq!(tasks.next(), None);
+    }
+}
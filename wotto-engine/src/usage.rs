@@ -0,0 +1,166 @@
+//! Invocation statistics, used to decide which modules to prewarm.
+//!
+//! Counts are kept per module, overall and per context (the bot uses the
+//! channel). They can be saved to a JSON file and loaded at startup, so that
+//! the modules that were popular before a restart can be warmed up before
+//! anybody asks for them.
+
+use std::collections::HashMap;
+use std::io;
+use std::path::Path;
+use std::sync::atomic::{AtomicU64, Ordering};
+
+use serde::{Deserialize, Serialize};
+
+/// Modules counted overall and in each context. When a new one comes in
+/// past this, the least used one is forgotten.
+const MAX_MODULES: usize = 256;
+
+#[derive(Default, Serialize, Deserialize)]
+pub(crate) struct Usage {
+    total: HashMap<String, u64>,
+    contexts: HashMap<String, HashMap<String, u64>>,
+}
+
+impl Usage {
+    pub(crate) fn record(&mut self, context: Option<&str>, module: &str) {
+        increment(&mut self.total, module);
+        if let Some(context) = context {
+            if !self.contexts.contains_key(context) {
+                self.contexts.insert(context.to_string(), HashMap::new());
+            }
+            increment(self.contexts.get_mut(context).unwrap(), module);
+        }
+    }
+
+    /// Modules by number of invocations, most used first, in a context or
+    /// overall.
+    pub(crate) fn popular(&self, context: Option<&str>) -> Vec<(String, u64)> {
+        let counts = match context {
+            Some(context) => self.contexts.get(context),
+            None => Some(&self.total),
+        };
+        let mut popular: Vec<_> = counts
+            .into_iter()
+            .flatten()
+            .map(|(module, count)| (module.clone(), *count))
+            .collect();
+        popular.sort_by(|a, b| b.1.cmp(&a.1).then_with(|| a.0.cmp(&b.0)));
+        popular
+    }
+
+    pub(crate) fn load(path: &Path) -> io::Result<Self> {
+        let file = std::fs::File::open(path)?;
+        Ok(serde_json::from_reader(io::BufReader::new(file))?)
+    }
+
+    pub(crate) fn save(&self, path: &Path) -> io::Result<()> {
+        // write and rename, so that a crash does not leave a truncated file
+        let tmp = path.with_extension("tmp");
+        serde_json::to_writer(std::fs::File::create(&tmp)?, self)?;
+        std::fs::rename(tmp, path)
+    }
+}
+
+/// Count one more call of a module, only allocating its name the first time.
+fn increment(counts: &mut HashMap<String, u64>, module: &str) {
+    match counts.get_mut(module) {
+        Some(count) => *count += 1,
+        None => {
+            if counts.len() >= MAX_MODULES {
+                let least_used = counts
+                    .iter()
+                    .min_by_key(|(_, count)| **count)
+                    .map(|(module, _)| module.clone());
+                if let Some(least_used) = least_used {
+                    counts.remove(&least_used);
+                }
+            }
+            counts.insert(module.to_string(), 1);
+        }
+    }
+}
+
+/// How many calls found their module already warm.
+#[derive(Debug, Clone, Default)]
+pub struct WarmStats {
+    pub calls: u64,
+    /// Calls that had to resolve imports and touch the module code for the
+    /// first time.
+    pub cold_starts: u64,
+}
+
+#[derive(Default)]
+pub(crate) struct WarmCounters {
+    calls: AtomicU64,
+    cold_starts: AtomicU64,
+}
+
+impl WarmCounters {
+    pub(crate) fn record(&self, cold: bool) {
+        self.calls.fetch_add(1, Ordering::Relaxed);
+        if cold {
+            self.cold_starts.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    pub(crate) fn get(&self) -> WarmStats {
+        WarmStats {
+            calls: self.calls.load(Ordering::Relaxed),
+            cold_starts: self.cold_starts.load(Ordering::Relaxed),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn popular() {
+        let mut usage = Usage::default();
+        for (context, module) in [
+            (Some("#a"), "foo"),
+            (Some("#a"), "bar"),
+            (Some("#a"), "bar"),
+            (Some("#b"), "foo"),
+            (None, "foo"),
+        ] {
+            usage.record(context, module);
+        }
+        assert_eq!(
+            usage.popular(None),
+            [("foo".to_string(), 3), ("bar".to_string(), 2)]
+        );
+        assert_eq!(
+            usage.popular(Some("#a")),
+            [("bar".to_string(), 2), ("foo".to_string(), 1)]
+        );
+        assert!(usage.popular(Some("#c")).is_empty());
+    }
+
+    #[test]
+    fn bounded() {
+        let mut usage = Usage::default();
+        usage.record(Some("#a"), "popular");
+        usage.record(Some("#a"), "popular");
+        for i in 0..2 * MAX_MODULES {
+            usage.record(Some("#a"), &format!("typo{i}"));
+        }
+        assert_eq!(usage.popular(None).len(), MAX_MODULES);
+        let in_context = usage.popular(Some("#a"));
+        assert_eq!(in_context.len(), MAX_MODULES);
+        assert_eq!(in_context[0], ("popular".to_string(), 2));
+    }
+
+    #[test]
+    fn save_and_load() {
+        let path = std::env::temp_dir().join(format!("wotto-usage-{}.json", std::process::id()));
+        let mut usage = Usage::default();
+        usage.record(Some("#a"), "foo");
+        usage.save(&path).unwrap();
+        let loaded = Usage::load(&path).unwrap();
+        std::fs::remove_file(&path).unwrap();
+        assert_eq!(loaded.popular(Some("#a")), usage.popular(Some("#a")));
+    }
+}
@@ -324,6 +324,23 @@ pub(super) async fn resolve_gist(url: &Url) -> Result<impl ResolverResult> {
     extract_gist_from_json(json, gist).ok_or(WebError::NotWasm.into())
 }
 
+/// A module from a raw gist url, as if it had been resolved and fetched.
+#[cfg(test)]
+pub(super) fn fetched(url: &Url, content: Vec<u8>) -> Result<impl ResolverResult> {
+    let gist = Gist::new(url)?;
+    let blob = gist.blob.expect("raw gist urls have a blob").to_string();
+    let file_path = gist
+        .file_path
+        .expect("raw gist urls have a file path")
+        .to_string();
+    Ok(GistResolvedModule::new(
+        gist,
+        file_path,
+        blob,
+        Some(content),
+    ))
+}
+
 pub(crate) async fn load_content(module: &mut ResolvedModule) -> Result<()> {
     if module.content().is_some() {
         return Ok(());
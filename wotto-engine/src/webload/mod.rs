@@ -71,10 +71,30 @@ impl ResolvedModule {
         self.resolved.content()
     }
 
+    /// Drop the content, which is only needed to compile the module; a
+    /// reload fetches it again. Returns the bytes it held.
+    pub(crate) fn drop_content(&mut self) -> usize {
+        self.resolved
+            .take_content()
+            .map_or(0, |content| content.len())
+    }
+
     pub(crate) async fn ensure_content(&mut self) -> Result<()> {
         self.loader.ensure_content(self).await
     }
 
+    /// A gist module with its content, without going to the network.
+    #[cfg(test)]
+    pub(crate) fn fetched(url: &str, content: Vec<u8>) -> Self {
+        let url = Url::parse(url).unwrap();
+        let resolved = gist::fetched(&url, content).unwrap();
+        Self {
+            loader: Loader::Gist,
+            url,
+            resolved: Box::new(resolved),
+        }
+    }
+
     fn downcast<T: ResolverResult + 'static>(&mut self) -> &mut T {
         self.resolved
             .as_any_mut()
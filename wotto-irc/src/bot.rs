@@ -7,12 +7,97 @@ use tracing::{error, info, trace, warn};
 use valuable::Valuable;
 use warp::Filter;
 
+use crate::health::HealthConfig;
 use crate::parsing;
 
 pub async fn bot_main() -> Result<(), Box<dyn std::error::Error>> {
     let config = Config::load("wotto.toml")?;
 
-    let engine = wotto_engine::Service::new();
+    let mut engine = wotto_engine::Service::new();
+    engine.set_execution_slots(execution_slots(&config));
+    engine.set_breaker_config(breaker_config(&config));
+    engine.set_reload_gate(reload_gate(&config));
+    engine.set_custom_sections(custom_sections(&config));
+    engine.set_memory_limits(memory_limits(&config));
+    if let Some(stoppable) = config.get_option("stoppable") {
+        for module in stoppable.split_whitespace() {
+            engine.set_stoppable(module, true);
+        }
+    }
+    if let Some(threaded) = config.get_option("threads") {
+        engine.enable_threads(thread_config(&config));
+        for module in threaded.split_whitespace() {
+            engine.set_threaded(module, true);
+        }
+    }
+    let default_budget = default_budget(&config);
+    engine.set_default_budget(default_budget);
+    if let Some(budgets) = config.get_option("budgets") {
+        for entry in budgets.split_whitespace() {
+            let Some((target, budget)) = entry
+                .split_once('=')
+                .and_then(|(target, limits)| Some((target, parse_budget(limits, default_budget)?)))
+            else {
+                error!(
+                    entry,
+                    "warning: budgets should be given as module[.entry]=wall[/cpu]"
+                );
+                continue;
+            };
+            match target.split_once('.') {
+                Some((module, entry_point)) => engine.set_budget(module, Some(entry_point), budget),
+                None => engine.set_budget(target, None, budget),
+            }
+        }
+    }
+    if let Some(profiler_config) = profiler_config(&config) {
+        info!(?profiler_config, "guest profiler enabled");
+        engine.enable_profiler(profiler_config);
+    }
+    let cache_config = cache_config(&config);
+    match engine.enable_cache(cache_config.clone()) {
+        Ok(()) => info!(?cache_config, "guest cache enabled"),
+        Err(err) => error!(%err, "cannot enable guest cache"),
+    }
+    if let Some(blobs) = config.get_option("blobs") {
+        for blob in blobs.split_whitespace() {
+            let Some((name, path)) = blob.split_once('=') else {
+                error!(blob, "warning: blobs should be given as name=path");
+                continue;
+            };
+            if let Err(err) = engine.register_blob(name, path) {
+                error!(blob = name, path, %err, "cannot register blob");
+            }
+        }
+    }
+    // libraries first, so that modules importing from them can be linked
+    if let Some(libraries) = config.get_option("libraries") {
+        for library in libraries.split_whitespace() {
+            match engine
+                .load_library_from_file(std::path::Path::new(library))
+                .await
+            {
+                Ok(name) => info!(library, name, "loaded library"),
+                Err(err) => error!(library, %err, "cannot load library"),
+            }
+        }
+    }
+    if let Some(bundle) = config.get_option("module_bundle") {
+        match engine.load_bundle(std::path::Path::new(bundle)).await {
+            Ok(modules) => info!(bundle, ?modules, "loaded precompiled modules"),
+            Err(err) => error!(bundle, %err, "cannot load module bundle"),
+        }
+    }
+    let usage_file = config.get_option("usage_file").map(str::to_owned);
+    if let Some(usage_file) = usage_file.as_deref() {
+        match engine.load_usage(usage_file) {
+            Ok(()) => info!(usage_file, "loaded usage statistics"),
+            Err(err) => warn!(usage_file, %err, "cannot load usage statistics"),
+        }
+    }
+    if let Some(budget) = prewarm_budget(&config) {
+        engine.prewarm_popular(None, budget).await;
+    }
 
     let futures = {
         let mut futures = vec![];
@@ -27,11 +112,21 @@ pub async fn bot_main() -> Result<(), Box<dyn std::error::Error>> {
         futures.push(state.engine_epoch_timer());
 
         let ctrl_c_task = tokio::spawn(ctrl_c_monitor(Arc::downgrade(&state)));
+        let memory_task = tokio::spawn(memory_monitor(Arc::downgrade(&state)));
+        let health_task = tokio::spawn(health_monitor(Arc::downgrade(&state)));
 
         let _ = state.clone().irc_task().await;
         trace!("irc_task quit");
 
+        if let Some(usage_file) = usage_file.as_deref() {
+            if let Err(err) = state.engine().save_usage(usage_file) {
+                error!(usage_file, %err, "cannot save usage statistics");
+            }
+        }
+
         ctrl_c_task.abort();
+        memory_task.abort();
+        health_task.abort();
 
         // TODO close web task cleanly?
         trace!("shutting down web server");
@@ -56,6 +151,304 @@ pub async fn bot_main() -> Result<(), Box<dyn std::error::Error>> {
     Ok(())
 }
 
+/// The profiler is enabled when `profile_sample_interval` is set (in epoch
+/// ticks). `profile_max_stacks` optionally bounds each module's profile.
+fn profiler_config(config: &Config) -> Option<wotto_engine::ProfilerConfig> {
+    let sample_interval = match config.get_option("profile_sample_interval")?.parse() {
+        Ok(interval) => interval,
+        Err(_) => {
+            error!("warning: profile_sample_interval cannot be parsed!");
+            return None;
+        }
+    };
+    let mut profiler_config = wotto_engine::ProfilerConfig {
+        sample_interval,
+        ..Default::default()
+    };
+    if let Some(max_stacks) = config.get_option("profile_max_stacks") {
+        match max_stacks.parse() {
+            Ok(max_stacks) => profiler_config.max_stacks = max_stacks,
+            Err(_) => error!("warning: profile_max_stacks cannot be parsed!"),
+        }
+    }
+    Some(profiler_config)
+}
+
+fn execution_slots(config: &Config) -> usize {
+    let default = 2;
+    let Some(slots) = config.get_option("execution_slots") else { return default; };
+    match slots.parse() {
+        Ok(slots) if slots > 0 => slots,
+        _ => {
+            error!("warning: execution_slots cannot be parsed!");
+            default
+        }
+    }
+}
+
+fn reload_gate(config: &Config) -> wotto_engine::ReloadGate {
+    let mut gate = wotto_engine::ReloadGate::default();
+    match config.get_option("reload_policy") {
+        None => {}
+        Some("off") => gate.policy = wotto_engine::ReloadPolicy::Off,
+        Some("flag") => gate.policy = wotto_engine::ReloadPolicy::Flag,
+        Some("refuse") => gate.policy = wotto_engine::ReloadPolicy::Refuse,
+        Some(_) => error!("warning: reload_policy cannot be parsed!"),
+    }
+    for (option, field) in [
+        ("reload_max_slowdown", &mut gate.max_slowdown),
+        ("reload_max_memory_growth", &mut gate.max_memory_growth),
+    ] {
+        if let Some(ratio) = config.get_option(option) {
+            match ratio.parse() {
+                Ok(ratio) if ratio >= 1. => *field = ratio,
+                _ => error!("warning: {option} cannot be parsed!"),
+            }
+        }
+    }
+    gate
+}
+
+fn thread_config(config: &Config) -> wotto_engine::ThreadConfig {
+    let mut thread_config = wotto_engine::ThreadConfig::default();
+    for (option, field) in [
+        ("max_threads", &mut thread_config.max_threads),
+        ("threads_per_call", &mut thread_config.max_per_call),
+    ] {
+        if let Some(value) = config.get_option(option) {
+            match value.parse() {
+                Ok(value) if value > 0 => *field = value,
+                _ => error!("warning: {option} cannot be parsed!"),
+            }
+        }
+    }
+    thread_config
+}
+
+fn custom_sections(config: &Config) -> wotto_engine::CustomSections {
+    match config.get_option("custom_sections") {
+        None | Some("keep") => wotto_engine::CustomSections::Keep,
+        Some("strip-debug") => wotto_engine::CustomSections::StripDebug,
+        Some("strip") => wotto_engine::CustomSections::Strip,
+        Some(_) => {
+            error!("warning: custom_sections cannot be parsed!");
+            wotto_engine::CustomSections::default()
+        }
+    }
+}
+
+fn memory_limits(config: &Config) -> wotto_engine::MemoryLimits {
+    let mut limits = wotto_engine::MemoryLimits::default();
+    let sizes = [
+        ("memory_soft_limit", &mut limits.soft),
+        ("memory_hard_limit", &mut limits.hard),
+    ];
+    for (option, value) in sizes {
+        if let Some(size) = config.get_option(option) {
+            match size.parse() {
+                Ok(size) => *value = size,
+                Err(_) => error!("warning: {option} cannot be parsed!"),
+            }
+        }
+    }
+    if let Some(ms) = config.get_option("module_idle_time") {
+        match ms.parse() {
+            Ok(ms) => limits.idle = std::time::Duration::from_millis(ms),
+            Err(_) => error!("warning: module_idle_time cannot be parsed!"),
+        }
+    }
+    limits
+}
+
+fn health_config(config: &Config) -> HealthConfig {
+    let mut health = HealthConfig::default();
+    let thresholds = [
+        ("max_scheduler_lag", &mut health.max_scheduler_lag),
+        ("max_ping_rtt", &mut health.max_ping_rtt),
+        ("max_reply_delay", &mut health.max_reply_delay),
+    ];
+    for (option, value) in thresholds {
+        if let Some(ms) = config.get_option(option) {
+            match ms.parse() {
+                Ok(ms) => *value = std::time::Duration::from_millis(ms),
+                Err(_) => error!("warning: {option} cannot be parsed!"),
+            }
+        }
+    }
+    health
+}
+
+/// Memory that prewarmed modules can take, in bytes, or `None` if
+/// prewarming is disabled with `prewarm = "false"`.
+fn prewarm_budget(config: &Config) -> Option<usize> {
+    let default = 64 << 20;
+    if config.get_option("prewarm") == Some("false") {
+        return None;
+    }
+    let Some(budget) = config.get_option("prewarm_budget") else { return Some(default); };
+    match budget.parse() {
+        Ok(budget) => Some(budget),
+        Err(_) => {
+            error!("warning: prewarm_budget cannot be parsed!");
+            Some(default)
+        }
+    }
+}
+
+fn breaker_config(config: &Config) -> wotto_engine::BreakerConfig {
+    let mut breaker_config = wotto_engine::BreakerConfig::default();
+    let counts = [
+        ("breaker_window", &mut breaker_config.window),
+        ("breaker_failures", &mut breaker_config.max_failures),
+        ("breaker_timeouts", &mut breaker_config.max_timeouts),
+    ];
+    for (option, value) in counts {
+        if let Some(count) = config.get_option(option) {
+            match count.parse() {
+                Ok(count) => *value = count,
+                Err(_) => error!("warning: {option} cannot be parsed!"),
+            }
+        }
+    }
+    breaker_config.window = breaker_config.window.clamp(1, 64);
+    if let Some(ms) = config.get_option("breaker_cooldown") {
+        match ms.parse() {
+            Ok(ms) => breaker_config.cooldown = std::time::Duration::from_millis(ms),
+            Err(_) => error!("warning: breaker_cooldown cannot be parsed!"),
+        }
+    }
+    breaker_config
+}
+
+/// One line per subsystem, after the overall state.
+fn describe_memory(report: &wotto_engine::MemoryReport) -> Vec<String> {
+    let mut lines = vec![format!(
+        "{:?}: {} bytes of {} (hard {}), {} unloaded, {} loads refused, {} slots held",
+        report.pressure,
+        report.total,
+        report.soft_limit,
+        report.hard_limit,
+        report.evicted_modules,
+        report.rejected_loads,
+        report.held_slots,
+    )];
+    lines.extend(
+        report
+            .usage
+            .iter()
+            .map(|(subsystem, bytes)| format!("{subsystem}: {bytes}")),
+    );
+    lines
+}
+
+/// One line per breaker that is not closed.
+fn describe_breakers(engine: &wotto_engine::Service) -> Vec<String> {
+    use wotto_engine::BreakerState;
+    engine
+        .breakers()
+        .into_iter()
+        .filter_map(|breaker| {
+            let state = match breaker.state {
+                BreakerState::Closed => return None,
+                BreakerState::Open { retry_in } => {
+                    format!("open, retry in {}s", retry_in.as_secs())
+                }
+                BreakerState::HalfOpen => "probing".to_string(),
+            };
+            Some(format!(
+                "{} ({state}; {} failures and {} timeouts in the last {} calls, opened {} times)",
+                breaker.name, breaker.failures, breaker.timeouts, breaker.calls, breaker.opened
+            ))
+        })
+        .collect()
+}
+
+fn default_budget(config: &Config) -> wotto_engine::Budget {
+    let mut budget = wotto_engine::Budget::default();
+    let limits = [
+        ("time_limit", &mut budget.wall),
+        ("cpu_limit", &mut budget.cpu),
+    ];
+    for (option, value) in limits {
+        if let Some(ms) = config.get_option(option) {
+            match ms.parse() {
+                Ok(ms) => *value = std::time::Duration::from_millis(ms),
+                Err(_) => error!("warning: {option} cannot be parsed!"),
+            }
+        }
+    }
+    budget
+}
+
+/// Parse `wall[/cpu]`, in milliseconds. The CPU limit defaults to the one
+/// of `base`, but is never larger than the wall-clock limit.
+fn parse_budget(limits: &str, base: wotto_engine::Budget) -> Option<wotto_engine::Budget> {
+    let ms = |s: &str| s.parse().ok().map(std::time::Duration::from_millis);
+    let (wall, cpu) = match limits.split_once('/') {
+        Some((wall, cpu)) => (ms(wall)?, ms(cpu)?),
+        None => {
+            let wall = ms(limits)?;
+            (wall, base.cpu.min(wall))
+        }
+    };
+    Some(wotto_engine::Budget { wall, cpu })
+}
+
+fn cache_config(config: &Config) -> wotto_engine::CacheConfig {
+    let mut cache_config = wotto_engine::CacheConfig::default();
+    let sizes = [
+        ("cache_size", &mut cache_config.capacity),
+        ("cache_module_quota", &mut cache_config.module_quota),
+        ("cache_log_size", &mut cache_config.log_size),
+    ];
+    for (option, value) in sizes {
+        if let Some(size) = config.get_option(option) {
+            match size.parse() {
+                Ok(size) => *value = size,
+                Err(_) => error!("warning: {option} cannot be parsed!"),
+            }
+        }
+    }
+    cache_config.log_path = config.get_option("cache_log").map(Into::into);
+    cache_config
+}
+
+/// How often memory usage is checked against the limits.
+const MEMORY_CHECK_INTERVAL: std::time::Duration = std::time::Duration::from_secs(10);
+
+async fn memory_monitor(state: std::sync::Weak<BotState>) {
+    let mut interval = tokio::time::interval(MEMORY_CHECK_INTERVAL);
+    loop {
+        interval.tick().await;
+        let Some(state) = state.upgrade() else { break; };
+        state.check_memory().await;
+    }
+}
+
+/// How long the health monitor sleeps between two measures of the
+/// scheduler lag.
+const LAG_PROBE_INTERVAL: std::time::Duration = std::time::Duration::from_millis(100);
+/// Lag probes between two health evaluations.
+const PROBES_PER_EVALUATION: u64 = 10;
+/// Lag probes between two PINGs to the server.
+const PROBES_PER_PING: u64 = 150;
+
+async fn health_monitor(state: std::sync::Weak<BotState>) {
+    for probe in 1u64.. {
+        let start = std::time::Instant::now();
+        tokio::time::sleep(LAG_PROBE_INTERVAL).await;
+        let lag = start.elapsed().saturating_sub(LAG_PROBE_INTERVAL);
+        let Some(state) = state.upgrade() else { break; };
+        state.health().record_scheduler_lag(lag);
+        if probe % PROBES_PER_EVALUATION == 0 {
+            state.health().evaluate();
+        }
+        if probe % PROBES_PER_PING == 0 {
+            state.send_health_ping();
+        }
+    }
+}
+
 async fn ctrl_c_monitor(state: std::sync::Weak<BotState>) {
     let Ok(_) = tokio::signal::ctrl_c().await else { return; };
     if let Some(state) = state.upgrade() {
@@ -112,19 +505,32 @@ impl std::str::FromStr for UserMask {
 
 mod state {
     use std::fmt::Debug;
-    use std::sync::atomic::AtomicBool;
-    use std::sync::Arc;
+    use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+    use std::sync::{Arc, Mutex};
 
     use irc::client::prelude::Config;
     use irc::client::Client;
     use irc::proto::Prefix;
-    use tokio::sync::{AcquireError, RwLock, Semaphore};
+    use tokio::sync::RwLock;
     use tracing::{error, info, trace};
     use valuable::Valuable;
 
-    use super::{BotCommand, CommandName, UserMask};
+    use super::{
+        describe_breakers, describe_memory, health_config, BotCommand, CommandName, UserMask,
+    };
+    use crate::health::Health;
     use crate::throttling::Throttler;
 
+    const DEFAULT_PROFILE_DIR: &str = "profiles";
+    /// Rough size of a message waiting to be sent (IRC lines are at most 512
+    /// bytes).
+    const QUEUED_MESSAGE_SIZE: usize = 512;
+    /// Rough size of a module command waiting for its turn.
+    const PENDING_COMMAND_SIZE: usize = 1 << 10;
+    /// Module commands that can be pending at the same time above the soft
+    /// memory limit. Above the hard limit, new ones are dropped.
+    const MAX_PENDING_COMMANDS_UNDER_PRESSURE: usize = 32;
+
     struct TrustedUsers {
         list: Vec<UserMask>,
     }
@@ -195,10 +601,22 @@ mod state {
         engine: wotto_engine::Service,
         trusted: RwLock<TrustedUsers>,
         throttler: Throttler,
-        engine_semaphore: Semaphore,
         quitting: AtomicBool,
         known_nickname: RwLock<Option<String>>,
         known_hostmask: RwLock<Option<UserMask>>,
+        /// Module commands that are waiting or running.
+        pending_commands: AtomicUsize,
+        memory_report: Mutex<wotto_engine::MemoryReport>,
+        health: Health,
+    }
+
+    /// A module command counted as pending until this is dropped.
+    pub(crate) struct PendingCommand(Arc<BotState>);
+
+    impl Drop for PendingCommand {
+        fn drop(&mut self) {
+            self.0.pending_commands.fetch_sub(1, Ordering::Relaxed);
+        }
     }
 
     impl BotState {
@@ -208,18 +626,20 @@ mod state {
                 .layer(2, 150)
                 .layer(1, 50)
                 .build();
-            let engine_semaphore = Semaphore::new(2);
             let trusted = TrustedUsers::from_config(&config);
+            let health = Health::new(health_config(&config));
             Self {
                 config,
                 client: RwLock::new(None),
                 engine,
                 trusted: RwLock::new(trusted),
                 throttler,
-                engine_semaphore,
                 quitting: AtomicBool::new(false),
                 known_nickname: RwLock::default(),
                 known_hostmask: RwLock::default(),
+                pending_commands: AtomicUsize::new(0),
+                memory_report: Mutex::default(),
+                health,
             }
         }
 
@@ -237,6 +657,132 @@ mod state {
             &self.engine
         }
 
+        pub(crate) fn health(&self) -> &Health {
+            &self.health
+        }
+
+        /// Count a module command as pending, unless there are already too
+        /// many for the current memory pressure, or the bot is not keeping
+        /// up.
+        pub(crate) fn admit_command(self: &Arc<Self>) -> Option<PendingCommand> {
+            let limit = match self.engine.memory_pressure() {
+                _ if !self.health.is_healthy() => 0,
+                wotto_engine::Pressure::Normal => usize::MAX,
+                wotto_engine::Pressure::Soft => MAX_PENDING_COMMANDS_UNDER_PRESSURE,
+                wotto_engine::Pressure::Hard => 0,
+            };
+            let pending = self.pending_commands.fetch_add(1, Ordering::Relaxed);
+            let command = PendingCommand(self.clone());
+            if pending >= limit {
+                self.health.shed();
+                return None;
+            }
+            Some(command)
+        }
+
+        /// Send a PING to measure the round trip to the server. The client
+        /// answers the server's pings on its own, but that tells nothing
+        /// about how long our messages take.
+        pub(crate) fn send_health_ping(&self) {
+            // before registration, the server might not answer
+            let registered = self
+                .known_nickname
+                .try_read()
+                .map_or(false, |nickname| nickname.is_some());
+            if !registered {
+                return;
+            }
+            if let Some(token) = self.health.start_ping() {
+                self.client(|client| client.send(irc::proto::Command::PING(token, None)));
+            }
+        }
+
+        /// Whether the bot is keeping up, with the reasons if it is not.
+        pub(crate) fn check_health(&self) -> Result<(), Vec<&'static str>> {
+            let mut problems = self.health.report().problems;
+            if self.engine.memory_pressure() == wotto_engine::Pressure::Hard {
+                problems.push("memory");
+            }
+            match problems.is_empty() {
+                true => Ok(()),
+                false => Err(problems),
+            }
+        }
+
+        /// Health and memory in the Prometheus text format.
+        pub(crate) fn metrics(&self) -> String {
+            use std::fmt::Write;
+            let health = self.health.report();
+            let memory = self.memory_report.lock().unwrap().clone();
+            let queued = self.client(|client| client.queued_messages()).unwrap_or(0);
+            let gauges = [
+                ("wotto_healthy", self.check_health().is_ok() as u64 as f64),
+                (
+                    "wotto_scheduler_lag_seconds",
+                    health.scheduler_lag.as_secs_f64(),
+                ),
+                ("wotto_irc_ping_rtt_seconds", health.ping_rtt.as_secs_f64()),
+                (
+                    "wotto_reply_delay_seconds",
+                    health.reply_delay.as_secs_f64(),
+                ),
+                ("wotto_irc_queued_messages", queued as f64),
+                (
+                    "wotto_pending_commands",
+                    self.pending_commands.load(Ordering::Relaxed) as f64,
+                ),
+                ("wotto_memory_pressure", memory.pressure as u8 as f64),
+            ];
+            let mut metrics = String::new();
+            for (name, value) in gauges {
+                let _ = writeln!(metrics, "# TYPE {name} gauge\n{name} {value}");
+            }
+            let _ = writeln!(
+                metrics,
+                "# TYPE wotto_commands_shed_total counter\nwotto_commands_shed_total {}",
+                health.shed_commands
+            );
+            let _ = writeln!(metrics, "# TYPE wotto_memory_bytes gauge");
+            for (subsystem, bytes) in &memory.usage {
+                let _ = writeln!(
+                    metrics,
+                    "wotto_memory_bytes{{subsystem=\"{subsystem}\"}} {bytes}"
+                );
+            }
+            metrics
+        }
+
+        /// Tell the engine how much memory the IRC client and the pending
+        /// commands hold, and let it check its limits.
+        pub(crate) async fn check_memory(&self) {
+            let irc = self.client(|client| (client.chanlists_size(), client.queued_messages()));
+            if let Some((channels, queued)) = irc {
+                self.engine.set_external_memory("irc_channels", channels);
+                self.engine
+                    .set_external_memory("irc_queue", queued * QUEUED_MESSAGE_SIZE);
+            }
+            let pending = self.pending_commands.load(Ordering::Relaxed);
+            self.engine
+                .set_external_memory("pending_commands", pending * PENDING_COMMAND_SIZE);
+            let report = self.engine.check_memory().await;
+            *self.memory_report.lock().unwrap() = report;
+        }
+
+        /// The report of the last memory check, one line per subsystem.
+        pub(crate) fn describe_memory(&self) -> Vec<String> {
+            describe_memory(&self.memory_report.lock().unwrap())
+        }
+
+        pub(crate) fn prewarm_budget(&self) -> Option<usize> {
+            prewarm_budget(&self.config)
+        }
+
+        pub(crate) fn profile_dir(&self) -> &str {
+            self.config
+                .get_option("profile_dir")
+                .unwrap_or(DEFAULT_PROFILE_DIR)
+        }
+
         pub(crate) async fn management_command(
             slf: Arc<Self>,
             source: Option<Prefix>,
@@ -298,7 +844,23 @@ mod state {
                             state.engine().load_module(module_name.clone()).await
                         };
                         let response = match load_result {
-                            Ok(name) => format!("loaded module: {name}"),
+                            Ok(name) => {
+                                let regression = state
+                                    .engine()
+                                    .reload_reports()
+                                    .into_iter()
+                                    .find(|report| report.module == name)
+                                    .and_then(|report| report.regression);
+                                match regression {
+                                    Some(reason) => {
+                                        format!("loaded module: {name} (warning: {reason})")
+                                    }
+                                    None => format!("loaded module: {name}"),
+                                }
+                            }
+                            Err(wotto_engine::Error::Regression(reason)) => {
+                                format!("kept the old version of {module_name}: {reason}")
+                            }
                             Err(error) => {
                                 error!(err = %error, module_name, "cannot load module");
                                 "cannot load module (check logs)".to_string()
@@ -307,6 +869,196 @@ mod state {
                         state.reply(response_target, response).await;
                     });
                 }
+                CommandName::Plain(x) if x == "load-library" => {
+                    if !check_trust(&slf, source).await {
+                        return;
+                    }
+                    let library_name = cmd.args.trim().to_string();
+                    let state = slf.clone();
+                    tokio::spawn(async move {
+                        let result = state.engine().load_library(library_name.clone()).await;
+                        let response = match result {
+                            Ok(name) => format!("loaded library: {name}"),
+                            Err(error) => {
+                                error!(err = %error, library_name, "cannot load library");
+                                "cannot load library (check logs)".to_string()
+                            }
+                        };
+                        state.reply(response_target, response).await;
+                    });
+                }
+                CommandName::Plain(x) if x == "libraries" => {
+                    if !check_trust(&slf, source).await {
+                        return;
+                    }
+                    let libraries: Vec<_> = slf
+                        .engine()
+                        .libraries()
+                        .await
+                        .into_iter()
+                        .map(|library| {
+                            format!(
+                                "{} (generation {}, used by {})",
+                                library.name,
+                                library.generation,
+                                library.dependents.len()
+                            )
+                        })
+                        .collect();
+                    let response = if libraries.is_empty() {
+                        "no libraries loaded".to_string()
+                    } else {
+                        libraries.join(", ")
+                    };
+                    slf.reply(response_target, response).await;
+                }
+                CommandName::Plain(x) if x == "overruns" => {
+                    if !check_trust(&slf, source).await {
+                        return;
+                    }
+                    let overruns: Vec<_> = slf
+                        .engine()
+                        .overruns()
+                        .into_iter()
+                        .map(|(name, stats)| {
+                            format!(
+                                "{name} ({} times, last {:?}, worst {:?})",
+                                stats.count, stats.last, stats.worst
+                            )
+                        })
+                        .collect();
+                    let response = if overruns.is_empty() {
+                        "no overruns".to_string()
+                    } else {
+                        overruns.join(", ")
+                    };
+                    slf.reply(response_target, response).await;
+                }
+                CommandName::Plain(x) if x == "breakers" => {
+                    if !check_trust(&slf, source).await {
+                        return;
+                    }
+                    let breakers = describe_breakers(slf.engine());
+                    let response = if breakers.is_empty() {
+                        "all circuits closed".to_string()
+                    } else {
+                        breakers.join(", ")
+                    };
+                    slf.reply(response_target, response).await;
+                }
+                CommandName::Plain(x) if x == "reset-breaker" => {
+                    if !check_trust(&slf, source).await {
+                        return;
+                    }
+                    let response = match cmd.args.trim().split_once('.') {
+                        Some((module, entry_point)) => {
+                            if slf.engine().reset_breaker(module, entry_point) {
+                                format!("reset breaker of {module}.{entry_point}")
+                            } else {
+                                format!("no breaker for {module}.{entry_point}")
+                            }
+                        }
+                        None => "usage: reset-breaker <module>.<entry point>".to_string(),
+                    };
+                    slf.reply(response_target, response).await;
+                }
+                CommandName::Plain(x) if x == "usage" => {
+                    if !check_trust(&slf, source).await {
+                        return;
+                    }
+                    let context = cmd.args.trim();
+                    let context = (!context.is_empty()).then_some(context);
+                    let popular: Vec<_> = slf
+                        .engine()
+                        .popular_modules(context)
+                        .into_iter()
+                        .take(10)
+                        .map(|(module, count)| format!("{module} ({count})"))
+                        .collect();
+                    let warm = slf.engine().warm_stats();
+                    let cold_rate = if warm.calls == 0 {
+                        0.
+                    } else {
+                        100. * warm.cold_starts as f64 / warm.calls as f64
+                    };
+                    let response = format!(
+                        "{}; cold starts: {} of {} calls ({cold_rate:.1}%)",
+                        if popular.is_empty() {
+                            "no calls yet".to_string()
+                        } else {
+                            popular.join(", ")
+                        },
+                        warm.cold_starts,
+                        warm.calls,
+                    );
+                    slf.reply(response_target, response).await;
+                }
+                CommandName::Plain(x) if x == "reloads" => {
+                    if !check_trust(&slf, source).await {
+                        return;
+                    }
+                    let reports: Vec<_> = slf
+                        .engine()
+                        .reload_reports()
+                        .into_iter()
+                        .map(|report| {
+                            format!(
+                                "{} ({} calls, {:?} -> {:?}, {} changed outputs{})",
+                                report.module,
+                                report.samples,
+                                report.old_time,
+                                report.new_time,
+                                report.changed_outputs,
+                                match (&report.regression, report.loaded) {
+                                    (None, _) => String::new(),
+                                    (Some(reason), true) => format!(", regressed: {reason}"),
+                                    (Some(reason), false) => format!(", refused: {reason}"),
+                                }
+                            )
+                        })
+                        .collect();
+                    let response = if reports.is_empty() {
+                        "no reloads checked".to_string()
+                    } else {
+                        reports.join(", ")
+                    };
+                    slf.reply(response_target, response).await;
+                }
+                CommandName::Plain(x) if x == "memory" => {
+                    if !check_trust(&slf, source).await {
+                        return;
+                    }
+                    let response = slf.describe_memory().join(", ");
+                    slf.reply(response_target, response).await;
+                }
+                CommandName::Plain(x) if x == "sizes" => {
+                    if !check_trust(&slf, source).await {
+                        return;
+                    }
+                    let reports: Vec<_> = slf
+                        .engine()
+                        .slim_reports()
+                        .into_iter()
+                        .map(|(module, report)| {
+                            format!(
+                                "{module} ({} bytes{}, compiled in {:?})",
+                                report.size,
+                                if report.stripped.is_empty() {
+                                    String::new()
+                                } else {
+                                    format!(", {} stripped", report.original_size - report.size)
+                                },
+                                report.compile_time,
+                            )
+                        })
+                        .collect();
+                    let response = if reports.is_empty() {
+                        "no modules compiled".to_string()
+                    } else {
+                        reports.join(", ")
+                    };
+                    slf.reply(response_target, response).await;
+                }
                 CommandName::Plain(x) if x == "unload" => {
                     if !check_trust(&slf, source).await {
                         return;
@@ -329,12 +1081,11 @@ mod state {
                     if !check_trust(&slf, source).await {
                         return;
                     }
-                    let available_permits = slf.engine_semaphore.available_permits();
-                    slf.reply(
-                        response_target,
-                        format!("available permits: {available_permits}"),
-                    )
-                    .await;
+                    let response = match slf.engine.available_execution_slots() {
+                        Some(slots) => format!("available permits: {slots}"),
+                        None => "permits are not limited".to_string(),
+                    };
+                    slf.reply(response_target, response).await;
                 }
                 CommandName::Plain(x) if x == "quit" => {
                     if !check_trust(&slf, source).await {
@@ -377,6 +1128,12 @@ mod state {
                 .filter(|x| !x.is_empty())
                 .enumerate()
             {
+                // when the bot is not keeping up, leave room to protocol
+                // traffic: the first line has to do
+                if i > 0 && !self.health.is_healthy() {
+                    trace!(target, "dropped the rest of the reply");
+                    break;
+                }
                 let prefix = if i == 0 { "\x02>\x0f" } else { "\x02:\x0f" };
                 let line = format!("{prefix}{line}");
                 let overhead = self.estimate_overhead(b"PRIVMSG", target);
@@ -402,16 +1159,14 @@ mod state {
                     estimated_size,
                     "want to send"
                 );
+                let waiting = std::time::Instant::now();
                 self.throttler.acquire_one().await;
+                self.health.record_reply_delay(waiting.elapsed());
                 trace!(target, line = fitted, "enqueued");
                 let _ = self.client(|client| client.send_privmsg(target, fitted));
             }
         }
 
-        pub(crate) async fn engine_permit(&self) -> Result<impl Drop + '_, AcquireError> {
-            self.engine_semaphore.acquire().await
-        }
-
         pub(crate) fn engine_epoch_timer(self: &Arc<Self>) -> impl core::future::Future {
             let weak = Arc::downgrade(&self.clone());
             struct ServiceRef(Arc<BotState>);
@@ -431,6 +1186,7 @@ mod state {
                 {
                     *self.known_nickname.write().await = None;
                 }
+                self.health.reset_ping();
                 let stream = client.stream()?;
                 *self.client.write().await = Some(client);
                 match super::irc_stream_handler(stream, self.clone()).await {
@@ -528,12 +1284,35 @@ async fn irc_stream_handler(
                         state.clone(),
                         move |response| async move {
                             if let Some(state) = w.upgrade() {
-                                state.reply(response_target, response).await;
+                                state.reply(response_target, &response).await;
                             }
+                            response
                         },
                     );
                 }
             }
+            Command::PONG(ref server, ref token) => {
+                // servers disagree on which argument carries the token
+                let health = state.health();
+                if !token.as_deref().map_or(false, |token| health.pong(token)) {
+                    health.pong(server);
+                }
+            }
+            Command::JOIN(ref channel, _, _) => {
+                // warm up what this channel uses, now that we joined it
+                let own_nickname = state.client(|c| c.current_nickname().to_owned());
+                if message.source_nickname().is_some()
+                    && message.source_nickname() == own_nickname.as_deref()
+                {
+                    if let Some(budget) = state.prewarm_budget() {
+                        let state = state.clone();
+                        let channel = channel.clone();
+                        tokio::spawn(async move {
+                            state.engine().prewarm_popular(Some(&channel), budget).await;
+                        });
+                    }
+                }
+            }
             Command::Response(response, args) if !args.is_empty() => {
                 // let's extract our last known nickname (some servers might be
                 // non-compliant and not include a target as the first argument
@@ -581,7 +1360,8 @@ fn handle_command<F, Fut>(
     handler: F,
 ) where
     F: FnOnce(String) -> Fut + Send + Sync + 'static,
-    Fut: Future<Output = ()> + Send,
+    // gives the output back, to be recycled
+    Fut: Future<Output = String> + Send,
 {
     let args = cmd.args().to_string();
     let (module_name, entry_point) = match cmd.command() {
@@ -593,17 +1373,41 @@ fn handle_command<F, Fut>(
         }
         CommandName::Namespaced(ns, name) => (ns.to_string(), name.to_string()),
     };
+    // under memory pressure or when lagging, shed commands rather than
+    // queue them
+    let Some(pending) = state.admit_command() else {
+        warn!(cmd = cmd.as_value(), "dropped command under load");
+        return;
+    };
     let task_name = format!("command::{module_name}::{entry_point}");
     let run_task = tokio::task::Builder::new().name(&task_name);
     run_task
         .spawn(async move {
-            let Ok(permit) = state.engine_permit().await else { return; };
-            match state
+            let _pending = pending;
+            // the engine takes care of limiting how many modules run at once,
+            // and gives a pooled buffer for the output, which goes back to
+            // the pool once replied
+            let mut output = String::new();
+            let result = state
                 .engine()
-                .run_module(&module_name, &entry_point, &args)
-                .await
-            {
-                Ok(s) => handler(s).await,
+                .run_module_into(&module_name, &entry_point, &args, &mut output)
+                .await;
+            // names that don't exist are not counted, they would only
+            // push the real ones out
+            if !matches!(
+                result,
+                Err(wotto_engine::Error::ModuleNotFound | wotto_engine::Error::InvalidModuleName)
+            ) {
+                let context = response_target
+                    .starts_with(['#', '&'])
+                    .then_some(response_target.as_str());
+                state.engine().record_invocation(context, &module_name);
+            }
+            match result {
+                Ok(_) => {
+                    let output = handler(output).await;
+                    state.engine().recycle_output(output);
+                }
                 Err(wotto_engine::Error::TimedOut) => {
                     // TODO irc code shouldn't be mixed here I think
                     state
@@ -616,13 +1420,21 @@ fn handle_command<F, Fut>(
                         )
                         .await;
                 }
+                Err(wotto_engine::Error::CircuitOpen) => {
+                    state
+                        .reply(
+                            response_target,
+                            format!(
+                                "{} keeps failing and has been disabled for a while.",
+                                cmd.command()
+                            ),
+                        )
+                        .await;
+                }
                 Err(err) => {
                     error!(error = %err, cmd = cmd.as_value(), "error on command");
                 }
             }
-            // being super-explicit that engine permit is released only after the
-            // whole response has been sent out:
-            drop(permit);
         })
         .unwrap();
 }
@@ -708,8 +1520,110 @@ async fn web_server(state: std::sync::Weak<BotState>) {
         })
         .map(|_| "");
 
+    let list_profiles = warp::path!("profile").and(warp::get()).map({
+        let state = state.clone();
+        move || {
+            let Some(state) = state.upgrade() else { return String::new(); };
+            let mut modules = state.engine().profiled_modules().join("\n");
+            modules.push('\n');
+            modules
+        }
+    });
+
+    let save_profiles = warp::path!("profile" / "save").and(warp::post()).map({
+        let state = state.clone();
+        move || {
+            let Some(state) = state.upgrade() else { return String::new(); };
+            let dir = state.profile_dir();
+            match state.engine().save_profiles(dir) {
+                Ok(count) => {
+                    info!(count, dir, "saved profiles");
+                    format!("saved {count} profiles\n")
+                }
+                Err(err) => {
+                    error!(%err, dir, "cannot save profiles");
+                    String::new()
+                }
+            }
+        }
+    });
+
+    // module names can contain a namespace separator, so match the whole tail
+    let get_profile = warp::path("profile")
+        .and(warp::path::tail())
+        .and(warp::get())
+        .map({
+            let state = state.clone();
+            move |tail: warp::path::Tail| {
+                let profile = state
+                    .upgrade()
+                    .and_then(|state| state.engine().profile(tail.as_str()));
+                match profile {
+                    Some(folded) => warp::reply::with_status(folded, warp::http::StatusCode::OK),
+                    None => {
+                        warp::reply::with_status(String::new(), warp::http::StatusCode::NOT_FOUND)
+                    }
+                }
+            }
+        });
+
+    let list_breakers = warp::path!("breakers").and(warp::get()).map({
+        let state = state.clone();
+        move || {
+            let Some(state) = state.upgrade() else { return String::new(); };
+            let mut breakers = describe_breakers(state.engine()).join("\n");
+            breakers.push('\n');
+            breakers
+        }
+    });
+
+    let get_memory = warp::path!("memory").and(warp::get()).map({
+        let state = state.clone();
+        move || {
+            let Some(state) = state.upgrade() else { return String::new(); };
+            let mut memory = state.describe_memory().join("\n");
+            memory.push('\n');
+            memory
+        }
+    });
+
+    let get_health = warp::path!("health").and(warp::get()).map({
+        let state = state.clone();
+        move || {
+            let (status, body) = match state.upgrade().map(|state| state.check_health()) {
+                Some(Ok(())) => (warp::http::StatusCode::OK, "ok\n".to_string()),
+                Some(Err(problems)) => (
+                    warp::http::StatusCode::SERVICE_UNAVAILABLE,
+                    format!("unhealthy: {}\n", problems.join(", ")),
+                ),
+                None => (
+                    warp::http::StatusCode::SERVICE_UNAVAILABLE,
+                    "shutting down\n".to_string(),
+                ),
+            };
+            warp::reply::with_status(body, status)
+        }
+    });
+
+    let get_metrics = warp::path!("metrics").and(warp::get()).map({
+        let state = state.clone();
+        move || {
+            let Some(state) = state.upgrade() else { return String::new(); };
+            state.metrics()
+        }
+    });
+
     #[allow(clippy::let_with_type_underscore)]
-    let filter: _ = hello.or(load_module).or(join_channel);
+    let filter: _ = hello
+        .or(load_module)
+        .or(join_channel)
+        .or(list_profiles)
+        .or(save_profiles)
+        .or(get_profile)
+        .or(list_breakers)
+        .or(get_memory)
+        .or(get_health)
+        .or(get_metrics);
 
     warp::serve(filter).run(([127, 0, 0, 1], 3030)).await;
 }
@@ -0,0 +1,250 @@
+//! Whether the bot keeps up with its work.
+//!
+//! Three signals are watched: how late the runtime wakes up a task that
+//! sleeps (scheduler lag), how long the server takes to answer a PING sent by
+//! the bot (which includes the time spent in the outgoing queue), and how
+//! long replies wait for the throttler. The IRC client only notices trouble
+//! when the server stops answering its own pings, and by then it is about to
+//! be disconnected. Here, as soon as a signal goes over its threshold, module
+//! commands are shed and replies are cut to their first line, to leave the
+//! runtime and the connection to protocol traffic until things calm down.
+
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+use tracing::{info, warn};
+
+#[derive(Debug, Clone)]
+pub(crate) struct HealthConfig {
+    pub(crate) max_scheduler_lag: Duration,
+    pub(crate) max_ping_rtt: Duration,
+    pub(crate) max_reply_delay: Duration,
+}
+
+impl Default for HealthConfig {
+    fn default() -> Self {
+        Self {
+            max_scheduler_lag: Duration::from_millis(200),
+            max_ping_rtt: Duration::from_secs(5),
+            max_reply_delay: Duration::from_secs(20),
+        }
+    }
+}
+
+/// Prefix of the tokens of the PINGs sent by the monitor, to tell their
+/// PONGs apart from the ones answering the client.
+const PING_TOKEN_PREFIX: &str = "wotto-health-";
+
+#[derive(Debug, Clone, Default)]
+pub(crate) struct HealthReport {
+    pub(crate) scheduler_lag: Duration,
+    pub(crate) ping_rtt: Duration,
+    pub(crate) reply_delay: Duration,
+    /// Signals over their threshold.
+    pub(crate) problems: Vec<&'static str>,
+    /// Module commands dropped since the start.
+    pub(crate) shed_commands: u64,
+}
+
+pub(crate) struct Health {
+    config: HealthConfig,
+    /// Largest values seen since the last evaluation, in microseconds.
+    scheduler_lag: AtomicU64,
+    reply_delay: AtomicU64,
+    /// Last round trip measured, in microseconds.
+    ping_rtt: AtomicU64,
+    /// Token and send time of the PING waiting for its PONG.
+    ping: Mutex<Option<(String, Instant)>>,
+    pings: AtomicU64,
+    healthy: AtomicBool,
+    shed_commands: AtomicU64,
+    last: Mutex<HealthReport>,
+}
+
+fn micros(duration: Duration) -> u64 {
+    duration.as_micros().try_into().unwrap_or(u64::MAX)
+}
+
+impl Health {
+    pub(crate) fn new(config: HealthConfig) -> Self {
+        Self {
+            config,
+            scheduler_lag: AtomicU64::new(0),
+            reply_delay: AtomicU64::new(0),
+            ping_rtt: AtomicU64::new(0),
+            ping: Mutex::default(),
+            pings: AtomicU64::new(0),
+            healthy: AtomicBool::new(true),
+            shed_commands: AtomicU64::new(0),
+            last: Mutex::default(),
+        }
+    }
+
+    pub(crate) fn record_scheduler_lag(&self, lag: Duration) {
+        self.scheduler_lag.fetch_max(micros(lag), Ordering::Relaxed);
+    }
+
+    pub(crate) fn record_reply_delay(&self, delay: Duration) {
+        self.reply_delay.fetch_max(micros(delay), Ordering::Relaxed);
+    }
+
+    /// Token for a new PING, or `None` if the last one was not answered
+    /// yet (its time so far counts as the round trip).
+    pub(crate) fn start_ping(&self) -> Option<String> {
+        let mut ping = self.ping.lock().unwrap();
+        if ping.is_some() {
+            return None;
+        }
+        let token = format!(
+            "{PING_TOKEN_PREFIX}{}",
+            self.pings.fetch_add(1, Ordering::Relaxed)
+        );
+        *ping = Some((token.clone(), Instant::now()));
+        Some(token)
+    }
+
+    /// Handle the token of a PONG. Returns whether it answered the PING of
+    /// the monitor.
+    pub(crate) fn pong(&self, token: &str) -> bool {
+        let mut ping = self.ping.lock().unwrap();
+        match &*ping {
+            Some((sent, start)) if sent == token => {
+                self.ping_rtt
+                    .store(micros(start.elapsed()), Ordering::Relaxed);
+                *ping = None;
+                true
+            }
+            _ => false,
+        }
+    }
+
+    /// Forget the PING in flight, which will never be answered on a new
+    /// connection.
+    pub(crate) fn reset_ping(&self) {
+        *self.ping.lock().unwrap() = None;
+        self.ping_rtt.store(0, Ordering::Relaxed);
+    }
+
+    /// Compare the signals gathered since the last evaluation with their
+    /// thresholds, and decide whether the bot is healthy until the next one.
+    pub(crate) fn evaluate(&self) -> HealthReport {
+        let in_flight = self
+            .ping
+            .lock()
+            .unwrap()
+            .as_ref()
+            .map_or(Duration::ZERO, |(_, start)| start.elapsed());
+        let since_last =
+            |signal: &AtomicU64| Duration::from_micros(signal.swap(0, Ordering::Relaxed));
+        let mut report = HealthReport {
+            scheduler_lag: since_last(&self.scheduler_lag),
+            ping_rtt: Duration::from_micros(self.ping_rtt.load(Ordering::Relaxed)).max(in_flight),
+            reply_delay: since_last(&self.reply_delay),
+            problems: vec![],
+            shed_commands: self.shed_commands.load(Ordering::Relaxed),
+        };
+        let checks = [
+            (
+                "scheduler lag",
+                report.scheduler_lag,
+                self.config.max_scheduler_lag,
+            ),
+            ("ping round trip", report.ping_rtt, self.config.max_ping_rtt),
+            (
+                "reply delay",
+                report.reply_delay,
+                self.config.max_reply_delay,
+            ),
+        ];
+        for (signal, value, threshold) in checks {
+            if value > threshold {
+                report.problems.push(signal);
+            }
+        }
+        let healthy = report.problems.is_empty();
+        if self.healthy.swap(healthy, Ordering::Relaxed) != healthy {
+            match healthy {
+                true => info!("healthy again, accepting module commands"),
+                false => warn!(
+                    problems = ?report.problems,
+                    scheduler_lag = ?report.scheduler_lag,
+                    ping_rtt = ?report.ping_rtt,
+                    reply_delay = ?report.reply_delay,
+                    "overloaded, shedding module commands"
+                ),
+            }
+        }
+        *self.last.lock().unwrap() = report.clone();
+        report
+    }
+
+    pub(crate) fn is_healthy(&self) -> bool {
+        self.healthy.load(Ordering::Relaxed)
+    }
+
+    /// Count a module command that was dropped.
+    pub(crate) fn shed(&self) {
+        self.shed_commands.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// The last evaluation.
+    pub(crate) fn report(&self) -> HealthReport {
+        let mut report = self.last.lock().unwrap().clone();
+        report.shed_commands = self.shed_commands.load(Ordering::Relaxed);
+        report
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn health() -> Health {
+        Health::new(HealthConfig {
+            max_scheduler_lag: Duration::from_millis(100),
+            max_ping_rtt: Duration::from_secs(1),
+            max_reply_delay: Duration::from_secs(1),
+        })
+    }
+
+    #[test]
+    fn thresholds() {
+        let health = health();
+        health.record_scheduler_lag(Duration::from_millis(150));
+        health.record_scheduler_lag(Duration::from_millis(10));
+        health.record_reply_delay(Duration::from_millis(10));
+        let report = health.evaluate();
+        assert_eq!(report.scheduler_lag, Duration::from_millis(150));
+        assert_eq!(report.problems, ["scheduler lag"]);
+        assert!(!health.is_healthy());
+        // each evaluation only looks at what happened since the last one
+        assert!(health.evaluate().problems.is_empty());
+        assert!(health.is_healthy());
+    }
+
+    #[test]
+    fn pings() {
+        let health = health();
+        let token = health.start_ping().unwrap();
+        assert!(token.starts_with(PING_TOKEN_PREFIX));
+        // one at a time
+        assert!(health.start_ping().is_none());
+        assert!(!health.pong("irc.example.net"));
+        assert!(health.pong(&token));
+        assert!(!health.pong(&token));
+        assert!(health.evaluate().ping_rtt < Duration::from_secs(1));
+        let token = health.start_ping().unwrap();
+        health.reset_ping();
+        assert!(!health.pong(&token));
+        assert!(health.start_ping().is_some());
+    }
+
+    #[test]
+    fn shed_commands() {
+        let health = health();
+        health.shed();
+        health.shed();
+        assert_eq!(health.report().shed_commands, 2);
+    }
+}
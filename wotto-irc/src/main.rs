@@ -2,6 +2,7 @@
 #![feature(arbitrary_self_types)]
 
 mod bot;
+mod health;
 mod parsing;
 mod throttling;
 mod tracing;